@@ -0,0 +1,114 @@
+#include "first.h"
+
+#include "algo_hmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ck.h"
+
+/* open-addressing hash map (Robin Hood hashing with backward-shift deletion)
+ *
+ * Entries are kept ordered by distance from initial bucket, so lookup of a
+ * key not present stops early (when probe distance exceeds distance of
+ * entry in slot).  Deletion shifts subsequent entries back one slot,
+ * instead of leaving tombstones, so probe sequences stay short under churn.
+ * Table grows (doubles) at 7/8 load.
+ */
+
+#define HMAP_MIN_SLOTS 64
+
+void hmap_free (hmap * const h)
+{
+    free(h->slots);
+    memset(h, 0, sizeof(*h));
+}
+
+static void hmap_place (hmap * const h, uint32_t key, void *data)
+{
+    /* (key not present in map; map has at least one empty slot) */
+    hmap_slot * const slots = h->slots;
+    const uint32_t mask = h->mask;
+    uint32_t i = hmap_bucket(h, key);
+    for (uint32_t d = 1; ; ++d, i = (i+1) & mask) {
+        hmap_slot * const s = slots+i;
+        if (0 == s->dib) {
+            s->key = key;
+            s->dib = d;
+            s->data = data;
+            return;
+        }
+        if (s->dib < d) {
+            /* take slot from entry closer to its initial bucket
+             * and continue placing displaced entry */
+            const uint32_t tkey = s->key;
+            const uint32_t tdib = s->dib;
+            void * const tdata = s->data;
+            s->key = key;
+            s->dib = d;
+            s->data = data;
+            key = tkey;
+            d = tdib;
+            data = tdata;
+        }
+    }
+}
+
+__attribute_cold__
+__attribute_noinline__
+static void hmap_resize (hmap * const h, const uint32_t nslots)
+{
+    hmap_slot * const oslots = h->slots;
+    const uint32_t onslots = hmap_slots(h);
+    uint32_t shift = 32;
+    for (uint32_t n = nslots; n > 1; n >>= 1) --shift;
+    h->slots = ck_calloc(nslots, sizeof(hmap_slot));
+    h->mask = nslots - 1;
+    h->shift = shift;
+    for (uint32_t i = 0; i < onslots; ++i) {
+        if (oslots[i].dib)
+            hmap_place(h, oslots[i].key, oslots[i].data);
+    }
+    free(oslots);
+}
+
+void * hmap_insert (hmap * const h, const uint32_t key, void * const data)
+{
+    const uint32_t i = hmap_find_slot(h, key);
+    if (i < hmap_slots(h)) {
+        void * const odata = h->slots[i].data;
+        h->slots[i].data = data;
+        return odata;
+    }
+    if (NULL == h->slots)
+        hmap_resize(h, HMAP_MIN_SLOTS);
+    else if (h->used + 1 > (h->mask + 1) - ((h->mask + 1) >> 3))
+        hmap_resize(h, (h->mask + 1) << 1);
+    hmap_place(h, key, data);
+    ++h->used;
+    return NULL;
+}
+
+void * hmap_remove_at (hmap * const h, uint32_t i)
+{
+    hmap_slot * const slots = h->slots;
+    const uint32_t mask = h->mask;
+    void * const data = slots[i].data;
+    /* backward-shift subsequent entries not in their initial bucket */
+    for (uint32_t j = (i+1) & mask; slots[j].dib > 1; i = j, j = (j+1) & mask) {
+        slots[i].key = slots[j].key;
+        slots[i].dib = slots[j].dib - 1;
+        slots[i].data = slots[j].data;
+    }
+    slots[i].key = 0;
+    slots[i].dib = 0;
+    slots[i].data = NULL;
+    --h->used;
+    return data;
+}
+
+void * hmap_remove (hmap * const h, const uint32_t key)
+{
+    const uint32_t i = hmap_find_slot(h, key);
+    return i < hmap_slots(h) ? hmap_remove_at(h, i) : NULL;
+}
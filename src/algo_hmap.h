@@ -0,0 +1,84 @@
+#ifndef INCLUDED_ALGO_HMAP_H
+#define INCLUDED_ALGO_HMAP_H
+#include "first.h"
+
+/* open-addressing hash map (Robin Hood hashing with backward-shift deletion)
+ *
+ * Maps 32-bit key (typically a hash of a string, e.g. djbhash()) to a data
+ * pointer, with one entry per key.  Lookup probes a contiguous array of slots
+ * storing key and probe distance, so does not modify the map or chase
+ * pointers (as does a splay tree).  Caller compares full name stored in data
+ * (if needed) to detect hash collisions, as is done with algo_splaytree.h.
+ *
+ * Iteration: walk slots [0 .. hmap_slots(h)-1] and skip NULL data.
+ * hmap_remove_at() may be called during iteration; the current slot index
+ * must then be examined again, since an entry might have shifted into it.
+ * (An entry might be visited twice if removal shifts an entry from the
+ *  beginning of the slot array into the last slot of the array.)
+ */
+
+typedef struct hmap_slot {
+    uint32_t key;
+    uint32_t dib;  /* distance from initial bucket + 1; 0 if slot empty */
+    void *data;
+} hmap_slot;
+
+typedef struct hmap {
+    hmap_slot *slots;
+    uint32_t mask; /* num slots - 1 */
+    uint32_t used;
+    uint32_t shift;
+} hmap;
+
+__attribute_cold__
+void hmap_free (hmap *h);
+
+__attribute_pure__
+static inline uint32_t hmap_slots (const hmap * const h);
+static inline uint32_t hmap_slots (const hmap * const h)
+{
+    return h->slots ? h->mask + 1 : 0;
+}
+
+__attribute_pure__
+static inline uint32_t hmap_bucket (const hmap * const h, const uint32_t key);
+static inline uint32_t hmap_bucket (const hmap * const h, const uint32_t key)
+{
+    /* Fibonacci hashing; use high bits (low bits of key might be weak) */
+    return (uint32_t)(key * 2654435769u) >> h->shift;
+}
+
+__attribute_pure__
+static inline uint32_t hmap_find_slot (const hmap * const h, const uint32_t key);
+static inline uint32_t hmap_find_slot (const hmap * const h, const uint32_t key)
+{
+    /* returns slot index, or hmap_slots(h) if not found */
+    if (NULL == h->slots) return 0;
+    const hmap_slot * const slots = h->slots;
+    const uint32_t mask = h->mask;
+    uint32_t i = hmap_bucket(h, key);
+    for (uint32_t d = 1; slots[i].dib >= d; ++d, i = (i+1) & mask) {
+        if (slots[i].key == key) return i;
+    }
+    return mask + 1;
+}
+
+__attribute_pure__
+static inline void * hmap_find (const hmap * const h, const uint32_t key);
+static inline void * hmap_find (const hmap * const h, const uint32_t key)
+{
+    const uint32_t i = hmap_find_slot(h, key);
+    return i < hmap_slots(h) ? h->slots[i].data : NULL;
+}
+
+/* insert data (must not be NULL) for key;
+ * returns prior data for key (which has been replaced), or NULL */
+void * hmap_insert (hmap *h, uint32_t key, void *data);
+
+/* remove entry for key; returns data removed, or NULL if not found */
+void * hmap_remove (hmap *h, uint32_t key);
+
+/* remove entry in slot (slot must not be empty); returns data removed */
+void * hmap_remove_at (hmap *h, uint32_t i);
+
+#endif
@@ -74,6 +74,11 @@ struct connection {
 
 	connection *next;
 	connection *prev;
+
+	/* timer wheel slot list (see connections.c) */
+	connection *tw_next;
+	connection **tw_pprev;
+	unix_time64_t tw_ts;
 };
 
 /* log_con_jqueue is in log.c to be defined in shared object */
@@ -145,6 +150,8 @@ typedef struct server_socket {
 	fdnode *fdn;
 	server *srv;
 	buffer *srv_token;
+	int *reuseport_fds; /* per-worker listen sockets (workers 1..n) */
+	uint32_t reuseport_n;
 } server_socket;
 
 typedef struct {
@@ -22,6 +22,16 @@
 #include <errno.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1<<1)
+#endif
+#endif
+
 
 #ifdef HAVE_MMAP
 
@@ -66,7 +76,10 @@ static int chunk_mmap_flags = MAP_SHARED;
 static size_t chunk_buf_sz = 8192;
 static chunk *chunks, *chunks_oversized, *chunks_filechunk;
 static chunk *chunk_buffers;
-static int chunks_oversized_n;
+static uint32_t chunks_n, chunks_oversized_n, chunks_filechunk_n;
+/* chunk pool watermarks (num chunks kept in pool; kept at periodic trim) */
+static uint32_t chunks_high = UINT32_MAX, chunks_low;
+static uint32_t chunks_oversized_high = 64, chunks_oversized_low;
 static const array *chunkqueue_default_tempdirs = NULL;
 static off_t chunkqueue_default_tempfile_size = DEFAULT_TEMPFILE_SIZE;
 static const char *env_tmpdir = NULL;
@@ -78,6 +91,16 @@ void chunkqueue_set_chunk_size (size_t sz)
     chunk_buf_sz = sz > 0 ? x : 8192;
 }
 
+void chunkqueue_set_chunk_pool_limits (uint32_t high, uint32_t low, uint32_t oversized_high, uint32_t oversized_low)
+{
+    chunks_high = high ? high : UINT32_MAX;
+    chunks_low = low < chunks_high ? low : chunks_high;
+    chunks_oversized_high = oversized_high;
+    chunks_oversized_low = oversized_low < oversized_high
+      ? oversized_low
+      : oversized_high;
+}
+
 void chunkqueue_set_tempdirs_default_reset (void)
 {
     chunk_buf_sz = 8192;
@@ -126,14 +149,105 @@ static chunk *chunk_init(void) {
 	return c;
 }
 
+#if defined(__linux__) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+#define CHUNK_HUGEPAGES
+
+static size_t chunk_hugepage_sz; /* 0 if disabled */
+static int chunk_hugepage_numa_local;
+static uint32_t chunk_hugepage_allocs, chunk_hugepage_numa_binds;
+
+__attribute_cold__
+static size_t chunk_hugepage_size (void)
+{
+    /* transparent hugepage (THP) size; 0 if THP disabled */
+    char buf[64];
+    ssize_t rd;
+    int fd = fdevent_open_cloexec("/sys/kernel/mm/transparent_hugepage/enabled",
+                                  1, O_RDONLY, 0);
+    if (fd < 0) return 0;
+    rd = read(fd, buf, sizeof(buf)-1);
+    close(fd);
+    if (rd <= 0) return 0;
+    buf[rd] = '\0';
+    if (NULL != strstr(buf, "[never]")) return 0;
+
+    size_t sz = 2 * 1024 * 1024;
+    fd = fdevent_open_cloexec("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size",
+                              1, O_RDONLY, 0);
+    if (fd < 0) return sz;
+    rd = read(fd, buf, sizeof(buf)-1);
+    close(fd);
+    if (rd > 0) {
+        buf[rd] = '\0';
+        const unsigned long n = strtoul(buf, NULL, 10);
+        if (n && !(n & (n-1))) sz = (size_t)n;
+    }
+    return sz;
+}
+
+__attribute_noinline__
+static int chunk_init_sz_hugepage(buffer * const b, const size_t sz) {
+    /* allocate hugepage-aligned buffer and request THP backing
+     * (memory remains allocated by malloc family, so that free() and
+     *  realloc() in buffer.c and elsewhere continue to work as usual)
+     * (size is exact hugepage multiple, not power-2 + 1 as would be allocated
+     *  by buffer_realloc(), so that last hugepage is not partially used) */
+    size_t bsz = chunk_hugepage_sz;
+    while (bsz < sz) bsz <<= 1;
+    void *p;
+    if (0 != posix_memalign(&p, chunk_hugepage_sz, bsz))
+        return 0;
+    /* bind to NUMA node of CPU on which (pinned) worker runs before pages
+     * are first touched; move pages if memory reused from malloc free list */
+    if (chunk_hugepage_numa_local
+        && 0 == syscall(SYS_mbind, p, bsz, MPOL_LOCAL, NULL, 0, MPOL_MF_MOVE))
+        ++chunk_hugepage_numa_binds;
+    (void)madvise(p, bsz, MADV_HUGEPAGE);
+    ++chunk_hugepage_allocs;
+    b->ptr = p;
+    b->size = bsz;
+    b->used = 0;
+    return 1;
+}
+
+#endif
+
 __attribute_noinline__
 __attribute_returns_nonnull__
 static chunk *chunk_init_sz(size_t sz) {
 	chunk * const restrict c = chunk_init();
+      #ifdef CHUNK_HUGEPAGES
+	if (chunk_hugepage_sz && sz >= chunk_hugepage_sz
+	    && chunk_init_sz_hugepage(c->mem, sz))
+		return c;
+      #endif
 	buffer_string_prepare_copy(c->mem, sz-1);
 	return c;
 }
 
+int chunkqueue_set_chunk_hugepages (int enable)
+{
+  #ifdef CHUNK_HUGEPAGES
+    chunk_hugepage_sz = enable ? chunk_hugepage_size() : 0;
+    return (!enable || chunk_hugepage_sz) ? 0 : -1;
+  #else
+    return enable ? -1 : 0;
+  #endif
+}
+
+void chunkqueue_set_chunk_numa_local (void)
+{
+    /* discard chunk buffers pooled by parent (possibly on other NUMA node)
+     * and prefer memory on local NUMA node for subsequent allocations */
+    chunkqueue_chunk_pool_clear();
+  #if defined(__linux__) && defined(SYS_set_mempolicy)
+    (void)syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0);
+  #endif
+  #ifdef CHUNK_HUGEPAGES
+    chunk_hugepage_numa_local = 1;
+  #endif
+}
+
 #ifdef HAVE_MMAP
 
 __attribute_malloc__
@@ -263,7 +377,91 @@ chunk_file_pread_chunk (chunk *c, void *buf, size_t count)
     return chunk_file_pread(c->file.fd, buf, count, c->offset);
 }
 
+#ifdef HAVE_SPLICE
+
+/* pipes used to relay data from socket to socket with splice()
+ * (see chunkqueue_append_splice_sock_pipe())
+ * (idle pipes are kept in a small pool for reuse; pipe is closed instead
+ *  if data remains in pipe when chunk is released, e.g. aborted response) */
+
+#define CHUNK_PIPES_MAX 16
+
+typedef struct chunk_pipe {
+    struct chunk_pipe *next;
+    int fd[2];
+} chunk_pipe;
+
+static chunk_pipe *chunk_pipes;
+static uint32_t chunk_pipes_n;
+static int chunk_splice_relay;
+static int *chunk_pipes_cur_fds; /* &srv->cur_fds; pipe fds are counted */
+
+static chunk_pipe * chunk_pipe_acquire(void) {
+    chunk_pipe *p = chunk_pipes;
+    if (p) {
+        chunk_pipes = p->next;
+        --chunk_pipes_n;
+        return p;
+    }
+    p = ck_malloc(sizeof(*p));
+    if (0 != fdevent_pipe_cloexec(p->fd, 0)) {
+        free(p);
+        return NULL;
+    }
+    if (chunk_pipes_cur_fds) *chunk_pipes_cur_fds += 2;
+    return p;
+}
+
+static void chunk_pipe_free(chunk_pipe * const p) {
+    close(p->fd[0]);
+    close(p->fd[1]);
+    free(p);
+    if (chunk_pipes_cur_fds) *chunk_pipes_cur_fds -= 2;
+}
+
+static void chunk_pipe_release(chunk_pipe * const p, const off_t remaining) {
+    if (0 == remaining && chunk_pipes_n < CHUNK_PIPES_MAX) {
+        ++chunk_pipes_n;
+        p->next = chunk_pipes;
+        chunk_pipes = p;
+    }
+    else
+        chunk_pipe_free(p);
+}
+
+__attribute_cold__
+static void chunk_pipes_clear(void) {
+    for (chunk_pipe *next, *p = chunk_pipes; p; p = next) {
+        next = p->next;
+        chunk_pipe_free(p);
+    }
+    chunk_pipes = NULL;
+    chunk_pipes_n = 0;
+}
+
+#endif /* HAVE_SPLICE */
+
+static void (*chunk_aio_release)(uint32_t);
+
+__attribute_cold__
+void chunkqueue_set_aio_release(void (*fn)(uint32_t)) {
+    chunk_aio_release = fn;
+}
+
 static void chunk_reset_file_chunk(chunk *c) {
+	if (c->file.aio) {
+		/*(cancel before fd close; buffer must outlive read in flight)*/
+		if (chunk_aio_release) chunk_aio_release(c->file.aio);
+		c->file.aio = 0;
+	}
+  #ifdef HAVE_SPLICE
+	if (c->file.is_pipe) {
+		c->file.is_pipe = 0;
+		chunk_pipe_release(c->file.ref, c->file.length - c->offset);
+		c->file.ref = NULL;
+		c->file.fd = -1; /*(pipe fds owned by chunk_pipe)*/
+	}
+  #endif
 	if (c->file.is_temp) {
 		c->file.is_temp = 0;
 	  #ifdef _WIN32 /*(not expecting c->file.refchg w/ .is_temp)*/
@@ -307,6 +505,31 @@ static void chunk_free(chunk *c) {
 	free(c);
 }
 
+static inline int chunk_mem_is_buf_sz(const size_t sz) {
+    /* power-2 + 1 from buffer_realloc(); exact power-2 if hugepage-backed */
+    return (sz|1) == (chunk_buf_sz|1);
+}
+
+static void chunk_push(chunk * const c) {
+    /*(c must have been reset; chunk_mem_is_buf_sz(c->mem->size))*/
+    if (chunks_n < chunks_high) {
+        ++chunks_n;
+        c->next = chunks;
+        chunks = c;
+    }
+    else
+        chunk_free(c);
+}
+
+static chunk * chunk_pop(void) {
+    chunk * const c = chunks;
+    if (c) {
+        --chunks_n;
+        chunks = c->next;
+    }
+    return c;
+}
+
 static chunk * chunk_pop_oversized(size_t sz) {
     /* future: might have buckets of certain sizes, up to socket buf sizes */
     if (chunks_oversized && chunks_oversized->mem->size >= sz) {
@@ -320,7 +543,7 @@ static chunk * chunk_pop_oversized(size_t sz) {
 
 static void chunk_push_oversized(chunk * const c, const size_t sz) {
     /* XXX: chunk_buffer_yield() may have removed need for list size limit */
-    if (chunks_oversized_n < 64 && chunk_buf_sz >= 4096) {
+    if (chunks_oversized_n < chunks_oversized_high && chunk_buf_sz >= 4096) {
         ++chunks_oversized_n;
         chunk **co = &chunks_oversized;
         while (*co && sz < (*co)->mem->size) co = &(*co)->next;
@@ -344,11 +567,8 @@ static buffer * chunk_buffer_acquire_sz(const size_t sz) {
     chunk *c;
     buffer *b;
     if (sz <= (chunk_buf_sz|1)) {
-        if (chunks) {
-            c = chunks;
-            chunks = c->next;
-        }
-        else
+        c = chunk_pop();
+        if (NULL == c)
             c = chunk_init_sz(chunk_buf_sz);
     }
     else {
@@ -380,10 +600,8 @@ void chunk_buffer_release(buffer *b) {
         chunk_buffers = c->next;
         c->mem = b;
         buffer_clear(b);
-        if (b->size == (chunk_buf_sz|1)) {
-            c->next = chunks;
-            chunks = c;
-        }
+        if (chunk_mem_is_buf_sz(b->size))
+            chunk_push(c);
         else if (b->size > chunk_buf_sz)
             chunk_push_oversized(c, b->size);
         else
@@ -395,7 +613,7 @@ void chunk_buffer_release(buffer *b) {
 }
 
 void chunk_buffer_yield(buffer *b) {
-    if (b->size == (chunk_buf_sz|1)) return;
+    if (chunk_mem_is_buf_sz(b->size)) return;
 
     buffer * const cb = chunk_buffer_acquire_sz(chunk_buf_sz);
     buffer tb = *b;
@@ -424,11 +642,8 @@ __attribute_noinline__
 __attribute_returns_nonnull__
 static chunk * chunk_acquire(size_t sz) {
     if (sz <= (chunk_buf_sz|1)) {
-        if (chunks) {
-            chunk *c = chunks;
-            chunks = c->next;
-            return c;
-        }
+        chunk * const c = chunk_pop();
+        if (c) return c;
         sz = chunk_buf_sz;
     }
     else {
@@ -443,10 +658,9 @@ static chunk * chunk_acquire(size_t sz) {
 
 static void chunk_release(chunk *c) {
     const size_t sz = c->mem->size;
-    if (sz == (chunk_buf_sz|1)) {
+    if (chunk_mem_is_buf_sz(sz)) {
         chunk_reset(c);
-        c->next = chunks;
-        chunks = c;
+        chunk_push(c);
     }
     else if (sz > chunk_buf_sz) {
         chunk_reset(c);
@@ -454,6 +668,7 @@ static void chunk_release(chunk *c) {
     }
     else if (c->type == FILE_CHUNK) {
         chunk_reset(c);
+        ++chunks_filechunk_n;
         c->next = chunks_filechunk;
         chunks_filechunk = c;
     }
@@ -467,34 +682,71 @@ static chunk * chunk_acquire_filechunk(void) {
     if (chunks_filechunk) {
         chunk *c = chunks_filechunk;
         chunks_filechunk = c->next;
+        --chunks_filechunk_n;
         return c;
     }
     return chunk_init();
 }
 
-void chunkqueue_chunk_pool_clear(void)
-{
-    for (chunk *next, *c = chunks; c; c = next) {
-        next = c->next;
-        chunk_free(c);
-    }
-    chunks = NULL;
-    for (chunk *next, *c = chunks_oversized; c; c = next) {
-        next = c->next;
-        chunk_free(c);
-    }
-    chunks_oversized = NULL;
-    chunks_oversized_n = 0;
-    for (chunk *next, *c = chunks_filechunk; c; c = next) {
+static uint32_t chunk_pool_list_trim(chunk **cp, uint32_t n, uint32_t keep) {
+    /* keep (up to) first 'keep' chunks in list; free the rest */
+    if (keep > n) keep = n;
+    for (uint32_t i = 0; i < keep; ++i) cp = &(*cp)->next;
+    for (chunk *next, *c = *cp; c; c = next) {
         next = c->next;
         chunk_free(c);
     }
-    chunks_filechunk = NULL;
+    *cp = NULL;
+    return keep;
+}
+
+void chunkqueue_chunk_pool_trim(void)
+{
+    chunks_n =
+      chunk_pool_list_trim(&chunks, chunks_n, chunks_low);
+    chunks_oversized_n =
+      chunk_pool_list_trim(&chunks_oversized, chunks_oversized_n,
+                           chunks_oversized_low);
+    chunks_filechunk_n =
+      chunk_pool_list_trim(&chunks_filechunk, chunks_filechunk_n, 0);
+}
+
+void chunkqueue_chunk_pool_clear(void)
+{
+    chunks_n =
+      chunk_pool_list_trim(&chunks, chunks_n, 0);
+    chunks_oversized_n =
+      chunk_pool_list_trim(&chunks_oversized, chunks_oversized_n, 0);
+    chunks_filechunk_n =
+      chunk_pool_list_trim(&chunks_filechunk, chunks_filechunk_n, 0);
+}
+
+void chunkqueue_chunk_pool_stats(chunk_pool_stats * const st)
+{
+    st->chunks = chunks_n;
+    st->oversized = chunks_oversized_n;
+    st->filechunks = chunks_filechunk_n;
+  #ifdef CHUNK_HUGEPAGES
+    st->hugepage_allocs = chunk_hugepage_allocs;
+    st->hugepage_numa_binds = chunk_hugepage_numa_binds;
+  #else
+    st->hugepage_allocs = 0;
+    st->hugepage_numa_binds = 0;
+  #endif
+    st->bytes = (size_t)chunks_n * (chunk_buf_sz+1);
+    for (const chunk *c = chunks_oversized; c; c = c->next)
+        st->bytes += c->mem->size;
+    for (const chunk *c = chunks_filechunk; c; c = c->next)
+        st->bytes += c->mem->size;
 }
 
 void chunkqueue_chunk_pool_free(void)
 {
     chunkqueue_chunk_pool_clear();
+  #ifdef HAVE_SPLICE
+    chunk_pipes_clear();
+    chunk_pipes_cur_fds = NULL;
+  #endif
     for (chunk *next, *c = chunk_buffers; c; c = next) {
         next = c->next;
       #if 1 /*(chunk_buffers contains MEM_CHUNK with (c->mem == NULL))*/
@@ -1228,6 +1480,15 @@ void chunkqueue_internal_pipes(int init) {
     if (-1 != cqpipes[1]) { close(cqpipes[1]); cqpipes[1] = -1; }
     if (init)
         if (0 != fdevent_pipe_cloexec(cqpipes, 262144)) { } /*(ignore error)*/
+    chunk_pipes_clear();
+}
+
+__attribute_cold__
+void chunkqueue_set_splice_relay(int enable, int *cur_fds) {
+    chunk_splice_relay = enable;
+    if (!enable)
+        chunk_pipes_clear();
+    chunk_pipes_cur_fds = cur_fds;
 }
 
 __attribute_cold__
@@ -1269,6 +1530,46 @@ ssize_t chunkqueue_append_splice_sock_tempfile(chunkqueue * const restrict cq, c
     return wr;
 }
 
+ssize_t chunkqueue_append_splice_sock_pipe(chunkqueue * const cq, const int fd, unsigned int len) {
+    /* splice() socket data into pipe at end of chunkqueue; data is later
+     * splice()d from pipe to the client socket without copying to userspace
+     * (see network_write.c).  Caller must ensure that cq is written directly
+     * to a socket (not TLS, not HTTP/2 framed) and that response body is not
+     * transformed (e.g. no Transfer-Encoding: chunked, no compression).
+     * returns num bytes relayed, or 0 if not handled here (pipe full,
+     * not enabled, or error, which caller should detect via read()) */
+    chunk *c = cq->last;
+    if (NULL == c || FILE_CHUNK != c->type || !c->file.is_pipe) {
+        if (!chunk_splice_relay) return 0;
+        /* limit to one pipe per chunkqueue; wait for prior pipe to drain */
+        for (const chunk *x = cq->first; x; x = x->next) {
+            if (x->type == FILE_CHUNK && x->file.is_pipe) return 0;
+        }
+        chunk_pipe * const p = chunk_pipe_acquire();
+        if (NULL == p) return 0;
+        c = chunk_acquire_filechunk();
+        chunkqueue_append_chunk(cq, c);
+        c->type = FILE_CHUNK;
+        c->offset = 0;
+        c->file.length = 0;
+        c->file.fd = p->fd[0];
+        c->file.is_pipe = 1;
+        c->file.ref = p;
+    }
+
+    const chunk_pipe * const p = c->file.ref;
+    ssize_t wr = splice(fd, NULL, p->fd[1], NULL, len,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (__builtin_expect( (wr > 0), 1)) {
+        c->file.length += wr;
+        cq->bytes_in += wr;
+        return wr;
+    }
+    if (0 == chunk_remaining_length(c))
+        chunkqueue_remove_empty_chunks(cq); /*(return pipe to pool)*/
+    return 0;
+}
+
 #endif /* HAVE_SPLICE */
 
 int chunkqueue_steal_with_tempfiles(chunkqueue * const restrict dest, chunkqueue * const restrict src, off_t len, log_error_st * const restrict errh) {
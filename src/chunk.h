@@ -35,8 +35,11 @@ typedef struct chunk {
 
 		int    fd;
 		uint8_t is_temp; /* file is temporary and will be deleted if on cleanup */
-		uint8_t busy;    /* file chunk not in page cache; reading might block */
+		uint8_t busy;    /* file chunk not in page cache; reading might block
+		                  * (2: async read in flight; owner is woken) */
 		uint8_t flagmask;/* (internal; used with preadv2() RWF_NOWAIT) */
+		uint8_t is_pipe; /* fd is read end of pipe (no offset; splice() out) */
+		uint32_t aio;    /* id of async read op of chunk (0 if none) */
 	  #if defined(HAVE_MMAP) || defined(_WIN32) /*(see local sys-mmap.h)*/
 		chunk_file_view *view;
 	  #endif
@@ -70,15 +73,39 @@ void chunk_buffer_yield(buffer *b);
 
 size_t chunk_buffer_prepare_append (buffer *b, size_t sz);
 
+void chunkqueue_chunk_pool_trim(void);
 void chunkqueue_chunk_pool_clear(void);
 void chunkqueue_chunk_pool_free(void);
 
+typedef struct chunk_pool_stats {
+    uint32_t chunks;     /* pooled chunks of (configured) chunk size */
+    uint32_t oversized;  /* pooled chunks larger than chunk size */
+    uint32_t filechunks; /* pooled chunks without data buffer */
+    size_t bytes;        /* memory held in pooled chunk data buffers */
+    uint32_t hugepage_allocs;     /* chunk buffers backed by hugepages */
+    uint32_t hugepage_numa_binds; /* hugepage buffers bound to local node */
+} chunk_pool_stats;
+
+void chunkqueue_chunk_pool_stats(chunk_pool_stats *st);
+
 __attribute_returns_nonnull__
 chunkqueue *chunkqueue_init(chunkqueue *cq);
 
 __attribute_cold__
 void chunkqueue_set_chunk_size (size_t sz);
 
+/* back chunk buffers >= hugepage size with transparent hugepages (Linux)
+ * (returns -1 if enabled and not supported, else 0) */
+__attribute_cold__
+int chunkqueue_set_chunk_hugepages (int enable);
+
+/* worker pinned to CPU(s): allocate chunk buffers on local NUMA node */
+__attribute_cold__
+void chunkqueue_set_chunk_numa_local (void);
+
+__attribute_cold__
+void chunkqueue_set_chunk_pool_limits (uint32_t high, uint32_t low, uint32_t oversized_high, uint32_t oversized_low);
+
 __attribute_cold__
 void chunkqueue_set_tempdirs_default_reset (void);
 
@@ -122,12 +149,20 @@ int chunkqueue_append_mem_to_tempfile(chunkqueue * restrict cq, const char * res
 #ifdef HAVE_SPLICE
 ssize_t chunkqueue_append_splice_pipe_tempfile(chunkqueue * restrict cq, int fd, unsigned int len, log_error_st * restrict errh);
 ssize_t chunkqueue_append_splice_sock_tempfile(chunkqueue * restrict cq, int fd, unsigned int len, log_error_st * restrict errh);
+ssize_t chunkqueue_append_splice_sock_pipe(chunkqueue *cq, int fd, unsigned int len);
 __attribute_cold__
 void chunkqueue_internal_pipes(int init);
+__attribute_cold__
+void chunkqueue_set_splice_relay(int enable, int *cur_fds);
 #else
 #define chunkqueue_internal_pipes(init) do { } while (0)
+#define chunkqueue_set_splice_relay(enable, cur_fds) do { } while (0)
 #endif
 
+/* callback to cancel async read op (c->file.aio) when chunk is released */
+__attribute_cold__
+void chunkqueue_set_aio_release(void (*fn)(uint32_t));
+
 /* functions to handle buffers to read into: */
 /* obtain/reserve memory in chunkqueue at least len (input) size,
  * return pointer to memory with len (output) available for use
@@ -28,6 +28,7 @@
 #cmakedefine  HAVE_SYSLOG_H
 #cmakedefine  HAVE_SYS_DEVPOLL_H
 #cmakedefine  HAVE_SYS_EPOLL_H
+#cmakedefine  HAVE_LINUX_IO_URING_H
 #cmakedefine  HAVE_SYS_EVENT_H
 #cmakedefine  HAVE_SYS_FILIO_H
 #cmakedefine  HAVE_SYS_LOADAVG_H
@@ -43,6 +44,8 @@
 #cmakedefine  HAVE_SYS_UN_H
 #cmakedefine  HAVE_SYS_WAIT_H
 #cmakedefine  HAVE_SYS_TIME_H
+#cmakedefine  HAVE_SYS_EVENTFD_H
+#cmakedefine  HAVE_PTHREAD_H
 #cmakedefine  HAVE_UNISTD_H
 
 #cmakedefine HAVE_IPV6
@@ -760,6 +760,9 @@ static int config_insert_srvconf(server *srv) {
      ,{ CONST_STR_LEN("server.feature-flags"),
         T_CONFIG_ARRAY_KVANY,
         T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("server.stat-cache-prewarm"),
+        T_CONFIG_ARRAY_VLIST,
+        T_CONFIG_SCOPE_SERVER }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -916,6 +919,10 @@ static int config_insert_srvconf(server *srv) {
                     array_get_element_klen(cpv->v.a,
                       CONST_STR_LEN("server.absolute-dir-redirect")), 0);
                 break;
+              case 33:/* server.stat-cache-prewarm */
+                if (cpv->v.a->used)
+                    stat_cache_prewarm_paths(cpv->v.a);
+                break;
               default:/* should not happen */
                 break;
             }
@@ -1375,6 +1382,16 @@ int config_finalize(server *srv, const buffer *default_server_tag) {
     /* disable h2proto if mod_h2 was not found during plugin load */
     p->defaults.h2proto = srv->srvconf.h2proto;
 
+    /* stat_cache pre-warm (if configured) uses global scope settings */
+    const int32_t prewarm_max =
+      config_feature_int(srv, "server.stat-cache-prewarm-max", 65536);
+    const int32_t prewarm_fds =
+      config_feature_int(srv, "server.stat-cache-prewarm-fds", 0);
+    stat_cache_prewarm_config(p->defaults.mimetypes, p->defaults.etag_flags,
+                              p->defaults.use_xattr,
+                              prewarm_max > 0 ? (uint32_t)prewarm_max : 0,
+                              prewarm_fds > 0 ? (uint32_t)prewarm_fds : 0);
+
     /* configure default server_tag if not set
      * (if configured to blank, unset server_tag)*/
     if (!p->defaults.server_tag)
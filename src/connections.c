@@ -58,7 +58,82 @@ static connection *connections_get_new_connection(server *srv) {
     return (srv->conns = con);
 }
 
+/* hashed timing wheel of connections; one slot per second
+ *
+ * Each connection is linked into the slot for the earliest second at which
+ * one of its timeouts might expire, so that periodic maintenance examines
+ * only the connections which might have timed out, instead of scanning all
+ * connections once per second.  Timestamps such as con->read_idle_ts are
+ * updated frequently on active connections, extending the deadline, so the
+ * connection is not moved each time; when its slot is reached, timeouts are
+ * checked and the connection is linked into the slot for the new deadline.
+ * A connection is moved to an earlier slot (if needed) after each run of
+ * connection_state_machine(), which is where request state and fdevent
+ * interest (and therefore which timeouts apply) change.  Deadlines are
+ * capped at CONNECTION_TWHEEL_MAX secs so that each connection is examined
+ * periodically and so that a slot is never reached before its deadline. */
+#define CONNECTION_TWHEEL_SLOTS 64 /* power of 2; > CONNECTION_TWHEEL_MAX */
+#define CONNECTION_TWHEEL_MAX   32
+
+static connection *connection_twheel[CONNECTION_TWHEEL_SLOTS];
+static unix_time64_t connection_twheel_ts; /* last slot processed */
+
+static void connection_timer_unlink (connection * const con) {
+    if (NULL == con->tw_pprev) return;
+    if ((*con->tw_pprev = con->tw_next))
+        con->tw_next->tw_pprev = con->tw_pprev;
+    con->tw_next = NULL;
+    con->tw_pprev = NULL;
+}
+
+static void connection_timer_link (connection * const con, const unix_time64_t ts) {
+    connection ** const slot =
+      connection_twheel + (ts & (CONNECTION_TWHEEL_SLOTS-1));
+    con->tw_ts = ts;
+    con->tw_pprev = slot;
+    if ((con->tw_next = *slot))
+        con->tw_next->tw_pprev = &con->tw_next;
+    *slot = con;
+}
+
+static unix_time64_t connection_timer_deadline (const connection * const con, const unix_time64_t cur_ts) {
+    /* (keep in sync with h1_check_timeout() and connection_check_timeout())
+     * check HTTP/2 (con->fn->check_timeout() checks streams) and rate-limited
+     * connections each second; reset con->bytes_written_cur_second */
+    if (con->fn || con->traffic_limit_reached || con->bytes_written_cur_second)
+        return cur_ts + 1;
+
+    const request_st * const r = &con->request;
+    unix_time64_t ts = cur_ts + CONNECTION_TWHEEL_MAX, t;
+    if (r->state == CON_STATE_CLOSE) {
+        t = con->close_timeout_ts + HTTP_LINGER_TIMEOUT + 1;
+        if (ts > t) ts = t;
+    }
+    else if (fdevent_fdnode_interest(con->fdn) & FDEVENT_IN) {
+        t = con->read_idle_ts + 1
+          + ((con->request_count != 1 && r->state == CON_STATE_READ)
+             ? con->keep_alive_idle
+             : (int)r->conf.max_read_idle);
+        if (ts > t) ts = t;
+    }
+    if (r->state == CON_STATE_WRITE && con->write_request_ts != 0) {
+        t = con->write_request_ts + r->conf.max_write_idle + 1;
+        if (ts > t) ts = t;
+    }
+    return ts > cur_ts ? ts : cur_ts + 1;
+}
+
+static void connection_timer_arm (connection * const con) {
+    const unix_time64_t ts = connection_timer_deadline(con, log_monotonic_secs);
+    if (con->tw_pprev) {
+        if (con->tw_ts <= ts) return; /*(checked sooner, then rescheduled)*/
+        connection_timer_unlink(con);
+    }
+    connection_timer_link(con, ts);
+}
+
 static void connection_del(server *srv, connection *con) {
+    connection_timer_unlink(con);
     if (con->next)
         con->next->prev = con->prev;
     if (con->prev)
@@ -313,6 +388,13 @@ connection_write_chunkqueue (connection * const con, chunkqueue * const restrict
 }
 
 
+static int connection_write_async_pending(const chunkqueue * const cq) {
+    /* async read of file chunk in flight (server.network-backend io_uring) */
+    const chunk * const c = cq->first;
+    return NULL != c && c->type == FILE_CHUNK && 2 == c->file.busy;
+}
+
+
 __attribute_noinline__
 static int connection_handle_write(request_st * const r, connection * const con) {
 	/*assert(!chunkqueue_is_empty(cq));*//* checked by callers */
@@ -331,6 +413,9 @@ static int connection_handle_write(request_st * const r, connection * const con)
 		break;
 	}
 
+	if (connection_write_async_pending(con->write_queue))
+		con->is_writable = 0; /*(network backend wakes con when ready)*/
+
 	return CON_STATE_WRITE; /*(state did not change)*/
 }
 
@@ -421,6 +506,7 @@ void connections_free(server *srv) {
         srv->conns = con->next;
         connection_free(con);
     }
+    memset(connection_twheel, 0, sizeof(connection_twheel));
 }
 
 
@@ -619,6 +705,7 @@ connection *connection_accepted(server *srv, const server_socket *srv_socket, so
 			return NULL;
 		}
 		if (r->http_status < 0) connection_set_state(r, CON_STATE_WRITE);
+		connection_timer_arm(con);
 		return con;
 }
 
@@ -773,7 +860,8 @@ connection_set_fdevent_interest (request_st * const r, connection * const con)
         break;
       case CON_STATE_WRITE:
         if (!chunkqueue_is_empty(con->write_queue)
-            && 0 == con->is_writable && 0 == con->traffic_limit_reached)
+            && 0 == con->is_writable && 0 == con->traffic_limit_reached
+            && !connection_write_async_pending(con->write_queue))
             n |= FDEVENT_OUT;
         __attribute_fallthrough__
       case CON_STATE_READ_POST:
@@ -823,6 +911,8 @@ connection_state_machine (connection * const con)
     if (rc)
         connection_state_machine_loop(r, con);
     connection_set_fdevent_interest(r, con);
+    if (con->fd >= 0)
+        connection_timer_arm(con);
 }
 
 
@@ -858,14 +948,42 @@ connection_check_timeout (connection * const con, const unix_time64_t cur_ts)
 }
 
 
+static void
+connection_periodic_maint_slot (const unix_time64_t ts, const unix_time64_t cur_ts)
+{
+    /* detach slot list; connections are relinked after timeout check
+     * (connection_del() unlinks connection from pending list, if closed) */
+    connection ** const slot =
+      connection_twheel + (ts & (CONNECTION_TWHEEL_SLOTS-1));
+    connection *pending = *slot;
+    *slot = NULL;
+    if (pending)
+        pending->tw_pprev = &pending;
+    for (connection *con; (con = pending); ) {
+        connection_timer_unlink(con);
+        if (con->tw_ts > cur_ts) /*(not expected)*/
+            connection_timer_link(con, con->tw_ts);
+        else {
+            connection_check_timeout(con, cur_ts);
+            if (con->fd >= 0)
+                connection_timer_arm(con);
+        }
+    }
+}
+
+
 void
 connection_periodic_maint (server * const srv, const unix_time64_t cur_ts)
 {
-    /* check all connections for timeouts */
-    for (connection *con = srv->conns, *tc; con; con = tc) {
-        tc = con->next;
-        connection_check_timeout(con, cur_ts);
-    }
+    /* check connections for timeouts (connections in timer wheel slots
+     * for each second elapsed since prior check) */
+    UNUSED(srv);
+    unix_time64_t ts = connection_twheel_ts;
+    if (cur_ts - ts > CONNECTION_TWHEEL_SLOTS)
+        ts = cur_ts - CONNECTION_TWHEEL_SLOTS;
+    while (ts < cur_ts)
+        connection_periodic_maint_slot(++ts, cur_ts);
+    connection_twheel_ts = cur_ts;
 }
 
 
@@ -924,5 +1042,8 @@ connection_graceful_shutdown_maint (server * const srv)
         if (changed) {
             connection_state_machine(con);
         }
+        else if (con->fd >= 0) {
+            connection_timer_arm(con); /*(close_timeout_ts might be reduced)*/
+        }
     }
 }
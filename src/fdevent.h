@@ -89,6 +89,9 @@ fdnode * fdevent_register(fdevents *ev, int fd, fdevent_handler handler, void *c
 
 void fdevent_unregister(fdevents *ev, fdnode *fdn);
 void fdevent_sched_close(fdevents *ev, fdnode *fdn);
+#ifndef _WIN32
+fdnode * fdevent_fdnode_get(const fdevents *ev, int fd);
+#endif
 
 void fdevent_setfd_cloexec(int fd);
 void fdevent_clrfd_cloexec(int fd);
@@ -39,6 +39,16 @@ fdevent_register (fdevents *ev, int fd, fdevent_handler handler, void *ctx)
     return fdn;
 }
 
+#ifndef _WIN32
+fdnode *
+fdevent_fdnode_get (const fdevents *ev, int fd)
+{
+    /*(NULL if fd is not registered or if close of fd is pending)*/
+    fdnode * const fdn = ev->fdarray[fd];
+    return ((uintptr_t)fdn & 0x3) ? NULL : fdn;
+}
+#endif
+
 #ifdef _WIN32
 #define fdevent_fdarray_slot(ev,fdn) &(ev)->fdarray[(fdn)->fda_ndx]
 #else
@@ -37,6 +37,7 @@
 #include "fdevent.h"
 #include "http_header.h"
 #include "log.h"
+#include "rand.h"
 #include "sock_addr.h"
 
 
@@ -89,6 +90,11 @@ static void gw_proc_connected_inc(gw_host *host, gw_proc *proc) {
     ++(*proc->stats_connected); /* "gw.backend...connected" */
 }
 
+static void gw_proc_reused_inc(gw_host *host, gw_proc *proc) {
+    UNUSED(host);
+    ++(*proc->stats_reused); /* "gw.backend...reused" */
+}
+
 static void gw_proc_load_inc(gw_host *host, gw_proc *proc) {
     *proc->stats_load = ++proc->load; /* "gw.backend...load" */
     ++(*host->stats_global_active); /* "gw.active-requests" */
@@ -114,6 +120,9 @@ static void gw_status_init_proc(gw_host *host, gw_proc *proc) {
     proc->stats_connected =
       gw_status_get_counter(host, proc, CONST_STR_LEN(".connected"));
     *proc->stats_connected = 0;
+    proc->stats_reused =
+      gw_status_get_counter(host, proc, CONST_STR_LEN(".reused"));
+    *proc->stats_reused = 0;
     proc->stats_load =
       gw_status_get_counter(host, proc, CONST_STR_LEN(".load"));
     *proc->stats_load = 0;
@@ -130,13 +139,18 @@ static void gw_status_init_host(gw_host *host) {
 
 
 
+/* generation of set of hosts with active procs (see gw_host_get_chash()) */
+static uint32_t gw_active_gen = 1;
+
 __attribute_cold__
 static void gw_proc_set_state(gw_host *host, gw_proc *proc, int state) {
     if ((int)proc->state == state) return;
     if (proc->state == PROC_STATE_RUNNING) {
-        --host->active_procs;
+        if (0 == --host->active_procs)
+            ++gw_active_gen;
     } else if (state == PROC_STATE_RUNNING) {
-        ++host->active_procs;
+        if (0 == host->active_procs++)
+            ++gw_active_gen;
     }
     proc->state = state;
 }
@@ -183,6 +197,18 @@ static gw_proc *gw_proc_init(gw_host *host) {
     return proc;
 }
 
+typedef struct gw_health_check {
+    fdnode *fdn;          /* NULL if no health check in progress */
+    gw_host *host;
+    gw_proc *proc;
+    server *srv;
+    unix_time64_t ts;     /* time most recent health check started */
+    int down;             /* proc disabled due to failed health check */
+    int status;           /* HTTP response status (-1 if invalid) */
+    uint32_t rlen;
+    char rbuf[16];        /* "HTTP/1.1 200 ..." */
+} gw_health_check;
+
 __attribute_cold__
 __attribute_noinline__
 static void gw_proc_free(gw_proc *proc) {
@@ -190,6 +216,18 @@ static void gw_proc_free(gw_proc *proc) {
 
     gw_proc_free(proc->next);
 
+    gw_health_check * const hc = proc->hc;
+    if (hc) {
+        if (hc->fdn) {
+            const int fd = hc->fdn->fd;
+            fdevent_fdnode_event_del(hc->srv->ev, hc->fdn);
+            fdevent_unregister(hc->srv->ev, hc->fdn);
+            fdio_close_socket(fd);
+            --hc->srv->cur_fds;
+        }
+        free(hc);
+    }
+
     buffer_free(proc->unixsocket);
     buffer_free(proc->connection_name);
     free(proc->saddr);
@@ -197,6 +235,15 @@ static void gw_proc_free(gw_proc *proc) {
     free(proc);
 }
 
+typedef struct gw_idle_conn {
+    fdnode *fdn;          /* NULL if slot is unused */
+    gw_host *host;
+    gw_proc *proc;
+    server *srv;
+    pid_t pid;
+    unix_time64_t idle_ts;
+} gw_idle_conn;
+
 __attribute_malloc__
 __attribute_returns_nonnull__
 static gw_host *gw_host_init(void) {
@@ -210,6 +257,19 @@ static void gw_host_free(gw_host *h) {
         return;
     }
 
+    if (h->idle_conns) {
+        for (uint32_t i = 0; i < h->keep_alive_max_idle; ++i) {
+            gw_idle_conn * const ic = h->idle_conns+i;
+            if (NULL == ic->fdn) continue;
+            const int fd = ic->fdn->fd;
+            fdevent_fdnode_event_del(ic->srv->ev, ic->fdn);
+            fdevent_unregister(ic->srv->ev, ic->fdn);
+            fdio_close_socket(fd);
+            --ic->srv->cur_fds;
+        }
+        free(h->idle_conns);
+    }
+
     gw_proc_free(h->first);
     gw_proc_free(h->unused_procs);
 
@@ -232,6 +292,7 @@ static void gw_extensions_free(gw_exts *f) {
             gw_host_free(fe->hosts[j]);
         }
         free(fe->hosts);
+        free(fe->chash);
     }
     free(f->exts);
     free(f);
@@ -359,6 +420,7 @@ __attribute_cold__
 static void gw_proc_check_enable(gw_host * const host, gw_proc * const proc, log_error_st * const errh) {
     if (log_monotonic_secs <= proc->disabled_until) return;
     if (proc->state != PROC_STATE_OVERLOADED) return;
+    if (proc->hc && proc->hc->down) return; /*(see gw_health_check_done())*/
 
     gw_proc_set_state(host, proc, PROC_STATE_RUNNING);
 
@@ -852,7 +914,9 @@ enum {
   GW_BALANCE_LEAST_CONNECTION,
   GW_BALANCE_RR,
   GW_BALANCE_HASH,
-  GW_BALANCE_STICKY
+  GW_BALANCE_STICKY,
+  GW_BALANCE_CONSISTENT,
+  GW_BALANCE_P2C_EWMA
 };
 
 __attribute_noinline__
@@ -863,6 +927,200 @@ gw_hash(const char *str, const uint32_t len, uint32_t hash)
     return djbhash(str, len, hash);
 }
 
+__attribute_const__
+static uint32_t
+gw_hash_mix(uint32_t h)
+{
+    /* (murmur3 fmix32 finalizer) */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+__attribute_cold__
+__attribute_noinline__
+static void
+gw_host_chash_build(gw_extension * const extension)
+{
+    /* Maglev consistent hashing (Eisenbud et al., NSDI 2016)
+     * Each active host fills lookup table slots following its own
+     * permutation of slots (offset, skip) until table is full.
+     * Table size is a prime chosen from the total number of hosts (not only
+     * active hosts) so that table size does not change when a host goes
+     * down or comes back up, limiting remapping of keys to other hosts */
+    static const uint32_t primes[] = {
+      251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521
+    };
+    const uint32_t used = extension->used;
+    uint32_t m = primes[0];
+    for (uint32_t i = 0; i < sizeof(primes)/sizeof(*primes); ++i) {
+        m = primes[i];
+        if (m >= used * 100) break;
+    }
+
+    if (extension->chash_size != m) {
+        free(extension->chash);
+        extension->chash = ck_malloc(m * sizeof(uint32_t));
+        extension->chash_size = m;
+    }
+    uint32_t * const entry = extension->chash;
+    extension->chash_gen = gw_active_gen;
+
+    uint32_t nactive = 0;
+    for (uint32_t k = 0; k < used; ++k) {
+        if (extension->hosts[k]->active_procs) ++nactive;
+    }
+    if (0 == nactive) {
+        memset(entry, 0xff, m * sizeof(uint32_t));/*(-1: no host)*/
+        return;
+    }
+
+    uint32_t * const next = ck_calloc(used, sizeof(uint32_t));
+    for (uint32_t c = 0; c < m; ++c) entry[c] = ~0u;
+    for (uint32_t n = 0; ; ) {
+        for (uint32_t k = 0; k < used; ++k) {
+            const gw_host * const host = extension->hosts[k];
+            if (0 == host->active_procs) continue;
+            const uint32_t offset = host->gw_hash % m;
+            const uint32_t skip = gw_hash_mix(host->gw_hash) % (m - 1) + 1;
+            uint32_t c;
+            do {
+                c = (uint32_t)((offset + (uint64_t)next[k] * skip) % m);
+                ++next[k];
+            } while (entry[c] != ~0u);
+            entry[c] = k;
+            if (++n == m) {
+                free(next);
+                return;
+            }
+        }
+    }
+}
+
+static int
+gw_host_get_chash(gw_extension * const extension, const uint32_t base_hash)
+{
+    if (extension->chash_gen != gw_active_gen)
+        gw_host_chash_build(extension);
+    /*(gw_hash_mix() since djbhash low bits are weak)*/
+    return (int)extension->chash[gw_hash_mix(base_hash) % extension->chash_size];
+}
+
+static uint64_t
+gw_monotonic_us (void)
+{
+    unix_timespec64_t ts;
+  #ifdef CLOCK_MONOTONIC
+    if (0 != log_clock_gettime(CLOCK_MONOTONIC, &ts))
+  #endif
+        log_clock_gettime_realtime(&ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void
+gw_host_ewma_sample (gw_host * const host, uint64_t t)
+{
+    /* exponentially weighted moving average of response time (alpha = 1/8)
+     * (ewma_us 0 means no samples; see gw_host_p2c_cost()) */
+    if (t > UINT32_MAX) t = UINT32_MAX;
+    if (0 == t) t = 1;
+    host->ewma_us = host->ewma_us
+      ? (uint32_t)(((uint64_t)host->ewma_us * 7 + t) >> 3)
+      : (uint32_t)t;
+}
+
+static void
+gw_host_ewma_update (gw_handler_ctx * const hctx)
+{
+    /* sample time to first response byte (once per attempt) */
+    if (0 == hctx->start_us) return;
+    gw_host_ewma_sample(hctx->host, gw_monotonic_us() - hctx->start_us);
+    hctx->start_us = 0;
+}
+
+#define GW_P2C_EWMA_PENALTY_US 1000000u
+
+__attribute_cold__
+static void
+gw_host_ewma_penalty (gw_handler_ctx * const hctx)
+{
+    /* connect error, reset, or timeout: sample at least the penalty so that
+     * a backend failing fast does not appear faster than healthy backends */
+    if (0 == hctx->start_us) return;
+    uint64_t t = gw_monotonic_us() - hctx->start_us;
+    const uint64_t p = (uint64_t)hctx->host->ewma_us << 2;
+    if (t < p) t = p;
+    if (t < GW_P2C_EWMA_PENALTY_US) t = GW_P2C_EWMA_PENALTY_US;
+    gw_host_ewma_sample(hctx->host, t);
+    hctx->start_us = 0;
+}
+
+static uint64_t
+gw_host_p2c_cost (const gw_host * const host, const uint32_t seed_us)
+{
+    /* (load+1) so that response time is considered for idle hosts;
+     * hosts without response time samples are costed at seed_us */
+    return (uint64_t)(uint32_t)(host->load + 1)
+         * (host->ewma_us ? host->ewma_us : seed_us);
+}
+
+static int
+gw_host_get_p2c (const gw_extension * const extension)
+{
+    /* power of two random choices; select host with lower cost
+     * (choice with xorshift32 since randomness need not be strong) */
+    static uint32_t x;
+    if (0 == x) x = (uint32_t)li_rand_pseudo() | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    const uint32_t used = extension->used;
+    uint32_t a = x % used;
+    uint32_t b = (x >> 16) % (used - 1);
+    if (b >= a) ++b;
+    const gw_host * const ha = extension->hosts[a];
+    const gw_host * const hb = extension->hosts[b];
+    if (ha->active_procs && hb->active_procs) {
+        /* host without samples is neutral: costed at the other's average
+         * (and preferred on tie, so that it gets sampled) */
+        const uint32_t ea = ha->ewma_us ? ha->ewma_us : hb->ewma_us;
+        const uint32_t eb = hb->ewma_us ? hb->ewma_us : ea;
+        const uint64_t ca = gw_host_p2c_cost(ha, ea);
+        const uint64_t cb = gw_host_p2c_cost(hb, eb);
+        return (int)(cb < ca || (cb == ca && 0 == hb->ewma_us) ? b : a);
+    }
+    if (ha->active_procs) return (int)a;
+    if (hb->active_procs) return (int)b;
+
+    /* fall back to active host with lowest cost
+     * (hosts without samples costed at average of sampled active hosts) */
+    uint64_t sum = 0;
+    uint32_t n = 0;
+    for (uint32_t k = 0; k < used; ++k) {
+        const gw_host * const host = extension->hosts[k];
+        if (host->active_procs && host->ewma_us) {
+            sum += host->ewma_us;
+            ++n;
+        }
+    }
+    const uint32_t seed_us = n ? (uint32_t)(sum / n) : 1;
+    int ndx = -1;
+    uint64_t cost = UINT64_MAX;
+    for (uint32_t k = 0; k < used; ++k) {
+        const gw_host * const host = extension->hosts[k];
+        if (0 == host->active_procs) continue;
+        const uint64_t c = gw_host_p2c_cost(host, seed_us);
+        if (c < cost || -1 == ndx) {
+            cost = c;
+            ndx = (int)k;
+        }
+    }
+    return ndx;
+}
+
 static gw_host * gw_host_get(request_st * const r, gw_extension *extension, int balance, int debug) {
     int ndx = -1;
     const int ext_used = (int)extension->used;
@@ -932,6 +1190,15 @@ static gw_host * gw_host_get(request_st * const r, gw_extension *extension, int
         }
         break;
        }
+      case GW_BALANCE_CONSISTENT:
+        ndx = gw_host_get_chash(extension,
+                                gw_hash(BUF_PTR_LEN(&r->uri.authority),
+                                  gw_hash(BUF_PTR_LEN(&r->uri.path),
+                                          DJBHASH_INIT)));
+        break;
+      case GW_BALANCE_P2C_EWMA:
+        ndx = gw_host_get_p2c(extension);
+        break;
       default:
         break;
      }
@@ -1100,8 +1367,10 @@ static handler_t gw_process_fdevent(gw_handler_ctx *hctx, request_st *r, int rev
 
 
 __attribute_returns_nonnull__
-static gw_handler_ctx * handler_ctx_init(size_t sz) {
-    gw_handler_ctx *hctx = ck_calloc(1, 0 == sz ? sizeof(*hctx) : sz);
+static gw_handler_ctx * handler_ctx_init(request_st * const r, size_t sz) {
+    /*(hctx lives no longer than request; freed by request_reset())*/
+    gw_handler_ctx *hctx =
+      request_arena_calloc(r, 0 == sz ? sizeof(*hctx) : sz);
 
     /*hctx->response = chunk_buffer_acquire();*//*(allocated when needed)*/
 
@@ -1130,7 +1399,7 @@ static void handler_ctx_free(gw_handler_ctx *hctx) {
     if (hctx->rb) chunkqueue_free(hctx->rb);
     chunkqueue_reset(&hctx->wb);
 
-    free(hctx);
+    /*(hctx allocated from request arena; see handler_ctx_init())*/
 }
 
 static void handler_ctx_clear(gw_handler_ctx *hctx) {
@@ -1319,6 +1588,24 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_p
      ,{ CONST_STR_LEN("upgrade"),
         T_CONFIG_BOOL,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("keep-alive-max-idle"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("keep-alive-idle-timeout"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-interval"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-timeout"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-uri"),
+        T_CONFIG_STRING,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-status"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -1387,6 +1674,9 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_p
             host->max_load_per_proc = 1;
             host->idle_timeout = 60;
             host->connect_timeout = 8;
+            host->keep_alive_idle_timeout = 4;
+            host->health_check_timeout = 2;
+            host->health_check_status = 200;
             host->disable_time = 1;
             host->break_scriptfilename_for_php = 0;
             host->kill_signal = SIGTERM;
@@ -1534,6 +1824,25 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_p
                   case 26:/* upgrade */
                     host->upgrade = (0 != cpv->v.u);
                     break;
+                  case 27:/* keep-alive-max-idle */
+                    host->keep_alive_max_idle = cpv->v.shrt;
+                    break;
+                  case 28:/* keep-alive-idle-timeout */
+                    host->keep_alive_idle_timeout = cpv->v.shrt;
+                    break;
+                  case 29:/* health-check-interval */
+                    host->health_check_interval = cpv->v.shrt;
+                    break;
+                  case 30:/* health-check-timeout */
+                    host->health_check_timeout = cpv->v.shrt;
+                    break;
+                  case 31:/* health-check-uri */
+                    if (!buffer_is_blank(cpv->v.b))
+                        host->health_check_uri = cpv->v.b;
+                    break;
+                  case 32:/* health-check-status */
+                    host->health_check_status = cpv->v.shrt;
+                    break;
                   default:
                     break;
                 }
@@ -1547,6 +1856,18 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_p
                 }
             }
 
+            /* backend connection reuse implemented only for FastCGI, HTTP */
+            if (host->keep_alive_max_idle
+                && 0 != strcmp(cpkkey, "fastcgi.server")
+                && 0 != strcmp(cpkkey, "proxy.server")) {
+                log_error(srv->errh, __FILE__, __LINE__,
+                  "keep-alive-max-idle not supported in: "
+                  "%s = (%s => (%s ( ...", cpkkey, da_ext->key.ptr,
+                  da_host->key.ptr);
+
+                goto error;
+            }
+
             if ((host->host || host->port) && host->unixsocket) {
                 log_error(srv->errh, __FILE__, __LINE__,
                   "either host/port or socket have to be set in: "
@@ -1797,10 +2118,14 @@ int gw_get_defaults_balance(server *srv, const buffer *b) {
         return GW_BALANCE_HASH;
     if (buffer_eq_slen(b, CONST_STR_LEN("sticky")))
         return GW_BALANCE_STICKY;
+    if (buffer_eq_slen(b, CONST_STR_LEN("consistent")))
+        return GW_BALANCE_CONSISTENT;
+    if (buffer_eq_slen(b, CONST_STR_LEN("p2c-ewma")))
+        return GW_BALANCE_P2C_EWMA;
 
     log_error(srv->errh, __FILE__, __LINE__,
-      "xxxxx.balance has to be one of: "
-      "least-connection, round-robin, hash, sticky, but not: %s", b->ptr);
+      "xxxxx.balance has to be one of: least-connection, round-robin, "
+      "hash, sticky, consistent, p2c-ewma, but not: %s", b->ptr);
     return GW_BALANCE_LEAST_CONNECTION;
 }
 
@@ -1851,6 +2176,133 @@ static void gw_host_hctx_deq(gw_handler_ctx * const hctx) {
 }
 
 
+static void gw_idle_conn_close(gw_idle_conn * const ic) {
+    fdevent_fdnode_event_del(ic->srv->ev, ic->fdn);
+    /*fdevent_unregister(ev, ic->fdn);*//*(handled below)*/
+    fdevent_sched_close(ic->srv->ev, ic->fdn);
+    ic->fdn = NULL;
+    --ic->host->idle_used;
+}
+
+
+static handler_t gw_idle_conn_fdevent(void *ctx, int revents) {
+    /* idle connection closed by backend (or unexpected data received) */
+    UNUSED(revents);
+    gw_idle_conn_close((gw_idle_conn *)ctx);
+    return HANDLER_FINISHED;
+}
+
+
+static int gw_idle_conn_is_open(const int fd) {
+    /* check for EOF (or data) which has not yet been processed by event loop*/
+    char c;
+    if (-1 != recv(fd, &c, 1, MSG_PEEK))
+        return 0;
+  #ifdef _WIN32
+    return (WSAGetLastError() == WSAEWOULDBLOCK);
+  #else
+    return (errno == EAGAIN || errno == EWOULDBLOCK);
+  #endif
+}
+
+
+static void gw_idle_conn_put(gw_handler_ctx * const hctx) {
+    /* move connection from hctx to host idle connections */
+    gw_host * const host = hctx->host;
+    gw_proc * const proc = hctx->proc;
+    if (host->idle_used >= host->keep_alive_max_idle) return;
+    if (proc->state != PROC_STATE_RUNNING) return;
+    if (proc->is_local && proc->pid != hctx->pid) return;
+
+    if (NULL == host->idle_conns)
+        host->idle_conns =
+          ck_calloc(host->keep_alive_max_idle, sizeof(gw_idle_conn));
+    gw_idle_conn *ic = host->idle_conns;
+    while (ic->fdn) ++ic; /*(idle_used < keep_alive_max_idle)*/
+
+    fdevent_fdnode_event_del(hctx->ev, hctx->fdn);
+    fdevent_unregister(hctx->ev, hctx->fdn);
+    ic->fdn = fdevent_register(hctx->ev, hctx->fd, gw_idle_conn_fdevent, ic);
+    fdevent_fdnode_event_set(hctx->ev, ic->fdn, FDEVENT_IN|FDEVENT_RDHUP);
+    ic->host = host;
+    ic->proc = proc;
+    ic->srv = hctx->r->con->srv;
+    ic->pid = hctx->pid;
+    ic->idle_ts = log_monotonic_secs;
+    ++host->idle_used;
+
+    hctx->fdn = NULL;
+    hctx->fd = -1;
+    gw_host_hctx_deq(hctx);
+}
+
+
+static int gw_idle_conn_get(gw_handler_ctx * const hctx) {
+    /* move most recently used host idle connection to hctx */
+    gw_host * const host = hctx->host;
+    const unix_time64_t idle_ts =
+      log_monotonic_secs - host->keep_alive_idle_timeout;
+    while (host->idle_used) {
+        gw_idle_conn *ic = NULL;
+        for (uint32_t i = 0; i < host->keep_alive_max_idle; ++i) {
+            gw_idle_conn * const c = host->idle_conns+i;
+            if (c->fdn && (NULL == ic || ic->idle_ts < c->idle_ts))
+                ic = c;
+        }
+
+        gw_proc * const proc = ic->proc;
+        if (ic->idle_ts < idle_ts
+            || proc->state != PROC_STATE_RUNNING
+            || (proc->is_local && proc->pid != ic->pid)
+            || !gw_idle_conn_is_open(ic->fdn->fd)) {
+            gw_idle_conn_close(ic);
+            continue;
+        }
+
+        hctx->fd = ic->fdn->fd;
+        fdevent_fdnode_event_del(ic->srv->ev, ic->fdn);
+        fdevent_unregister(ic->srv->ev, ic->fdn);
+        ic->fdn = NULL;
+        --host->idle_used;
+
+        hctx->fdn = fdevent_register(hctx->ev,hctx->fd,gw_handle_fdevent,hctx);
+        hctx->proc = proc;
+        hctx->pid = ic->pid;
+        return 1;
+    }
+    return 0;
+}
+
+
+static void gw_idle_conn_expire(gw_host * const host) {
+    const unix_time64_t idle_ts =
+      log_monotonic_secs - host->keep_alive_idle_timeout;
+    for (uint32_t i = 0; host->idle_used && i < host->keep_alive_max_idle; ++i){
+        gw_idle_conn * const ic = host->idle_conns+i;
+        if (ic->fdn && ic->idle_ts < idle_ts)
+            gw_idle_conn_close(ic);
+    }
+}
+
+
+static void gw_backend_keep_alive(gw_handler_ctx * const hctx, request_st * const r) {
+    /* save connection to backend for reuse if response is complete,
+     * request was completely sent, and backend permits keep-alive
+     * (backends which frame responses in opts->parse() (e.g. FastCGI)
+     *  clear opts->backend_keep_alive if response did not end cleanly) */
+    if ((NULL != hctx->opts.parse
+         || (r->resp_body_finished
+             && (r->resp_decode_chunked || 0 == r->resp_body_scratchpad)))
+        && hctx->wb_reqlen >= 0
+        && hctx->wb.bytes_out == hctx->wb_reqlen
+        && chunkqueue_is_empty(&hctx->wb)
+        && hctx->opts.upgrade != 2
+        && !(r->conf.stream_request_body
+             & FDEVENT_STREAM_REQUEST_BACKEND_SHUT_WR))
+        gw_idle_conn_put(hctx);
+}
+
+
 static void gw_backend_close(gw_handler_ctx * const hctx, request_st * const r) {
     if (hctx->fd >= 0) {
         fdevent_fdnode_event_del(hctx->ev, hctx->fdn);
@@ -1860,6 +2312,7 @@ static void gw_backend_close(gw_handler_ctx * const hctx, request_st * const r)
         hctx->fd = -1;
         gw_host_hctx_deq(hctx);
     }
+    hctx->reused = 0;
 
     if (hctx->host) {
         if (hctx->proc) {
@@ -1885,6 +2338,19 @@ static void gw_connection_close(gw_handler_ctx * const hctx, request_st * const
     }
 }
 
+static int gw_reconnect_reused(gw_handler_ctx * const hctx, request_st * const r) {
+    /* backend might close idle keep-alive connection while it is being reused;
+     * retry on new connection if nothing received and request can be resent */
+    if (!hctx->reused || r->resp_body_started || 0 != r->reqbody_length
+        || (hctx->response && !buffer_is_blank(hctx->response))
+        || (hctx->rb && !chunkqueue_is_empty(hctx->rb))
+        || hctx->reconnects++ >= 5)
+        return 0;
+    chunkqueue_reset(&hctx->wb);
+    hctx->wb_reqlen = 0;
+    return 1;
+}
+
 static handler_t gw_reconnect(gw_handler_ctx * const hctx, request_st * const r) {
     gw_backend_close(hctx, r);
 
@@ -1960,6 +2426,21 @@ static handler_t gw_write_refill_wb(gw_handler_ctx * const hctx, request_st * co
 static handler_t gw_write_request(gw_handler_ctx * const hctx, request_st * const r) {
     switch(hctx->state) {
     case GW_STATE_INIT:
+        if (hctx->conf.balance == GW_BALANCE_P2C_EWMA)
+            hctx->start_us = gw_monotonic_us();
+
+        /* reuse idle keep-alive connection to backend, if available */
+        if (hctx->host->idle_used && hctx->opts.backend_keep_alive
+            && gw_idle_conn_get(hctx)) {
+            hctx->reused = 1;
+            gw_proc_reused_inc(hctx->host, hctx->proc);
+            gw_proc_load_inc(hctx->host, hctx->proc);
+            hctx->write_ts = log_monotonic_secs;
+            gw_host_hctx_enq(hctx);
+            gw_set_state(hctx, GW_STATE_PREPARE_WRITE);
+            return gw_write_request(hctx, r);
+        }
+
         /* do we have a running process for this host (max-procs) ? */
         hctx->proc = NULL;
 
@@ -2180,6 +2661,9 @@ static handler_t gw_write_error(gw_handler_ctx * const hctx, request_st * const
     if (hctx->state == GW_STATE_INIT ||
         hctx->state == GW_STATE_CONNECT_DELAYED) {
 
+        if (hctx->conf.balance == GW_BALANCE_P2C_EWMA)
+            gw_host_ewma_penalty(hctx); /* connect error */
+
         /* (optimization to detect backend process exit while processing a
          *  large number of ready events; (this block could be removed)) */
         if (hctx->proc && hctx->proc->is_local) {
@@ -2212,6 +2696,9 @@ static handler_t gw_write_error(gw_handler_ctx * const hctx, request_st * const
     if (!r->resp_body_started && r->http_status < 500 && r->http_status != 400)
         r->http_status = 503; /* Service Unavailable */
 
+    if (hctx->conf.balance == GW_BALANCE_P2C_EWMA)
+        gw_host_ewma_penalty(hctx);
+
     return gw_backend_error(hctx, r); /* HANDLER_FINISHED */
 }
 
@@ -2406,8 +2893,11 @@ static handler_t gw_recv_response(gw_handler_ctx * const hctx, request_st * cons
          * hctx->opts->parse callback, hampering detection here.  However, this
          * may not be triggered for partial collection of HTTP response headers
          * or partial packets for backend protocol (e.g. FastCGI) */
-        if (r->write_queue.bytes_in > bytes_in)
+        if (r->write_queue.bytes_in > bytes_in) {
             hctx->read_ts = proc->last_used = log_monotonic_secs;
+            if (hctx->conf.balance == GW_BALANCE_P2C_EWMA)
+                gw_host_ewma_update(hctx);
+        }
         return HANDLER_GO_ON;
     case HANDLER_FINISHED:
         /*hctx->read_ts =*/ proc->last_used = log_monotonic_secs;
@@ -2416,6 +2906,15 @@ static handler_t gw_recv_response(gw_handler_ctx * const hctx, request_st * cons
             && (200 == r->http_status || 0 == r->http_status))
             return gw_authorizer_ok(hctx, r);
 
+        if (!r->resp_body_started && gw_reconnect_reused(hctx, r))
+            return gw_reconnect(hctx, r);
+
+        if (hctx->conf.balance == GW_BALANCE_P2C_EWMA)
+            gw_host_ewma_update(hctx);
+
+        if (hctx->opts.backend_keep_alive)
+            gw_backend_keep_alive(hctx, r);
+
         gw_connection_close(hctx, r);
         return HANDLER_FINISHED;
     case HANDLER_COMEBACK: /*(not expected; treat as error)*/
@@ -2451,6 +2950,13 @@ static handler_t gw_recv_response_error(gw_handler_ctx * const hctx, request_st
             }
         }
 
+        if (gw_reconnect_reused(hctx, r))
+            return gw_reconnect(hctx, r);
+
+        /* backend reset or recv error */
+        if (hctx->conf.balance == GW_BALANCE_P2C_EWMA)
+            gw_host_ewma_penalty(hctx);
+
         int reconnect = 0;
         const char * const msg = (r->resp_body_started == 0)
           ? hctx->wb.bytes_out == 0
@@ -2509,6 +3015,8 @@ static handler_t gw_process_fdevent(gw_handler_ctx * const hctx, request_st * co
             r->conf.stream_response_body = flags;
             return rc; /* HANDLER_FINISHED or HANDLER_ERROR */
         } else {
+            if (gw_reconnect_reused(hctx, r))
+                return gw_reconnect(hctx, r);
             gw_proc *proc = hctx->proc;
             log_error(r->conf.errh, __FILE__, __LINE__,
               "error: unexpected close of gw connection for %s?%.*s "
@@ -2743,7 +3251,7 @@ handler_t gw_check_extension(request_st * const r, gw_plugin_data * const p, int
     if (0 != r->http_status)
         return HANDLER_FINISHED;
 
-    if (!hctx) hctx = handler_ctx_init(hctx_sz);
+    if (!hctx) hctx = handler_ctx_init(r, hctx_sz);
 
     hctx->ev               = r->con->srv->ev;
     hctx->r                = r;
@@ -2808,6 +3316,10 @@ static void gw_handle_trigger_hctx_timeout(gw_handler_ctx * const hctx, const ch
     request_st * const r = hctx->r;
     joblist_append(r->con);
 
+    /* count timeout in response time average */
+    if (hctx->conf.balance == GW_BALANCE_P2C_EWMA)
+        gw_host_ewma_penalty(hctx);
+
     if (*msg == 'c') { /* "connect" */
         /* temporarily disable backend proc */
         gw_proc_connect_error(r, hctx->host, hctx->proc, hctx->pid,
@@ -2843,6 +3355,213 @@ static void gw_handle_trigger_hctx_timeout(gw_handler_ctx * const hctx, const ch
         r->http_status = 504; /*Gateway Timeout*/
 }
 
+static void gw_health_check_close(gw_health_check * const hc) {
+    if (hc->fdn) {
+        fdevent_fdnode_event_del(hc->srv->ev, hc->fdn);
+        fdevent_sched_close(hc->srv->ev, hc->fdn);
+        hc->fdn = NULL;
+    }
+}
+
+static void gw_health_check_done(gw_health_check * const hc, const char * const msg) {
+    /* msg is NULL if health check passed */
+    server * const srv = hc->srv;
+    gw_health_check_close(hc);
+
+    gw_host * const host = hc->host;
+    gw_proc * const proc = hc->proc;
+    if (NULL == msg) {
+        if (!hc->down) return;
+        hc->down = 0;
+        if (proc->state == PROC_STATE_OVERLOADED)
+            gw_proc_set_state(host, proc, PROC_STATE_RUNNING);
+        log_error(srv->errh, __FILE__, __LINE__,
+          "health check passed; gw-server re-enabled: %s",
+          proc->connection_name->ptr);
+    }
+    else {
+        if (hc->down) return;
+        hc->down = 1;
+        if (proc->state == PROC_STATE_RUNNING)
+            gw_proc_set_state(host, proc, PROC_STATE_OVERLOADED);
+        log_error(srv->errh, __FILE__, __LINE__,
+          "health check failed (%s); gw-server disabled: %s",
+          msg, proc->connection_name->ptr);
+    }
+}
+
+#ifndef _WIN32
+__attribute_cold__
+static void gw_health_check_overloaded(gw_health_check * const hc) {
+    /* soft fail: backend is listening, but backlog is full; cool down the
+     * backend as is done for EAGAIN upon connect() for a request (see
+     * gw_proc_connect_error()), without marking backend down */
+    gw_health_check_close(hc);
+    gw_host * const host = hc->host;
+    gw_proc * const proc = hc->proc;
+    proc->disabled_until = log_monotonic_secs + host->disable_time;
+    if (proc->state == PROC_STATE_RUNNING)
+        gw_proc_set_state(host, proc, PROC_STATE_OVERLOADED);
+    gw_proc_tag_inc(host, proc, CONST_STR_LEN(".overloaded"));
+    log_error(hc->srv->errh, __FILE__, __LINE__,
+      "health check: backlog full; gw-server disabled for %d secs: %s",
+      host->disable_time, proc->connection_name->ptr);
+}
+#endif
+
+static void gw_health_check_connected(gw_health_check * const hc) {
+    const gw_host * const host = hc->host;
+    if (NULL == host->health_check_uri) {
+        gw_health_check_done(hc, NULL); /* TCP connect succeeded */
+        return;
+    }
+
+    buffer * const b = chunk_buffer_acquire();
+    buffer_append_str3(b, CONST_STR_LEN("GET "),
+                          BUF_PTR_LEN(host->health_check_uri),
+                          CONST_STR_LEN(" HTTP/1.0\r\nHost: "));
+    if (host->host) {
+        /* bracket IPv6 address literal (RFC 3986 IP-literal) */
+        if (host->host->ptr[0] != '['
+            && NULL != strchr(host->host->ptr, ':'))
+            buffer_append_str3(b, CONST_STR_LEN("["),
+                                  BUF_PTR_LEN(host->host),
+                                  CONST_STR_LEN("]"));
+        else
+            buffer_append_string_buffer(b, host->host);
+    }
+    else
+        buffer_append_string_len(b, CONST_STR_LEN("localhost"));
+    buffer_append_string_len(b, CONST_STR_LEN("\r\nConnection: close\r\n\r\n"));
+    /*(request is small; expect to be written to socket buffer in one send)*/
+    const ssize_t wr = send(hc->fdn->fd, b->ptr, buffer_clen(b), 0);
+    const int ok = (wr == (ssize_t)buffer_clen(b));
+    chunk_buffer_release(b);
+    if (!ok) {
+        gw_health_check_done(hc, "send");
+        return;
+    }
+    fdevent_fdnode_event_set(hc->srv->ev, hc->fdn, FDEVENT_IN|FDEVENT_RDHUP);
+}
+
+static const char * gw_health_check_result(const gw_health_check * const hc) {
+    return hc->status == (int)hc->host->health_check_status
+      ? NULL
+      : hc->status < 0
+        ? "invalid response"
+        : "unexpected status";
+}
+
+static void gw_health_check_read(gw_health_check * const hc) {
+    /* read "HTTP/1.x NNN" from status line of response,
+     * then read and discard remainder of response until EOF
+     * (avoid TCP RST to backend from close() with unread data) */
+    char buf[1024];
+    const ssize_t rd = hc->status
+      ? recv(hc->fdn->fd, buf, sizeof(buf), 0)
+      : recv(hc->fdn->fd, hc->rbuf + hc->rlen, sizeof(hc->rbuf) - hc->rlen, 0);
+    if (rd < 0) {
+      #ifdef _WIN32
+        const int errnum = WSAGetLastError();
+        if (errnum == WSAEWOULDBLOCK || errnum == WSAEINTR) return;
+      #else
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+      #endif
+        gw_health_check_done(hc, "recv");
+        return;
+    }
+    if (0 == rd) {
+        gw_health_check_done(hc, hc->status
+                                 ? gw_health_check_result(hc)
+                                 : "unexpected EOF");
+        return;
+    }
+    if (hc->status) return;
+    hc->rlen += (uint32_t)rd;
+    if (hc->rlen < sizeof("HTTP/1.1 200")-1) return;
+
+    const char * const s = hc->rbuf;
+    hc->status =
+        (0 == memcmp(s, "HTTP/1.", sizeof("HTTP/1.")-1) && s[8] == ' '
+         && light_isdigit(s[9]) && light_isdigit(s[10])
+         && light_isdigit(s[11]))
+      ? (s[9]-'0')*100 + (s[10]-'0')*10 + (s[11]-'0')
+      : -1;
+    if (hc->status < 0)
+        gw_health_check_done(hc, gw_health_check_result(hc));
+}
+
+static handler_t gw_health_check_fdevent(void *ctx, int revents) {
+    gw_health_check * const hc = ctx;
+    if (fdevent_fdnode_interest(hc->fdn) & FDEVENT_OUT) {
+        if (0 != fdevent_connect_status(hc->fdn->fd))
+            gw_health_check_done(hc, "connect");
+        else
+            gw_health_check_connected(hc);
+    }
+    else if (revents & (FDEVENT_IN|FDEVENT_HUP|FDEVENT_RDHUP|FDEVENT_ERR))
+        gw_health_check_read(hc);
+    return HANDLER_FINISHED;
+}
+
+static void gw_health_check_start(server * const srv, gw_host * const host, gw_proc * const proc) {
+    gw_health_check *hc = proc->hc;
+    if (NULL == hc) {
+        hc = proc->hc = ck_calloc(1, sizeof(*hc));
+        hc->host = host;
+        hc->proc = proc;
+        hc->srv = srv;
+    }
+    hc->ts = log_monotonic_secs;
+    hc->status = 0;
+    hc->rlen = 0;
+
+    const int fd = fdevent_socket_nb_cloexec(host->family, SOCK_STREAM, 0);
+    if (-1 == fd) return; /*(local resource error; retry next interval)*/
+    ++srv->cur_fds;
+    hc->fdn = fdevent_register(srv->ev, fd, gw_health_check_fdevent, hc);
+
+    if (0 == connect(fd, proc->saddr, proc->saddrlen)) {
+        gw_health_check_connected(hc);
+        return;
+    }
+  #ifdef _WIN32
+    const int errnum = WSAGetLastError();
+    if (errnum == WSAEINPROGRESS || errnum == WSAEALREADY
+        || errnum == WSAEWOULDBLOCK || errnum == WSAEINTR)
+  #else
+    const int errnum = errno;
+    if (errnum == EINPROGRESS || errnum == EALREADY || errnum == EINTR)
+  #endif
+        fdevent_fdnode_event_set(srv->ev, hc->fdn, FDEVENT_OUT);
+  #ifndef _WIN32
+    else if (errnum == EAGAIN && host->unixsocket)
+        gw_health_check_overloaded(hc); /*(listening, but backlog full)*/
+  #endif
+    else
+        gw_health_check_done(hc, "connect");
+}
+
+__attribute_noinline__
+static void gw_health_check_host(server * const srv, gw_host * const host) {
+    const unix_time64_t mono = log_monotonic_secs;
+    for (gw_proc *proc = host->first; proc; proc = proc->next) {
+        /*(procs spawned by lighttpd are monitored with waitpid())*/
+        if (proc->is_local) continue;
+        if (proc->state != PROC_STATE_RUNNING
+            && proc->state != PROC_STATE_OVERLOADED) continue;
+        gw_health_check * const hc = proc->hc;
+        if (hc && hc->fdn) {
+            if (mono - hc->ts >= host->health_check_timeout)
+                gw_health_check_done(hc, hc->status
+                                         ? gw_health_check_result(hc)
+                                         : "timeout");
+        }
+        else if (NULL == hc || mono - hc->ts >= host->health_check_interval)
+            gw_health_check_start(srv, host, proc);
+    }
+}
+
 __attribute_noinline__
 static void gw_handle_trigger_host_timeouts(gw_host * const host) {
 
@@ -2877,11 +3596,19 @@ static void gw_handle_trigger_host_timeouts(gw_host * const host) {
     }
 }
 
-static void gw_handle_trigger_host(gw_host * const host, log_error_st * const errh, const int debug) {
+static void gw_handle_trigger_host(server * const srv, gw_host * const host, log_error_st * const errh, const int debug) {
 
     /* check for socket timeouts on active requests to backend host */
     gw_handle_trigger_host_timeouts(host);
 
+    /* active health checks (not in parent process monitoring workers) */
+    if (host->health_check_interval && 0 == srv->srvconf.max_worker)
+        gw_health_check_host(srv, host);
+
+    /* close expired idle keep-alive connections to backend host */
+    if (host->idle_used)
+        gw_idle_conn_expire(host);
+
     /* check each child proc to detect if proc exited */
 
     gw_proc *proc;
@@ -2944,21 +3671,25 @@ static void gw_handle_trigger_host(gw_host * const host, log_error_st * const er
   #endif
 }
 
-static void gw_handle_trigger_exts(gw_exts * const exts, log_error_st * const errh, const int debug) {
+static void gw_handle_trigger_exts(server * const srv, gw_exts * const exts, log_error_st * const errh, const int debug) {
     for (uint32_t j = 0; j < exts->used; ++j) {
         gw_extension *ex = exts->exts+j;
         for (uint32_t n = 0; n < ex->used; ++n) {
-            gw_handle_trigger_host(ex->hosts[n], errh, debug);
+            gw_handle_trigger_host(srv, ex->hosts[n], errh, debug);
         }
     }
 }
 
-static void gw_handle_trigger_exts_wkr(gw_exts *exts, log_error_st *errh) {
+static void gw_handle_trigger_exts_wkr(server *srv, gw_exts *exts, log_error_st *errh) {
     for (uint32_t j = 0; j < exts->used; ++j) {
         gw_extension * const ex = exts->exts+j;
         for (uint32_t n = 0; n < ex->used; ++n) {
             gw_host * const host = ex->hosts[n];
             gw_handle_trigger_host_timeouts(host);
+            if (host->idle_used)
+                gw_idle_conn_expire(host);
+            if (host->health_check_interval)
+                gw_health_check_host(srv, host);
             for (gw_proc *proc = host->first; proc; proc = proc->next) {
                 if (proc->state == PROC_STATE_OVERLOADED)
                     gw_proc_check_enable(host, proc, errh);
@@ -2999,8 +3730,8 @@ handler_t gw_handle_trigger(server *srv, void *p_d) {
          * (unable to use p->defaults.debug since gw_plugin_config
          *  might be part of a larger plugin_config) */
         wkr
-          ? gw_handle_trigger_exts_wkr(conf->exts, errh)
-          : gw_handle_trigger_exts(conf->exts, errh, debug);
+          ? gw_handle_trigger_exts_wkr(srv, conf->exts, errh)
+          : gw_handle_trigger_exts(srv, conf->exts, errh, debug);
     }
 
     return HANDLER_GO_ON;
@@ -27,6 +27,7 @@ typedef struct gw_proc {
     unix_time64_t last_used; /* see idle_timeout */
     int *stats_load;
     int *stats_connected;
+    int *stats_reused;
     pid_t pid;   /* PID of the spawned process (0 if not spawned locally) */
     int is_local;
     uint32_t id; /* id will be between 1 and max_procs */
@@ -35,6 +36,7 @@ typedef struct gw_proc {
 
     unix_time64_t disabled_until; /* proc disabled until given time */
     struct gw_proc *prev; /* see first */
+    struct gw_health_check *hc; /* active health check state */
 
     /* either tcp:<host>:<port> or unix:<socket> for debugging purposes */
     buffer *connection_name;
@@ -56,6 +58,7 @@ typedef struct {
 
     uint32_t active_procs; /* how many procs in state PROC_STATE_RUNNING */
     uint32_t gw_hash;
+    uint32_t ewma_us; /* EWMA of time to first response byte (usecs); 0: none*/
 
     int32_t load;
     int *stats_load;
@@ -118,6 +121,29 @@ typedef struct {
     unsigned short connect_timeout;
     struct gw_handler_ctx *hctxs;
 
+    /*
+     * idle keep-alive connections to backend available for reuse
+     * (if supported by backend protocol, e.g. HTTP/1.1 for mod_proxy)
+     *
+     * keep at most keep_alive_max_idle idle connections to host
+     * and close connections idle for more than keep_alive_idle_timeout
+     */
+    unsigned short keep_alive_max_idle;
+    unsigned short keep_alive_idle_timeout;
+    uint32_t idle_used;
+    struct gw_idle_conn *idle_conns;
+
+    /*
+     * active health checks of remote procs every health_check_interval secs
+     * (TCP connect, or HTTP GET health_check_uri expecting
+     *  health_check_status response if health_check_uri is set)
+     * proc is disabled while health check fails
+     */
+    unsigned short health_check_interval;
+    unsigned short health_check_timeout;
+    unsigned short health_check_status;
+    const buffer *health_check_uri;
+
     /*
      * some gw processes get a little bit larger
      * than wanted. max_requests_per_proc kills a
@@ -249,6 +275,12 @@ typedef struct {
     gw_host **hosts;
     uint32_t used;
     uint32_t size;
+
+    /* consistent hashing (maglev) lookup table of host indexes;
+     * rebuilt when set of hosts with active procs changes */
+    uint32_t *chash;
+    uint32_t chash_size;
+    uint32_t chash_gen;
 } gw_extension;
 
 typedef struct {
@@ -321,6 +353,8 @@ typedef struct gw_handler_ctx {
 
     pid_t     pid;
     int       reconnects; /* number of reconnect attempts */
+    int       reused;     /* fd reused from host idle keep-alive connections */
+    uint64_t  start_us;   /* attempt start (usecs); 0 once sampled (p2c-ewma)*/
 
     int       request_id;
     int       send_content_body;
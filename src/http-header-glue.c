@@ -823,10 +823,60 @@ static int http_response_append_buffer(request_st * const r, buffer * const mem,
 
 
 #ifdef HAVE_SPLICE
+__attribute_pure__
+static int http_response_splice_relay_ok(const request_st * const r, const http_response_opts * const opts, const unsigned int toread) {
+    /* relay response body from backend socket to client socket through pipe
+     * if response headers already sent to client and response body is sent
+     * as-is: HTTP/1.x over cleartext socket (not TLS, not HTTP/2 framed),
+     * Content-Length (not Transfer-Encoding: chunked), and not transformed
+     * (mod_deflate and Range requests require r->resp_body_finished at
+     *  response start, so are not applied once response is streaming)
+     * (new pipe (2 fds) not used if fds are scarce (see server_overload_check))*/
+    const connection * const con = r->con;
+    const chunk * const last = r->write_queue.last;
+    const int is_pipe = (last && last->file.is_pipe);
+    return opts->splice_relay
+        && opts->fdfmt == S_IFSOCK
+        && NULL == opts->parse
+        && r->resp_body_started
+        && !r->resp_decode_chunked
+        && r->state == CON_STATE_WRITE
+        && con->write_queue == &r->write_queue
+        && r->http_version <= HTTP_VERSION_1_1
+        && !con->is_ssl_sock
+        && !r->resp_send_chunked
+        && r->resp_body_scratchpad >= toread
+        && (toread >= 8192 || is_pipe)
+        && (is_pipe || con->srv->cur_fds < con->srv->max_fds_lowat);
+}
+
 static int http_response_append_splice(request_st * const r, http_response_opts * const opts, buffer * const b, const int fd, unsigned int toread) {
     /* check if worthwhile to splice() to avoid copying through userspace */
-    /*assert(opts->simple_accum);*//*(checked in caller)*/
-    if (r->resp_body_scratchpad >= toread
+    if (0 == toread) return 0;
+
+    if (http_response_splice_relay_ok(r, opts, toread)) {
+        if (!buffer_is_blank(b)) {
+            /*(flush small reads previously accumulated in b)*/
+            int rc = http_response_append_buffer(r, b, 0); /*(0 to flush)*/
+            chunk_buffer_yield(b); /*(improve large buf reuse)*/
+            if (__builtin_expect( (0 != rc), 0)) return -1; /* error */
+        }
+        const chunk * const last = r->write_queue.last;
+        const int is_pipe = (last && last->file.is_pipe);
+        ssize_t n =
+          chunkqueue_append_splice_sock_pipe(&r->write_queue, fd, toread);
+        if (n > 0) {
+            if (!is_pipe) /*(count pipes started, not each splice())*/
+                plugin_stats_inc("response.splice-relay");
+            if (0 == (r->resp_body_scratchpad -= n))
+                r->resp_body_finished = 1;
+            return 1; /* success */
+        }
+        /*(fall through; pipe full or not available)*/
+    }
+
+    if (opts->simple_accum
+        && r->resp_body_scratchpad >= toread
         && (toread > 32768
             || (toread >= 8192 /*(!http_response_append_buffer_simple_accum())*/
                 && r->write_queue.last && r->write_queue.last->file.is_temp))) {
@@ -940,6 +990,8 @@ static int http_response_process_headers(request_st * const restrict r, http_res
                 r->http_status = status;
                 opts->local_redir = 0; /*(disable; status was set)*/
                 i = 2;
+                if (s[7] == '0') /*(HTTP/1.0 response; no keep-alive)*/
+                    opts->backend_keep_alive = 0;
             } /* else we expected 3 digits and didn't get them */
         }
 
@@ -1028,7 +1080,13 @@ static int http_response_process_headers(request_st * const restrict r, http_res
                 continue;
             break;
           case HTTP_HEADER_CONNECTION:
-            if (opts->backend == BACKEND_PROXY) continue;
+            if (opts->backend == BACKEND_PROXY) {
+                if (opts->backend_keep_alive
+                    && http_header_str_contains_token(value, end - value,
+                                                      CONST_STR_LEN("close")))
+                    opts->backend_keep_alive = 0;
+                continue;
+            }
             if (r->http_version >= HTTP_VERSION_2) continue;
             /*(simplistic attempt to honor backend request to close)*/
             if (http_header_str_contains_token(value, end - value,
@@ -1325,7 +1383,7 @@ handler_t http_response_read(request_st * const r, http_response_opts * const op
 
           #ifdef HAVE_SPLICE
             /* check if worthwhile to splice() to avoid copying to userspace */
-            if (opts->simple_accum) {
+            if (opts->simple_accum || opts->splice_relay) {
                 int rc = http_response_append_splice(r, opts, b, fd, toread);
                 if (rc) {
                     if (__builtin_expect( (rc > 0), 1))
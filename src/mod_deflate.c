@@ -95,6 +95,12 @@
  *   create and destroy.  If this is ever changed to give away buffers, then use
  *   a unique hctx->output buffer per hctx; do not reuse p->tmp_buf across
  *   multiple requests being handled in parallel.
+ * - deflate.thread-pool-size offloads compression of larger responses to
+ *   worker threads.  Compression stream is initialized and cleaned up on the
+ *   main thread; worker thread only compresses hctx->in_queue into private
+ *   hctx->output and hctx->job_out buffers, and must not access request_st,
+ *   plugin_data, chunkqueue (other than reading hctx->in_queue), or logging.
+ *   Completed jobs are handed back to the main thread through eventfd/pipe.
  */
 #include "first.h"
 
@@ -113,6 +119,7 @@
 #include <errno.h>
 
 #include "base.h"
+#include "algo_md.h"
 #include "ck.h"
 #include "fdevent.h"
 #include "log.h"
@@ -157,6 +164,15 @@
 #undef HAVE_LIBDEFLATE
 #endif
 
+#if defined(HAVE_PTHREAD_H) && !defined(_WIN32)
+#define MOD_DEFLATE_THREADS
+#include <pthread.h>
+#include <signal.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#endif
+
 /* request: accept-encoding */
 #define HTTP_ACCEPT_ENCODING_IDENTITY BV(0)
 #define HTTP_ACCEPT_ENCODING_GZIP     BV(1)
@@ -198,21 +214,82 @@ typedef struct {
 	unsigned short	output_buffer_size;
 	unsigned short	work_block_size;
 	unsigned short	sync_flush;
+	unsigned short	adaptive_level;
 	short		compression_level;
 	uint16_t *	allowed_encodings;
 	double		max_loadavg;
 	const encparms *params;
 } plugin_config;
 
+/* in-memory cache of compressed responses (small static files)
+ * key is file path + ETag (ETag already modified to include encoding label) */
+typedef struct mod_deflate_mcache_entry {
+    struct mod_deflate_mcache_entry *hnext; /* hash chain */
+    struct mod_deflate_mcache_entry *prev;  /* LRU list (toward MRU) */
+    struct mod_deflate_mcache_entry *next;  /* LRU list (toward LRU) */
+    uint32_t hash;
+    uint32_t klen;
+    uint32_t dlen;
+    char key[];                             /* key followed by data */
+} mod_deflate_mcache_entry;
+
+typedef struct {
+    mod_deflate_mcache_entry **htab;
+    mod_deflate_mcache_entry *head;         /* most recently used */
+    mod_deflate_mcache_entry *tail;         /* least recently used */
+    uint32_t hmask;
+    uint32_t used;
+    size_t bytes;
+    size_t max_bytes;
+    size_t max_item;
+    buffer key;
+} mod_deflate_mcache;
+
+/* adaptive compression level (deflate.adaptive-level)
+ * (measurements are per-process; pressure recalculated once per second) */
+typedef struct {
+    uint64_t trigger_us;  /* time of most recent trigger */
+    uint32_t lag_us;      /* event loop lag (EWMA) */
+    uint32_t lag_prev;    /* event loop lag measured in prior interval */
+    uint32_t busy_us;     /* time spent compressing in event loop */
+    uint32_t rate;        /* compression throughput (bytes/ms) (EWMA) */
+    int pressure;         /* 0 none, 1 moderate, 2 heavy */
+} mod_deflate_adapt;
+
+struct handler_ctx;
+
+#ifdef MOD_DEFLATE_THREADS
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct handler_ctx *queue;     /* jobs pending (FIFO) */
+    struct handler_ctx *queue_tail;
+    struct handler_ctx *done;      /* jobs completed (LIFO) */
+    pthread_t *threads;
+    uint32_t nthreads;
+    uint32_t pending;              /* jobs submitted, not yet done */
+    int shutdown;
+    int fd[2];                     /* eventfd (fd[0] == fd[1]) or pipe */
+    fdnode *fdn;
+    server *srv;
+} mod_deflate_tpool;
+#endif
+
 typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
 
     buffer tmp_buf;
+    mod_deflate_mcache mcache;
+    mod_deflate_adapt adapt;
+  #ifdef MOD_DEFLATE_THREADS
+    uint32_t thread_pool_size;
+    mod_deflate_tpool tpool;
+  #endif
 } plugin_data;
 
-typedef struct {
+typedef struct handler_ctx {
 	union {
 	      #ifdef USE_ZLIB
 		z_stream z;
@@ -233,16 +310,25 @@ typedef struct {
 	buffer *output;
 	plugin_data *plugin_data;
 	request_st *r;
+	log_error_st *errh;
 	int compression_type;
+	int clevel;       /*(adaptive compression level; -1 if not set)*/
 	int cache_fd;
 	char *cache_fn;
 	chunkqueue in_queue;
+	struct handler_ctx *job_next;
+	buffer *job_out;  /*(non-NULL if compression offloaded to thread)*/
+	int job_rc;
+	int job_errno;
+	int job_cancel;   /*(set by main thread, read by worker thread)*/
+	int job_orphan;   /*(request reset while job in progress)*/
 } handler_ctx;
 
 __attribute_returns_nonnull__
 static handler_ctx *handler_ctx_init(void) {
 	handler_ctx * const hctx = ck_calloc(1, sizeof(*hctx));
 	chunkqueue_init(&hctx->in_queue);
+	hctx->clevel = -1;
 	hctx->cache_fd = -1;
 	return hctx;
 }
@@ -254,11 +340,10 @@ static void handler_ctx_free(handler_ctx *hctx) {
 	}
 	if (-1 != hctx->cache_fd)
 		close(hctx->cache_fd);
-      #if 0
-	if (hctx->output != &p->tmp_buf) {
-		buffer_free(hctx->output);
+	if (hctx->job_out) {
+		buffer_free(hctx->job_out);
+		buffer_free(hctx->output); /*(not &p->tmp_buf if job_out)*/
 	}
-      #endif
 	chunkqueue_reset(&hctx->in_queue);
 	free(hctx);
 }
@@ -273,9 +358,18 @@ INIT_FUNC(mod_deflate_init) {
     return p;
 }
 
+static void mod_deflate_mcache_free(mod_deflate_mcache * const mc);
+#ifdef MOD_DEFLATE_THREADS
+static void mod_deflate_tpool_free(plugin_data * const p);
+#endif
+
 FREE_FUNC(mod_deflate_free) {
     plugin_data *p = p_d;
+  #ifdef MOD_DEFLATE_THREADS
+    mod_deflate_tpool_free(p);
+  #endif
     free(p->tmp_buf.ptr);
+    mod_deflate_mcache_free(&p->mcache);
     if (NULL == p->cvlist) return;
     /* (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
@@ -359,6 +453,105 @@ static int mod_deflate_cache_file_finish (request_st * const r, handler_ctx * co
     return rc;
 }
 
+static void mod_deflate_mcache_init(mod_deflate_mcache * const mc, const size_t max_bytes) {
+    /* size hash table for average ~8k per entry (power of 2) */
+    uint32_t hsize = 64;
+    while (hsize < 65536 && ((size_t)hsize << 13) < max_bytes) hsize <<= 1;
+    mc->htab = ck_calloc(hsize, sizeof(*mc->htab));
+    mc->hmask = hsize - 1;
+    mc->max_bytes = max_bytes;
+    mc->max_item = max_bytes >> 4; /* each entry at most 1/16 of cache */
+}
+
+static void mod_deflate_mcache_free(mod_deflate_mcache * const mc) {
+    for (mod_deflate_mcache_entry *e = mc->head, *n; e; e = n) {
+        n = e->next;
+        free(e);
+    }
+    free(mc->htab);
+    free(mc->key.ptr);
+    memset(mc, 0, sizeof(*mc));
+}
+
+static void mod_deflate_mcache_unlink(mod_deflate_mcache * const mc, mod_deflate_mcache_entry * const e) {
+    if (e->prev) e->prev->next = e->next; else mc->head = e->next;
+    if (e->next) e->next->prev = e->prev; else mc->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void mod_deflate_mcache_link_head(mod_deflate_mcache * const mc, mod_deflate_mcache_entry * const e) {
+    e->prev = NULL;
+    e->next = mc->head;
+    if (mc->head) mc->head->prev = e; else mc->tail = e;
+    mc->head = e;
+}
+
+static void mod_deflate_mcache_evict(mod_deflate_mcache * const mc, mod_deflate_mcache_entry * const e) {
+    mod_deflate_mcache_entry **ep = mc->htab + (e->hash & mc->hmask);
+    while (*ep != e) ep = &(*ep)->hnext;
+    *ep = e->hnext;
+    mod_deflate_mcache_unlink(mc, e);
+    mc->bytes -= sizeof(*e) + e->klen + e->dlen;
+    --mc->used;
+    free(e);
+}
+
+static const buffer * mod_deflate_mcache_key(mod_deflate_mcache * const mc, const buffer * const path, const buffer * const etag) {
+    buffer * const k = &mc->key;
+    buffer_copy_string_len(k, BUF_PTR_LEN(path));
+    buffer_append_string_len(k, BUF_PTR_LEN(etag));
+    return k;
+}
+
+static mod_deflate_mcache_entry * mod_deflate_mcache_get(mod_deflate_mcache * const mc, const buffer * const k) {
+    const uint32_t klen = buffer_clen(k);
+    const uint32_t hash = djbhash(k->ptr, klen, DJBHASH_INIT);
+    mod_deflate_mcache_entry *e = mc->htab[hash & mc->hmask];
+    for (; e; e = e->hnext) {
+        if (e->hash == hash && e->klen == klen
+            && 0 == memcmp(e->key, k->ptr, klen)) {
+            if (e != mc->head) {
+                mod_deflate_mcache_unlink(mc, e);
+                mod_deflate_mcache_link_head(mc, e);
+            }
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void mod_deflate_mcache_insert(mod_deflate_mcache * const mc, const buffer * const k, const chunkqueue * const cq) {
+    /* store compressed response only if entirely in memory */
+    const off_t dlen = chunkqueue_length(cq);
+    const uint32_t klen = buffer_clen(k);
+    if (dlen <= 0 || (size_t)dlen + klen > mc->max_item) return;
+    for (const chunk *c = cq->first; c; c = c->next) {
+        if (c->type != MEM_CHUNK) return;
+    }
+
+    const size_t sz = sizeof(mod_deflate_mcache_entry) + klen + (size_t)dlen;
+    while (mc->tail && mc->bytes + sz > mc->max_bytes)
+        mod_deflate_mcache_evict(mc, mc->tail);
+
+    mod_deflate_mcache_entry * const e = ck_malloc(sz);
+    e->hash = djbhash(k->ptr, klen, DJBHASH_INIT);
+    e->klen = klen;
+    e->dlen = (uint32_t)dlen;
+    memcpy(e->key, k->ptr, klen);
+    char *d = e->key + klen;
+    for (const chunk *c = cq->first; c; c = c->next) {
+        const uint32_t n = buffer_clen(c->mem) - (uint32_t)c->offset;
+        memcpy(d, c->mem->ptr + c->offset, n);
+        d += n;
+    }
+    mod_deflate_mcache_entry ** const hp = mc->htab + (e->hash & mc->hmask);
+    e->hnext = *hp;
+    *hp = e;
+    mod_deflate_mcache_link_head(mc, e);
+    mc->bytes += sz;
+    ++mc->used;
+}
+
 static void mod_deflate_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
     switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
       case 0: /* deflate.mimetypes */
@@ -413,6 +606,12 @@ static void mod_deflate_merge_config_cpv(plugin_config * const pconf, const conf
         if (cpv->vtype == T_CONFIG_LOCAL)
             pconf->params = cpv->v.v;
         break;
+      case 15:/* deflate.cache-memory-size */ /* T_CONFIG_SCOPE_SERVER */
+      case 16:/* deflate.thread-pool-size */ /* T_CONFIG_SCOPE_SERVER */
+        break;
+      case 17:/* deflate.adaptive-level */
+        pconf->adaptive_level = (unsigned short)cpv->v.u;
+        break;
       default:/* should not happen */
         return;
     }
@@ -718,6 +917,15 @@ SETDEFAULTS_FUNC(mod_deflate_set_defaults) {
      ,{ CONST_STR_LEN("deflate.params"),
         T_CONFIG_ARRAY_KVANY,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("deflate.cache-memory-size"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("deflate.thread-pool-size"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("deflate.adaptive-level"),
+        T_CONFIG_BOOL,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -833,6 +1041,22 @@ SETDEFAULTS_FUNC(mod_deflate_set_defaults) {
                 cpv->v.v = mod_deflate_parse_params(cpv->v.a, srv->errh);
                 cpv->vtype = T_CONFIG_LOCAL;
                 break;
+              case 15:/* deflate.cache-memory-size */ /* T_CONFIG_SCOPE_SERVER */
+                if (cpv->v.u && NULL == p->mcache.htab) /*(size in KB)*/
+                    mod_deflate_mcache_init(&p->mcache, (size_t)cpv->v.u<<10);
+                break;
+              case 16:/* deflate.thread-pool-size */ /* T_CONFIG_SCOPE_SERVER */
+               #ifdef MOD_DEFLATE_THREADS
+                p->thread_pool_size = cpv->v.shrt;
+               #else
+                if (cpv->v.shrt)
+                    log_warn(srv->errh, __FILE__, __LINE__,
+                      "%s ignored; threads not supported in this build",
+                      cpk[cpv->k_id].k);
+               #endif
+                break;
+              case 17:/* deflate.adaptive-level */
+                break;
               default:/* should not happen */
                 break;
             }
@@ -890,6 +1114,10 @@ static int mod_deflate_cache_file_append (handler_ctx * const hctx, const char *
 
 static int stream_http_chunk_append_mem(handler_ctx * const hctx, const char * const out, size_t len) {
     if (0 == len) return 0;
+    if (hctx->job_out) { /*(worker thread)*/
+        buffer_append_string_len(hctx->job_out, out, len);
+        return 0;
+    }
     return (-1 == hctx->cache_fd)
       ? http_chunk_append_mem(hctx->r, out, len)
       : mod_deflate_cache_file_append(hctx, out, len);
@@ -911,7 +1139,9 @@ static int stream_deflate_init(handler_ctx *hctx) {
 
 	const plugin_data * const p = hctx->plugin_data;
 	const encparms * const params = p->conf.params;
-	const int clevel = (NULL != params)
+	const int clevel = (hctx->clevel >= 0)
+	  ? hctx->clevel
+	  : (NULL != params)
 	  ? params->gzip.clevel
 	  : p->conf.compression_level;
 	const int wbits = (NULL != params)
@@ -1004,10 +1234,10 @@ static int stream_deflate_end(handler_ctx *hctx) {
 	if (Z_OK == rc || Z_DATA_ERROR == rc) return 0;
 
 	if (z->msg != NULL) {
-		log_error(hctx->r->conf.errh, __FILE__, __LINE__,
+		log_error(hctx->errh, __FILE__, __LINE__,
 		  "deflateEnd error ret=%d, msg=%s", rc, z->msg);
 	} else {
-		log_error(hctx->r->conf.errh, __FILE__, __LINE__,
+		log_error(hctx->errh, __FILE__, __LINE__,
 		  "deflateEnd error ret=%d", rc);
 	}
 	return -1;
@@ -1118,7 +1348,7 @@ static int stream_bzip2_end(handler_ctx *hctx) {
 	int rc = BZ2_bzCompressEnd(bz);
 	if (BZ_OK == rc || BZ_DATA_ERROR == rc) return 0;
 
-	log_error(hctx->r->conf.errh, __FILE__, __LINE__,
+	log_error(hctx->errh, __FILE__, __LINE__,
 	  "BZ2_bzCompressEnd error ret=%d", rc);
 	return -1;
 }
@@ -1136,7 +1366,9 @@ static int stream_br_init(handler_ctx *hctx) {
     /*(note: we ignore any errors while tuning parameters here)*/
     const plugin_data * const p = hctx->plugin_data;
     const encparms * const params = p->conf.params;
-    const uint32_t quality = (NULL != params)
+    const uint32_t quality = (hctx->clevel >= 0)
+      ? (uint32_t)hctx->clevel
+      : (NULL != params)
       ? params->brotli.quality
       : (p->conf.compression_level >= 0) /* 0 .. 11 are valid values */
         ? (uint32_t)p->conf.compression_level
@@ -1256,6 +1488,13 @@ static int stream_zstd_init(handler_ctx *hctx) {
         ZSTD_initCStream(cctx, level);
       #endif
     }
+    if (hctx->clevel >= 0) { /* adaptive compression level */
+      #if ZSTD_VERSION_NUMBER >= 10000+400+0 /* v1.4.0 */
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, hctx->clevel);
+      #else
+        ZSTD_initCStream(cctx, hctx->clevel);
+      #endif
+    }
     return 0;
 }
 
@@ -1474,7 +1713,9 @@ static int mod_deflate_using_libdeflate_err (handler_ctx * const hctx, buffer *
 static int mod_deflate_using_libdeflate_sm (handler_ctx * const hctx, const plugin_data * const p)
 {
     const encparms * const params = p->conf.params;
-    const int clevel = (NULL != params)
+    const int clevel = (hctx->clevel >= 0)
+      ? hctx->clevel
+      : (NULL != params)
       ? params->gzip.clevel
       : p->conf.compression_level;
     struct libdeflate_compressor * const compressor =
@@ -1575,7 +1816,9 @@ static int mod_deflate_using_libdeflate (handler_ctx * const hctx, const plugin_
     }
 
     const encparms * const params = p->conf.params;
-    const int clevel = (NULL != params)
+    const int clevel = (hctx->clevel >= 0)
+      ? hctx->clevel
+      : (NULL != params)
       ? params->gzip.clevel
       : p->conf.compression_level;
     struct libdeflate_compressor * const compressor =
@@ -1782,6 +2025,417 @@ static handler_t deflate_compress_response(request_st * const r, handler_ctx * c
 }
 
 
+#ifdef MOD_DEFLATE_THREADS
+
+/* responses at least this large are compressed in worker thread, if enabled
+ * (and at most MOD_DEFLATE_THREAD_MAX_SIZE, since worker thread collects the
+ *  entire compressed response in memory (hctx->job_out); larger responses
+ *  are compressed in the event loop, streaming to temp files) */
+#define MOD_DEFLATE_THREAD_MIN_SIZE 65536
+#define MOD_DEFLATE_THREAD_MAX_SIZE 4194304
+
+static int mod_deflate_job_cancelled (handler_ctx * const hctx) {
+    return __atomic_load_n(&hctx->job_cancel, __ATOMIC_RELAXED);
+}
+
+static int mod_deflate_job_compress_file (handler_ctx * const hctx, const chunk * const c, char * const buf, const size_t bufsz) {
+    /*(runs in worker thread)*/
+    /*(FILE_CHUNK opened by main thread before job was queued)*/
+    off_t off = c->offset;
+    for (off_t n = c->file.length - off; n > 0; ) {
+        if (mod_deflate_job_cancelled(hctx)) return -1;
+        const ssize_t rd =
+          chunk_file_pread(c->file.fd, buf,
+                           n < (off_t)bufsz ? (size_t)n : bufsz, off);
+        if (rd <= 0) {
+            if (0 == rd) errno = EIO; /*(file truncated)*/
+            return -1;
+        }
+        if (mod_deflate_compress(hctx, (unsigned char *)buf, rd) < 0)
+            return -1;
+        off += rd;
+        n -= rd;
+    }
+    return 0;
+}
+
+static int mod_deflate_job_compress (handler_ctx * const hctx) {
+    /*(runs in worker thread)*/
+    /*(p->conf.sync_flush is not accessed since flush only at end of stream)*/
+    const size_t bufsz = 256*1024;
+    char *buf = NULL;
+    int rc = 0;
+    for (const chunk *c = hctx->in_queue.first; c && 0 == rc; c = c->next) {
+        if (mod_deflate_job_cancelled(hctx))
+            rc = -1;
+        else if (c->type == MEM_CHUNK)
+            rc = mod_deflate_compress(hctx, (unsigned char *)c->mem->ptr
+                                              + c->offset,
+                                      (off_t)buffer_clen(c->mem) - c->offset);
+        else if (NULL == buf && NULL == (buf = malloc(bufsz)))
+            rc = -1;
+        else
+            rc = mod_deflate_job_compress_file(hctx, c, buf, bufsz);
+    }
+    free(buf);
+    return (0 == rc) ? mod_deflate_stream_flush(hctx, 1) : -1;
+}
+
+static void mod_deflate_tpool_notify (const mod_deflate_tpool * const tp) {
+    /*(ignore write error; EAGAIN if pipe full and reader will be woken)*/
+    ssize_t wr;
+  #ifdef HAVE_SYS_EVENTFD_H
+    if (tp->fd[0] == tp->fd[1]) {
+        const uint64_t u = 1;
+        wr = write(tp->fd[1], &u, sizeof(u));
+    }
+    else
+  #endif
+        wr = write(tp->fd[1], "", 1);
+    UNUSED(wr);
+}
+
+static void * mod_deflate_tpool_thread (void *arg) {
+    mod_deflate_tpool * const tp = arg;
+    pthread_mutex_lock(&tp->mutex);
+    for (;;) {
+        handler_ctx *hctx;
+        while (NULL == (hctx = tp->queue) && !tp->shutdown)
+            pthread_cond_wait(&tp->cond, &tp->mutex);
+        if (NULL == hctx) break; /*(shutdown)*/
+        if (NULL == (tp->queue = hctx->job_next))
+            tp->queue_tail = NULL;
+        pthread_mutex_unlock(&tp->mutex);
+
+        errno = 0;
+        hctx->job_rc = mod_deflate_job_compress(hctx);
+        hctx->job_errno = errno;
+
+        pthread_mutex_lock(&tp->mutex);
+        hctx->job_next = tp->done;
+        tp->done = hctx;
+        if (NULL == hctx->job_next) /*(notify if done list was empty)*/
+            mod_deflate_tpool_notify(tp);
+    }
+    pthread_mutex_unlock(&tp->mutex);
+    return NULL;
+}
+
+static void mod_deflate_job_free (handler_ctx * const hctx) {
+    mod_deflate_stream_end(hctx);
+    handler_ctx_free(hctx);
+}
+
+static void mod_deflate_job_done (plugin_data * const p, handler_ctx * const hctx) {
+    if (hctx->job_orphan) { /*(request was reset while job in progress)*/
+        mod_deflate_job_free(hctx);
+        return;
+    }
+
+    request_st * const r = hctx->r;
+    connection * const con = r->con;
+    r->plugin_ctx[p->id] = NULL;
+    if (0 == hctx->job_rc && 0 == http_chunk_append_buffer(r, hctx->job_out)) {
+        http_chunk_close(r);
+        mod_deflate_note_ratio(r, hctx->bytes_out, hctx->bytes_in);
+    }
+    else {
+        if (hctx->job_rc) {
+            errno = hctx->job_errno;
+            log_perror(r->conf.errh, __FILE__, __LINE__,
+              "compress failed %s", r->target.ptr);
+        }
+        /*(response headers already sent; truncate response, close conn)*/
+        r->keep_alive = 0;
+    }
+    r->resp_body_finished = 1;
+    if (deflate_compress_cleanup(r, hctx) < 0)
+        r->keep_alive = 0;
+    joblist_append(con);
+}
+
+static handler_t mod_deflate_tpool_fdevent (void *ctx, int revents) {
+    plugin_data * const p = ctx;
+    mod_deflate_tpool * const tp = &p->tpool;
+    UNUSED(revents);
+
+    /* drain eventfd or pipe *before* taking done list (avoid lost wakeup) */
+    char buf[64];
+  #ifdef HAVE_SYS_EVENTFD_H
+    if (tp->fd[0] == tp->fd[1]) {
+        if (read(tp->fd[0], buf, sizeof(buf)) < 0) { } /*(ignore)*/
+    }
+    else
+  #endif
+    while (read(tp->fd[0], buf, sizeof(buf)) == (ssize_t)sizeof(buf)) ;
+
+    pthread_mutex_lock(&tp->mutex);
+    handler_ctx *hctx = tp->done;
+    tp->done = NULL;
+    pthread_mutex_unlock(&tp->mutex);
+
+    for (handler_ctx *next; hctx; hctx = next) {
+        next = hctx->job_next;
+        --tp->pending;
+        mod_deflate_job_done(p, hctx);
+    }
+
+    return HANDLER_FINISHED;
+}
+
+static int mod_deflate_job_submit (request_st * const r, plugin_data * const p, handler_ctx * const hctx) {
+    /* open files on main thread; worker thread only reads */
+    chunkqueue * const cq = &r->write_queue;
+    for (chunk *c = cq->first; c; c = c->next) {
+        if (c->type == FILE_CHUNK && -1 == c->file.fd
+            && -1 == (c->file.fd = fdevent_open_cloexec(c->mem->ptr, r->conf.follow_symlink, O_RDONLY, 0))) {
+            log_perror(r->conf.errh, __FILE__, __LINE__,
+              "open failed %s", c->mem->ptr);
+            return -1;
+        }
+    }
+
+    /* move all chunks from write_queue into in_queue, then adjust
+     * counters since r->write_queue is reused for compressed output */
+    const off_t len = chunkqueue_length(cq);
+    chunkqueue_remove_finished_chunks(cq);
+    chunkqueue_append_chunkqueue(&hctx->in_queue, cq);
+    cq->bytes_in  -= len;
+    cq->bytes_out -= len;
+
+    /* response headers are sent while compressing (and response body
+     * is then sent with Transfer-Encoding: chunked for HTTP/1.1)
+     * (response from handler was complete; do not call handler_module
+     *  handle_subrequest() while resp_body_finished is temporarily unset) */
+    r->resp_body_finished = 0;
+    r->handler_module = NULL;
+    r->plugin_ctx[p->id] = hctx;
+
+    mod_deflate_tpool * const tp = &p->tpool;
+    hctx->job_next = NULL;
+    ++tp->pending;
+    pthread_mutex_lock(&tp->mutex);
+    if (tp->queue_tail)
+        tp->queue_tail->job_next = hctx;
+    else
+        tp->queue = hctx;
+    tp->queue_tail = hctx;
+    pthread_cond_signal(&tp->cond);
+    pthread_mutex_unlock(&tp->mutex);
+    return 0;
+}
+
+__attribute_cold__
+static void mod_deflate_tpool_free (plugin_data * const p) {
+    mod_deflate_tpool * const tp = &p->tpool;
+    if (NULL == tp->srv) return;
+
+    pthread_mutex_lock(&tp->mutex);
+    tp->shutdown = 1;
+    pthread_cond_broadcast(&tp->cond);
+    pthread_mutex_unlock(&tp->mutex);
+    for (uint32_t i = 0; i < tp->nthreads; ++i)
+        pthread_join(tp->threads[i], NULL);
+    free(tp->threads);
+
+    /*(requests already reset; jobs orphaned)*/
+    for (handler_ctx *hctx = tp->queue, *next; hctx; hctx = next) {
+        next = hctx->job_next;
+        mod_deflate_job_free(hctx);
+    }
+    for (handler_ctx *hctx = tp->done, *next; hctx; hctx = next) {
+        next = hctx->job_next;
+        mod_deflate_job_free(hctx);
+    }
+
+    server * const srv = tp->srv;
+    fdevent_fdnode_event_del(srv->ev, tp->fdn);
+    fdevent_unregister(srv->ev, tp->fdn);
+    if (tp->fd[0] != tp->fd[1]) {
+        close(tp->fd[1]);
+        --srv->cur_fds;
+    }
+    close(tp->fd[0]);
+    --srv->cur_fds;
+
+    pthread_cond_destroy(&tp->cond);
+    pthread_mutex_destroy(&tp->mutex);
+    memset(tp, 0, sizeof(*tp));
+}
+
+__attribute_cold__
+static int mod_deflate_tpool_init (server * const srv, plugin_data * const p) {
+    mod_deflate_tpool * const tp = &p->tpool;
+  #ifdef HAVE_SYS_EVENTFD_H
+    tp->fd[0] = tp->fd[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (-1 == tp->fd[0])
+  #endif
+    {
+        if (0 != fdevent_pipe_cloexec(tp->fd, 0)) {
+            log_perror(srv->errh, __FILE__, __LINE__, "pipe()");
+            return -1;
+        }
+        fdevent_fcntl_set_nb(tp->fd[0]);
+        fdevent_fcntl_set_nb(tp->fd[1]);
+        ++srv->cur_fds;
+    }
+    ++srv->cur_fds;
+    tp->srv = srv;
+    tp->fdn = fdevent_register(srv->ev, tp->fd[0], mod_deflate_tpool_fdevent, p);
+    fdevent_fdnode_event_set(srv->ev, tp->fdn, FDEVENT_IN);
+
+    pthread_mutex_init(&tp->mutex, NULL);
+    pthread_cond_init(&tp->cond, NULL);
+
+    /* block signals in worker threads; signals handled by main thread */
+    sigset_t all, orig;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &orig);
+    tp->threads = ck_calloc(p->thread_pool_size, sizeof(pthread_t));
+    for (uint32_t i = 0; i < p->thread_pool_size; ++i) {
+        const int rc = pthread_create(tp->threads+i, NULL,
+                                      mod_deflate_tpool_thread, tp);
+        if (0 != rc) {
+            errno = rc;
+            log_perror(srv->errh, __FILE__, __LINE__, "pthread_create()");
+            break;
+        }
+        ++tp->nthreads;
+    }
+    pthread_sigmask(SIG_SETMASK, &orig, NULL);
+
+    return tp->nthreads ? 0 : -1;
+}
+
+SERVER_FUNC(mod_deflate_worker_init) {
+    plugin_data * const p = p_d;
+    if (0 == p->thread_pool_size) return HANDLER_GO_ON;
+    if (0 != mod_deflate_tpool_init(srv, p)) {
+        mod_deflate_tpool_free(p);
+        return HANDLER_ERROR;
+    }
+    return HANDLER_GO_ON;
+}
+
+#endif /* MOD_DEFLATE_THREADS */
+
+
+/* adaptive compression level
+ *
+ * Per-response compression level is chosen from compression "pressure"
+ * (recalculated once per second from time spent compressing in the event
+ * loop, event loop lag, and compression jobs backlog), from the predicted
+ * time to compress the response (using measured compression throughput),
+ * and from the response size and whether result will be cached.
+ * Small, cacheable responses are compressed at high level when there is
+ * no pressure, since result is reused.  Large responses, or all responses
+ * under heavy pressure (or when deflate.max-loadavg is exceeded), are
+ * compressed at fast level.  Otherwise, configured level is used. */
+
+/* responses at least this large are always compressed at fast level */
+#define MOD_DEFLATE_ADAPT_LARGE     (1024*1024)
+/* cacheable responses up to this size compressed at high level */
+#define MOD_DEFLATE_ADAPT_HIGH_MAX  65536
+/* compress at fast level if predicted to take longer than this (ms) */
+#define MOD_DEFLATE_ADAPT_MAX_MS    20
+
+static uint64_t mod_deflate_monotonic_us (void) {
+    unix_timespec64_t ts;
+  #ifdef CLOCK_MONOTONIC
+    if (0 != log_clock_gettime(CLOCK_MONOTONIC, &ts))
+  #endif
+        log_clock_gettime_realtime(&ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void mod_deflate_adapt_note (plugin_data * const p, const uint64_t start_us, const off_t bytes) {
+    mod_deflate_adapt * const a = &p->adapt;
+    uint64_t t = mod_deflate_monotonic_us() - start_us;
+    if (t > 10000000) t = 10000000; /*(clamp to 10s)*/
+    a->busy_us += (uint32_t)t;
+    if (t < 1000) return; /*(too short for meaningful throughput measure)*/
+    /* exponentially weighted moving average of throughput (alpha = 1/8)*/
+    uint64_t rate = (uint64_t)bytes * 1000u / t;
+    if (rate > UINT32_MAX) rate = UINT32_MAX;
+    a->rate = a->rate
+      ? (uint32_t)(((uint64_t)a->rate * 7 + rate) >> 3)
+      : (uint32_t)rate;
+}
+
+static int mod_deflate_adapt_tier_base (const off_t len, const int cacheable) {
+    /* tier chosen by response size alone (without load) */
+    if (len >= MOD_DEFLATE_ADAPT_LARGE)
+        return -1;
+    return (cacheable && len <= MOD_DEFLATE_ADAPT_HIGH_MAX) ? 1 : 0;
+}
+
+static int mod_deflate_adapt_tier (const plugin_data * const p, const off_t len, const int cacheable) {
+    /* returns -1 for fast level, 0 for configured level, 1 for high level */
+    const mod_deflate_adapt * const a = &p->adapt;
+    if (a->pressure > 1 || len >= MOD_DEFLATE_ADAPT_LARGE)
+        return -1;
+    if (a->rate && len / a->rate >= MOD_DEFLATE_ADAPT_MAX_MS)
+        return -1;
+    if (a->pressure)
+        return (len > MOD_DEFLATE_ADAPT_HIGH_MAX) ? -1 : 0;
+    return mod_deflate_adapt_tier_base(len, cacheable);
+}
+
+static int mod_deflate_adapt_level (const int compression_type, const int tier) {
+    if (0 == tier) return -1; /*(use configured level)*/
+    switch (compression_type) {
+      case HTTP_ACCEPT_ENCODING_GZIP:
+      case HTTP_ACCEPT_ENCODING_DEFLATE:
+        return tier < 0 ? 1 : 9;
+      case HTTP_ACCEPT_ENCODING_BR:
+        return tier < 0 ? 1 : 11;
+      case HTTP_ACCEPT_ENCODING_ZSTD:
+        return tier < 0 ? 1 : 19;
+      default: /*(bzip2 level is block size, not speed)*/
+        return -1;
+    }
+}
+
+TRIGGER_FUNC(mod_deflate_handle_trigger) {
+    plugin_data * const p = p_d;
+    mod_deflate_adapt * const a = &p->adapt;
+    UNUSED(srv);
+
+    /* event loop lag: trigger expected once per second
+     * (use lesser of two most recent measurements to filter out single
+     *  spurious delay, e.g. shift in timing of wake-ups relative to
+     *  second boundary) */
+    const uint64_t now = mod_deflate_monotonic_us();
+    if (a->trigger_us) {
+        uint64_t lag = now - a->trigger_us;
+        lag = (lag > 1000000) ? lag - 1000000 : 0;
+        if (lag > 10000000) lag = 10000000; /*(clamp to 10s)*/
+        const uint32_t cur = (uint32_t)lag;
+        const uint32_t min = cur < a->lag_prev ? cur : a->lag_prev;
+        a->lag_prev = cur;
+        a->lag_us = (a->lag_us * 3 + min) >> 2; /*(EWMA alpha = 1/4)*/
+    }
+    a->trigger_us = now;
+
+    /* pressure: moderate if compressing > 25% of the time in event loop,
+     * heavy if > 50%; similar thresholds for event loop lag */
+    int pressure = 0;
+    if (a->busy_us > 250000 || a->lag_us > 100000)
+        pressure = 1;
+    if (a->busy_us > 500000 || a->lag_us > 500000)
+        pressure = 2;
+  #ifdef MOD_DEFLATE_THREADS
+    if (p->tpool.nthreads && p->tpool.pending > p->tpool.nthreads
+        && 0 == pressure)
+        pressure = 1;
+  #endif
+    a->pressure = pressure;
+    a->busy_us = 0;
+
+    return HANDLER_GO_ON;
+}
+
+
 static int mod_deflate_choose_encoding (const char *value, plugin_data *p, const char **label) {
 	/* get client side support encodings */
 	int accept_encoding = 0;
@@ -2014,8 +2668,11 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 		}
 	}
 
+	int adapt_fast = 0;
 	if (0.0 < p->conf.max_loadavg && p->conf.max_loadavg < r->con->srv->loadavg[0]) {
-		return HANDLER_GO_ON;
+		if (!p->conf.adaptive_level) return HANDLER_GO_ON;
+		/* compress at fast level instead of not compressing */
+		adapt_fast = 1;
 	}
 
 	/* update ETag, if ETag response header is set */
@@ -2055,9 +2712,13 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 	 *       memory (if streaming HTTP/1.1 chunked response) and will end up
 	 *       getting stream-compressed rather than cached on disk as compressed
 	 *       file
+	 * Note: if deflate.cache-memory-size is set, files small enough to fit
+	 *       in the in-memory cache (and <= 64k) are cached in memory instead
+	 *       of on disk
 	 */
 	buffer *tb = NULL;
-	if (p->conf.cache_dir
+	const buffer *mk = NULL;
+	if ((p->conf.cache_dir || p->mcache.max_bytes)
 	    && !had_vary
 	    && etaglen > 2
 	    && r->resp_body_finished
@@ -2073,6 +2734,32 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 	            && !http_header_str_contains_token(BUF_PTR_LEN(vbro),
 	                                               CONST_STR_LEN("no-store"))))
 	   ) {
+	  if (p->mcache.max_bytes && (size_t)len <= p->mcache.max_item
+	      && len <= 65536) {
+		/*(larger output is spilled to temp file by http_chunk_append_mem()
+		 * and could not be stored in memory; use cache-dir, if set)*/
+		/* small file; check in-memory cache of compressed responses */
+		mk = mod_deflate_mcache_key(&p->mcache,
+		                            r->write_queue.first->mem, vb);
+		const mod_deflate_mcache_entry * const e =
+		  mod_deflate_mcache_get(&p->mcache, mk);
+		if (NULL != e) {
+			chunkqueue_reset(&r->write_queue);
+			if (0 != http_chunk_append_mem(r, e->key + e->klen, e->dlen))
+				return HANDLER_ERROR;
+			if (light_btst(r->resp_htags, HTTP_HEADER_CONTENT_LENGTH))
+				http_header_response_unset(r, HTTP_HEADER_CONTENT_LENGTH,
+				                           CONST_STR_LEN("Content-Length"));
+			mod_deflate_note_ratio(r, e->dlen, len);
+			return HANDLER_GO_ON;
+		}
+		/* sanity check that response was whole file */
+		stat_cache_entry * const sce =
+		  stat_cache_get_entry(r->write_queue.first->mem);
+		if (NULL == sce || sce->st.st_size != len)
+			mk = NULL;
+	  }
+	  else if (p->conf.cache_dir) {
 		tb = mod_deflate_cache_file_name(r, p->conf.cache_dir, vb);
 		/*(checked earlier and skipped if Transfer-Encoding had been set)*/
 		stat_cache_entry *sce = stat_cache_get_entry_open(tb, 1);
@@ -2093,6 +2780,7 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 			tb = NULL;
 		else if (0 != mkdir_for_file(tb->ptr))
 			tb = NULL;
+	  }
 	}
 
 	/* enable compression */
@@ -2104,6 +2792,22 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 	hctx->plugin_data = p;
 	hctx->compression_type = compression_type;
 	hctx->r = r;
+	hctx->errh = r->conf.errh;
+	uint64_t adapt_start = 0;
+	if (p->conf.adaptive_level) {
+		const int cacheable = (NULL != tb || NULL != mk);
+		const int tier = adapt_fast
+		  ? -1
+		  : mod_deflate_adapt_tier(p, len, cacheable);
+		hctx->clevel = mod_deflate_adapt_level(compression_type, tier);
+		/* do not cache result if load forced a lower level; cached result
+		 * would otherwise be served at lower level long after load drops */
+		if (cacheable && tier < mod_deflate_adapt_tier_base(len, cacheable)) {
+			tb = NULL;
+			mk = NULL;
+		}
+		adapt_start = mod_deflate_monotonic_us();
+	}
 	/* setup output buffer */
 	buffer_clear(&p->tmp_buf);
 	hctx->output = &p->tmp_buf;
@@ -2127,8 +2831,13 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 		rc = HANDLER_GO_ON;
 		hctx->bytes_in = len;
 		if (mod_deflate_using_libdeflate(hctx, p)) {
-			if (NULL == tb || 0 == mod_deflate_cache_file_finish(r, hctx, tb))
+			if (adapt_start)
+				mod_deflate_adapt_note(p, adapt_start, len);
+			if (NULL == tb || 0 == mod_deflate_cache_file_finish(r, hctx, tb)) {
 				mod_deflate_note_ratio(r, hctx->bytes_out, hctx->bytes_in);
+				if (mk)
+					mod_deflate_mcache_insert(&p->mcache,mk,&r->write_queue);
+			}
 			else
 				rc = HANDLER_ERROR;
 			handler_ctx_free(hctx);
@@ -2148,8 +2857,13 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 		rc = HANDLER_GO_ON;
 		hctx->bytes_in = len;
 		if (mod_deflate_using_libdeflate_sm(hctx, p)) {
-			if (NULL == tb || 0 == mod_deflate_cache_file_finish(r, hctx, tb))
+			if (adapt_start)
+				mod_deflate_adapt_note(p, adapt_start, len);
+			if (NULL == tb || 0 == mod_deflate_cache_file_finish(r, hctx, tb)) {
 				mod_deflate_note_ratio(r, hctx->bytes_out, hctx->bytes_in);
+				if (mk)
+					mod_deflate_mcache_insert(&p->mcache,mk,&r->write_queue);
+			}
 			else
 				rc = HANDLER_ERROR;
 			handler_ctx_free(hctx);
@@ -2159,6 +2873,23 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 	}
   #endif /* HAVE_LIBDEFLATE */
 
+  #ifdef MOD_DEFLATE_THREADS
+	/* compress larger responses in worker thread (if thread pool enabled)
+	 * (not if writing to cache-dir or in-memory cache, or if decoding
+	 *  Transfer-Encoding: chunked from backend) */
+	const int offload = (p->tpool.nthreads
+	                     && len >= MOD_DEFLATE_THREAD_MIN_SIZE
+	                     && len <= MOD_DEFLATE_THREAD_MAX_SIZE
+	                     && NULL == tb && NULL == mk
+	                     && NULL == r->gw_dechunk);
+	if (offload) {
+		/* private output buffers for use by worker thread */
+		hctx->job_out = buffer_init();
+		hctx->output = buffer_init();
+		buffer_string_prepare_copy(hctx->output, p->tmp_buf.size-1);
+	}
+  #endif
+
 	if (0 != mod_deflate_stream_init(hctx)) {
 		/*(should not happen unless ENOMEM)*/
 		handler_ctx_free(hctx);
@@ -2183,9 +2914,21 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 	if (light_btst(r->resp_htags, HTTP_HEADER_CONTENT_LENGTH)) {
 		http_header_response_unset(r, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"));
 	}
+
+  #ifdef MOD_DEFLATE_THREADS
+	if (offload) {
+		if (0 == mod_deflate_job_submit(r, p, hctx))
+			return HANDLER_GO_ON;
+		deflate_compress_cleanup(r, hctx);
+		return HANDLER_ERROR;
+	}
+  #endif
+
 	r->plugin_ctx[p->id] = hctx;
 
 	rc = deflate_compress_response(r, hctx);
+	if (adapt_start)
+		mod_deflate_adapt_note(p, adapt_start, len);
 	if (HANDLER_GO_ON == rc) return HANDLER_GO_ON;
 	if (HANDLER_FINISHED == rc) {
 	  #ifdef __COVERITY__
@@ -2195,6 +2938,8 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 		if (-1 == hctx->cache_fd
 		    || 0 == mod_deflate_cache_file_finish(r, hctx, tb)) {
 			mod_deflate_note_ratio(r, hctx->bytes_out, hctx->bytes_in);
+			if (mk)
+				mod_deflate_mcache_insert(&p->mcache, mk, &r->write_queue);
 			rc = HANDLER_GO_ON;
 		}
 		else
@@ -2211,6 +2956,14 @@ static handler_t mod_deflate_cleanup(request_st * const r, void *p_d) {
 
 	if (NULL != hctx) {
 		r->plugin_ctx[p->id] = NULL;
+	  #ifdef MOD_DEFLATE_THREADS
+		if (hctx->job_out) {
+			/* job in progress in worker thread; free hctx when done */
+			hctx->job_orphan = 1;
+			__atomic_store_n(&hctx->job_cancel, 1, __ATOMIC_RELAXED);
+			return HANDLER_GO_ON;
+		}
+	  #endif
 		deflate_compress_cleanup(r, hctx);
 	}
 
@@ -2228,7 +2981,11 @@ int mod_deflate_plugin_init(plugin *p) {
 	p->init		= mod_deflate_init;
 	p->cleanup	= mod_deflate_free;
 	p->set_defaults	= mod_deflate_set_defaults;
+  #ifdef MOD_DEFLATE_THREADS
+	p->worker_init	= mod_deflate_worker_init;
+  #endif
 	p->handle_request_reset = mod_deflate_cleanup;
+	p->handle_trigger	= mod_deflate_handle_trigger;
 	p->handle_response_start	= mod_deflate_handle_response_start;
 
 	return 0;
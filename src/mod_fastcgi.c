@@ -255,7 +255,8 @@ static handler_t fcgi_create_env(handler_ctx *hctx) {
 	fcgi_header(&(beginRecord.header), FCGI_BEGIN_REQUEST, request_id, sizeof(beginRecord.body), 0);
 	beginRecord.body.roleB0 = hctx->gw_mode;
 	beginRecord.body.roleB1 = 0;
-	beginRecord.body.flags = 0;
+	/* FCGI_KEEP_CONN if connection might be reused (see gw_backend.c) */
+	beginRecord.body.flags = hctx->opts.backend_keep_alive ? FCGI_KEEP_CONN : 0;
 	memset(beginRecord.body.reserved, 0, sizeof(beginRecord.body.reserved));
 	fcgi_header(&header, FCGI_PARAMS, request_id, 0, 0); /*(set aside space to fill in later)*/
 	buffer_append_str2(b, (const char *)&beginRecord, sizeof(beginRecord),
@@ -388,6 +389,7 @@ static handler_t fcgi_recv_parse_loop(request_st * const r, handler_ctx * const
 				fastcgi_get_packet_body(hdrs, hctx, &packet);
 				if (HANDLER_GO_ON != http_response_parse_headers(r, &hctx->opts, hdrs)) {
 					hctx->send_content_body = 0;
+					hctx->opts.backend_keep_alive = 0;
 					fin = 1;
 					break;
 				}
@@ -428,6 +430,7 @@ static handler_t fcgi_recv_parse_loop(request_st * const r, handler_ctx * const
 					/* error writing to tempfile;
 					 * truncate response or send 500 if nothing sent yet */
 					hctx->send_content_body = 0;
+					hctx->opts.backend_keep_alive = 0;
 					fin = 1;
 				}
 				if (packet.padding) chunkqueue_mark_written(hctx->rb, packet.padding);
@@ -446,6 +449,10 @@ static handler_t fcgi_recv_parse_loop(request_st * const r, handler_ctx * const
 			break;
 		case FCGI_END_REQUEST:
 			hctx->request_id = -1; /*(flag request ended)*/
+			chunkqueue_mark_written(hctx->rb, packet.len);
+			/*(do not reuse connection if unexpected data follows)*/
+			if (!chunkqueue_is_empty(hctx->rb))
+				hctx->opts.backend_keep_alive = 0;
 			fin = 1;
 			break;
 		default:
@@ -511,6 +518,8 @@ static handler_t fcgi_check_extension(request_st * const r, void *p_d, int uri_p
 		hctx->opts.headers = fcgi_response_headers;
 		hctx->opts.pdata = hctx;   /*(skip +255 for potential padding)*/
 		hctx->opts.max_per_read = sizeof(FCGI_Header)+FCGI_MAX_LENGTH+1;
+		/*(decided before gw_write_request() might reuse idle connection)*/
+		hctx->opts.backend_keep_alive = (0 != hctx->host->keep_alive_max_idle);
 		hctx->stdin_append = fcgi_stdin_append;
 		hctx->create_env = fcgi_create_env;
 		if (!hctx->rb) {
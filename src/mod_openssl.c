@@ -10,21 +10,22 @@
  *     ssl.openssl.ssl-conf-cmd = ("Options" => "-SessionTicket")
  *   mod_openssl rotates server ticket encryption key (STEK) every 8 hours
  *   and keeps the prior two STEKs around, so ticket lifetime is 24 hours.
- *   This is fine for use with a single lighttpd instance, but with multiple
- *   lighttpd workers, no coordinated STEK (server ticket encryption key)
- *   rotation occurs unless ssl.stek-file is defined and maintained (preferred),
- *   or if some external job restarts lighttpd.  Restarting lighttpd generates a
- *   new key that is shared by lighttpd workers for the lifetime of the new key.
- *   If the rotation period expires and lighttpd has not been restarted, and if
- *   ssl.stek-file is not in use, then lighttpd workers will generate new
- *   independent keys, making session tickets less effective for session
- *   resumption, since clients have a lower chance for future connections to
- *   reach the same lighttpd worker.  However, things will still work, and a new
- *   session will be created if session resumption fails.  Admins should plan to
- *   restart lighttpd at least every 8 hours if session tickets are enabled and
- *   multiple lighttpd workers are configured.  Since that is likely disruptive,
- *   if multiple lighttpd workers are configured, ssl.stek-file should be
- *   defined and the file maintained externally.
+ *   With multiple lighttpd workers (server.max-worker), STEK are kept in
+ *   memory shared between workers (where mmap() MAP_SHARED is available),
+ *   so STEK rotation is coordinated and a ticket issued by one worker can
+ *   be decrypted by any worker.  On Linux, shared memory (memfd) persists
+ *   across graceful restart, so STEK are not regenerated upon graceful restart.
+ *   Where shared memory is not available, lighttpd workers generate
+ *   independent keys upon rotation, making session tickets less effective
+ *   for session resumption.  If multiple lighttpd instances (e.g. on multiple
+ *   machines) should share STEK, ssl.stek-file should be defined and the file
+ *   maintained externally; the file is read by one worker and the keys are
+ *   then shared with other workers.
+ *
+ * Note: If server-side session cache is enabled with
+ *     server.feature-flags += ("ssl.session-cache" => "enable")
+ *   the session cache is kept in memory shared between workers (OpenSSL 1.1.0
+ *   or later), sized with ("ssl.session-cache-size" => 4096) (entries).
  */
 #include "first.h"
 
@@ -179,6 +180,10 @@ static int ktls_enable;
 static plugin_data *plugin_data_singleton;
 #define LOCAL_SEND_BUFSIZE (16 * 1024)
 static char *local_send_buffer;
+/* bytes sent with SSL_write() (copied through userspace; encrypted in
+ * userspace unless kTLS) and with SSL_sendfile() (kTLS; not copied) */
+static uint64_t tls_write_bytes;
+static uint64_t ktls_sendfile_bytes;
 
 typedef struct {
     SSL *ssl;
@@ -187,6 +192,7 @@ typedef struct {
     short renegotiations; /* count of SSL_CB_HANDSHAKE_START */
     short close_notify;
     unsigned short alpn;
+    unsigned short ktls_checked;
     plugin_config conf;
     buffer *tmp_buf;
     log_error_st *errh;
@@ -225,6 +231,405 @@ typedef struct tlsext_ticket_key_st {
 
 static tlsext_ticket_key_t session_ticket_keys[4];
 static unix_time64_t stek_rotate_ts;
+#endif /* TLSEXT_TYPE_session_ticket */
+
+
+#ifndef _WIN32
+#include <sys/mman.h>   /* mmap() munmap() memfd_create() */
+#include "sys-unistd.h" /* close() ftruncate() readlinkat() */
+#if defined(MAP_SHARED) && defined(MAP_ANONYMOUS) && defined(HAVE_PTHREAD_H) \
+ && defined(_POSIX_THREAD_PROCESS_SHARED) && _POSIX_THREAD_PROCESS_SHARED > 0\
+ && (defined(__linux__) || defined(__FreeBSD__)) /*(robust mutexes)*/
+#include <pthread.h>
+#define MOD_OPENSSL_SHM
+#if defined(MFD_CLOEXEC) && defined(__linux__) /*(/proc/self/fd)*/
+#define MOD_OPENSSL_SHM_MEMFD_REUSE
+#include <dirent.h>     /* opendir() readdir() closedir() */
+#endif
+#endif
+#endif
+
+#ifdef MOD_OPENSSL_SHM
+
+/* Memory shared between lighttpd workers for coordinated session ticket
+ * encryption key (STEK) rotation and for a server-side TLS session cache
+ * (if ssl.session-cache is enabled).  Memory is created (in the lighttpd
+ * parent process) before workers are forked.  On Linux, memory is backed
+ * by memfd, which is kept open (O_CLOEXEC) across graceful restart, so that
+ * keys and cached sessions are preserved across graceful restart.  (memfd is
+ * found again in /proc/self/fd, rather than passed in environment, which
+ * would be inherited by CGI and other child processes)
+ *
+ * Workers load STEK from shared memory when generation counter changes
+ * (checked once per second).  Tickets are encrypted and decrypted using
+ * the local copy of STEK, so that ticket callback does not take lock.
+ *
+ * Lock is a process-shared, robust mutex; critical sections are short
+ * (memcpy()), and lock is recovered if holder has exited (e.g. worker crash).
+ */
+
+#define MOD_OPENSSL_SHM_MAGIC     0x6c747332u /* "lts2" */
+#define MOD_OPENSSL_SHM_MEMFD     "lighttpd-ssl"
+#define MOD_OPENSSL_SHM_SESS_SZ   1024        /* size of cache entry */
+#define MOD_OPENSSL_SHM_SESS_WAYS 4           /* entries per cache set */
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L \
+ && !defined(LIBRESSL_VERSION_NUMBER) \
+ && !defined(BORINGSSL_API_VERSION)
+#define MOD_OPENSSL_SHM_SESS
+#endif
+
+typedef struct mod_openssl_shm_sess {
+    uint32_t hash;       /* 0 if entry unused */
+    uint16_t id_len;
+    uint16_t der_len;
+    unix_time64_t expire_ts;
+    unsigned char id[32];/* SSL_MAX_SSL_SESSION_ID_LENGTH */
+    unsigned char der[MOD_OPENSSL_SHM_SESS_SZ - 48]; /* DER-encoded session */
+} mod_openssl_shm_sess;
+
+typedef struct mod_openssl_shm {
+    uint32_t magic;
+    uint32_t nsess;      /* num session cache entries */
+    uint32_t stek_gen;   /* incremented when STEK rotated */
+    pthread_mutex_t lock;/* PTHREAD_PROCESS_SHARED, PTHREAD_MUTEX_ROBUST */
+  #ifdef TLSEXT_TYPE_session_ticket
+    unix_time64_t stek_rotate_ts;
+    tlsext_ticket_key_t stek[3];
+  #endif
+    mod_openssl_shm_sess sess[];
+} mod_openssl_shm;
+
+static mod_openssl_shm *ssl_shm;
+static size_t ssl_shm_sz;
+static int ssl_shm_fd = -1; /* memfd (kept open across graceful restart) */
+static uint32_t ssl_shm_stek_gen; /* generation of local copy of STEK */
+
+
+static void
+mod_openssl_shm_lock (void)
+{
+    if (__builtin_expect( (EOWNERDEAD == pthread_mutex_lock(&ssl_shm->lock)),0)){
+        /* holder exited while holding lock (e.g. worker crashed); session
+         * cache entry might be partially written, so clear session cache.
+         * (STEK is published with stek_gen updated after copy, so partial
+         *  STEK copy is not loaded by other workers) */
+        OPENSSL_cleanse(ssl_shm->sess,
+                        ssl_shm->nsess * sizeof(mod_openssl_shm_sess));
+        pthread_mutex_consistent(&ssl_shm->lock);
+    }
+}
+
+
+static void
+mod_openssl_shm_unlock (void)
+{
+    pthread_mutex_unlock(&ssl_shm->lock);
+}
+
+
+#ifdef MOD_OPENSSL_SHM_MEMFD_REUSE
+__attribute_cold__
+static int
+mod_openssl_shm_memfd_find (void)
+{
+    /* find memfd created by prior config in this process (graceful restart)
+     * (mod_openssl might have been unloaded and reloaded) */
+    DIR * const dp = opendir("/proc/self/fd");
+    if (NULL == dp) return -1;
+    const int dfd = dirfd(dp);
+    int fd = -1;
+    char lnk[64];
+    for (struct dirent *dent; -1 == fd && (dent = readdir(dp)); ) {
+        char *e;
+        const long n = strtol(dent->d_name, &e, 10);
+        if (*e != '\0' || e == dent->d_name || n < 0 || n == dfd) continue;
+        const ssize_t len = readlinkat(dfd, dent->d_name, lnk, sizeof(lnk)-1);
+        if (len <= 0) continue;
+        lnk[len] = '\0';
+        if (0 == strncmp(lnk, "/memfd:" MOD_OPENSSL_SHM_MEMFD " ",
+                         sizeof("/memfd:" MOD_OPENSSL_SHM_MEMFD " ")-1))
+            fd = (int)n;
+    }
+    closedir(dp);
+    return fd;
+}
+#endif
+
+
+__attribute_cold__
+static mod_openssl_shm *
+mod_openssl_shm_inherit (const size_t sz)
+{
+    /* reuse shared memory (memfd) from prior config (graceful restart) */
+  #ifdef MOD_OPENSSL_SHM_MEMFD_REUSE
+    const int fd = mod_openssl_shm_memfd_find();
+    if (fd < 0) return NULL;
+    struct stat st;
+    mod_openssl_shm *shm = MAP_FAILED;
+    if (0 == fstat(fd, &st) && st.st_size == (off_t)sz)
+        shm = mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm != MAP_FAILED && shm->magic == MOD_OPENSSL_SHM_MAGIC) {
+        ssl_shm_fd = fd;
+        return shm;
+    }
+    /* size changed (ssl.session-cache, ssl.session-cache-size) or invalid */
+    if (shm != MAP_FAILED) munmap(shm, sz);
+    close(fd);
+    ssl_shm_fd = -1;
+  #else
+    UNUSED(sz);
+  #endif
+    return NULL;
+}
+
+
+__attribute_cold__
+static void
+mod_openssl_shm_init (server * const srv)
+{
+    if (ssl_shm) return;
+    /* size for STEK only, unless server-side session cache is enabled */
+    const int32_t n = config_feature_bool(srv, "ssl.session-cache", 0)
+      ? config_feature_int(srv, "ssl.session-cache-size", 4096)
+      : 0;
+    const uint32_t nsess = n > 0
+      ? ((uint32_t)n + MOD_OPENSSL_SHM_SESS_WAYS-1)
+        & ~(uint32_t)(MOD_OPENSSL_SHM_SESS_WAYS-1)
+      : 0;
+    const size_t sz =
+      sizeof(mod_openssl_shm) + nsess * sizeof(mod_openssl_shm_sess);
+
+    mod_openssl_shm *shm = mod_openssl_shm_inherit(sz);
+    if (NULL == shm) {
+        int fd = -1;
+      #ifdef MOD_OPENSSL_SHM_MEMFD_REUSE
+        fd = memfd_create(MOD_OPENSSL_SHM_MEMFD, MFD_CLOEXEC);
+        if (fd >= 0 && 0 != ftruncate(fd, (off_t)sz)) {
+            close(fd);
+            fd = -1;
+        }
+      #endif
+        shm = (fd >= 0)
+          ? mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)
+          : mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,-1,0);
+        if (shm == MAP_FAILED) {
+            log_perror(srv->errh, __FILE__, __LINE__,
+              "SSL: mmap() shared memory for session cache and ticket keys");
+            if (fd >= 0) close(fd);
+            return;
+        }
+        /*(memory is zero-initialized)*/
+        pthread_mutexattr_t attr;
+        int rc = pthread_mutexattr_init(&attr);
+        if (0 == rc) {
+            if (0 == (rc = pthread_mutexattr_setpshared(&attr,
+                                                PTHREAD_PROCESS_SHARED))
+                && 0 == (rc = pthread_mutexattr_setrobust(&attr,
+                                                PTHREAD_MUTEX_ROBUST)))
+                rc = pthread_mutex_init(&shm->lock, &attr);
+            pthread_mutexattr_destroy(&attr);
+        }
+        if (0 != rc) {
+            errno = rc;
+            log_perror(srv->errh, __FILE__, __LINE__,
+              "SSL: process-shared mutex for session cache and ticket keys");
+            munmap(shm, sz);
+            if (fd >= 0) close(fd);
+            return;
+        }
+        shm->magic = MOD_OPENSSL_SHM_MAGIC;
+        shm->nsess = nsess;
+        ssl_shm_fd = fd;
+    }
+    ssl_shm = shm;
+    ssl_shm_sz = sz;
+    ssl_shm_stek_gen = 0;
+}
+
+
+__attribute_cold__
+static void
+mod_openssl_shm_free (void)
+{
+    /*(memfd (if used) is kept open for reuse upon graceful restart)*/
+    if (NULL == ssl_shm) return;
+    munmap(ssl_shm, ssl_shm_sz);
+    ssl_shm = NULL;
+    ssl_shm_sz = 0;
+    ssl_shm_stek_gen = 0;
+}
+
+
+#ifdef TLSEXT_TYPE_session_ticket
+
+static void
+mod_openssl_shm_stek_load (void)
+{
+    /*(caller must hold lock)*/
+    memcpy(session_ticket_keys, ssl_shm->stek, sizeof(ssl_shm->stek));
+    stek_rotate_ts = ssl_shm->stek_rotate_ts;
+    ssl_shm_stek_gen = ssl_shm->stek_gen;
+}
+
+
+static void
+mod_openssl_shm_stek_save (void)
+{
+    /*(caller must hold lock)*/
+    memcpy(ssl_shm->stek, session_ticket_keys, sizeof(ssl_shm->stek));
+    ssl_shm->stek_rotate_ts = stek_rotate_ts;
+    __atomic_store_n(&ssl_shm->stek_gen, ++ssl_shm_stek_gen, __ATOMIC_RELEASE);
+}
+
+
+static void
+mod_openssl_shm_stek_sync (void)
+{
+    if (ssl_shm
+        && __atomic_load_n(&ssl_shm->stek_gen, __ATOMIC_ACQUIRE)
+           != ssl_shm_stek_gen) {
+        mod_openssl_shm_lock();
+        mod_openssl_shm_stek_load();
+        mod_openssl_shm_unlock();
+    }
+}
+
+#endif /* TLSEXT_TYPE_session_ticket */
+
+
+#ifdef MOD_OPENSSL_SHM_SESS
+
+static mod_openssl_shm_sess *
+mod_openssl_shm_sess_set (const unsigned char * const id, const uint32_t idlen, uint32_t * const hash)
+{
+    /* session ids are random; use leading bytes as hash */
+    uint32_t h = 0;
+    memcpy(&h, id, idlen < sizeof(h) ? idlen : sizeof(h));
+    *hash = h | 1; /*(non-zero)*/
+    const uint32_t nsets = ssl_shm->nsess / MOD_OPENSSL_SHM_SESS_WAYS;
+    return ssl_shm->sess + (h % nsets) * MOD_OPENSSL_SHM_SESS_WAYS;
+}
+
+
+static int
+mod_openssl_shm_sess_new (SSL *ssl, SSL_SESSION *sess)
+{
+    UNUSED(ssl);
+    unsigned int idlen;
+    const unsigned char * const id = SSL_SESSION_get_id(sess, &idlen);
+    mod_openssl_shm_sess x;
+    const int len = i2d_SSL_SESSION(sess, NULL);
+    if (0 == idlen || idlen > sizeof(x.id)
+        || len <= 0 || (size_t)len > sizeof(x.der))
+        return 0; /* not cached */
+    unsigned char *der = x.der;
+    i2d_SSL_SESSION(sess, &der);
+
+    uint32_t hash;
+    mod_openssl_shm_sess * const set =
+      mod_openssl_shm_sess_set(id, idlen, &hash);
+    const unix_time64_t expire_ts = (unix_time64_t)SSL_SESSION_get_time(sess)
+                                  + (unix_time64_t)SSL_SESSION_get_timeout(sess);
+
+    mod_openssl_shm_lock();
+    /* replace entry with same id, else unused or oldest entry in set */
+    mod_openssl_shm_sess *e = set;
+    for (int i = 0; i < MOD_OPENSSL_SHM_SESS_WAYS; ++i) {
+        mod_openssl_shm_sess * const c = set+i;
+        if (c->hash == hash && c->id_len == idlen
+            && 0 == memcmp(c->id, id, idlen)) {
+            e = c;
+            break;
+        }
+        if (c->expire_ts < e->expire_ts)
+            e = c;
+    }
+    e->hash = hash;
+    e->id_len = (uint16_t)idlen;
+    e->der_len = (uint16_t)len;
+    e->expire_ts = expire_ts;
+    memcpy(e->id, id, idlen);
+    memcpy(e->der, x.der, (size_t)len);
+    mod_openssl_shm_unlock();
+
+    OPENSSL_cleanse(x.der, (size_t)len);
+    plugin_stats_inc("openssl.session-cache-store");
+    return 0; /* reference to sess not kept */
+}
+
+
+static SSL_SESSION *
+mod_openssl_shm_sess_get (SSL *ssl, const unsigned char *id, int idlen, int *copy)
+{
+    UNUSED(ssl);
+    *copy = 0;
+    mod_openssl_shm_sess x;
+    if (idlen <= 0 || (size_t)idlen > sizeof(x.id)) return NULL;
+
+    uint32_t hash;
+    mod_openssl_shm_sess * const set =
+      mod_openssl_shm_sess_set(id, (uint32_t)idlen, &hash);
+    const unix_time64_t cur_ts = log_epoch_secs;
+    uint32_t len = 0;
+
+    mod_openssl_shm_lock();
+    for (int i = 0; i < MOD_OPENSSL_SHM_SESS_WAYS; ++i) {
+        const mod_openssl_shm_sess * const c = set+i;
+        if (c->hash == hash && c->id_len == (uint32_t)idlen
+            && 0 == memcmp(c->id, id, (size_t)idlen)) {
+            if (c->expire_ts >= cur_ts) {
+                len = c->der_len;
+                memcpy(x.der, c->der, len);
+            }
+            break;
+        }
+    }
+    mod_openssl_shm_unlock();
+
+    if (0 == len) {
+        plugin_stats_inc("openssl.session-cache-miss");
+        return NULL;
+    }
+    const unsigned char *der = x.der;
+    SSL_SESSION * const sess = d2i_SSL_SESSION(NULL, &der, (long)len);
+    OPENSSL_cleanse(x.der, len);
+    if (sess) plugin_stats_inc("openssl.session-cache-hit");
+    return sess;
+}
+
+
+static void
+mod_openssl_shm_sess_remove (SSL_CTX *ctx, SSL_SESSION *sess)
+{
+    UNUSED(ctx);
+    unsigned int idlen;
+    const unsigned char * const id = SSL_SESSION_get_id(sess, &idlen);
+    if (0 == idlen || idlen > sizeof(((mod_openssl_shm_sess *)0)->id))
+        return;
+
+    uint32_t hash;
+    mod_openssl_shm_sess * const set =
+      mod_openssl_shm_sess_set(id, idlen, &hash);
+
+    mod_openssl_shm_lock();
+    for (int i = 0; i < MOD_OPENSSL_SHM_SESS_WAYS; ++i) {
+        mod_openssl_shm_sess * const c = set+i;
+        if (c->hash == hash && c->id_len == idlen
+            && 0 == memcmp(c->id, id, idlen)) {
+            OPENSSL_cleanse(c, sizeof(*c));
+            break;
+        }
+    }
+    mod_openssl_shm_unlock();
+}
+
+#endif /* MOD_OPENSSL_SHM_SESS */
+
+#endif /* MOD_OPENSSL_SHM */
+
+
+#ifdef TLSEXT_TYPE_session_ticket
 
 
 static int
@@ -442,6 +847,12 @@ mod_openssl_session_ticket_key_file (const char *fn)
 static void
 mod_openssl_session_ticket_key_check (const plugin_data *p, const unix_time64_t cur_ts)
 {
+  #ifdef MOD_OPENSSL_SHM
+    /* coordinate STEK rotation between workers
+     * (lock is not held during stat(), file read, or key generation below) */
+    mod_openssl_shm_stek_sync();
+  #endif
+
     static unix_time64_t detect_retrograde_ts;
     if (detect_retrograde_ts > cur_ts && detect_retrograde_ts - cur_ts > 28800)
         stek_rotate_ts = 0;
@@ -458,10 +869,28 @@ mod_openssl_session_ticket_key_check (const plugin_data *p, const unix_time64_t
     else if (cur_ts - 28800 >= stek_rotate_ts || 0 == stek_rotate_ts)/*(8 hrs)*/
         rotate = mod_openssl_session_ticket_key_generate(cur_ts, cur_ts+86400);
 
-    if (rotate) {
-        mod_openssl_session_ticket_key_rotate();
-        stek_rotate_ts = cur_ts;
+    if (!rotate) return;
+
+  #ifdef MOD_OPENSSL_SHM
+    if (ssl_shm) {
+        mod_openssl_shm_lock();
+        if (ssl_shm->stek_gen != ssl_shm_stek_gen) {
+            /* another worker rotated STEK meanwhile; use those keys */
+            OPENSSL_cleanse(session_ticket_keys+3, sizeof(tlsext_ticket_key_t));
+            mod_openssl_shm_stek_load();
+        }
+        else {
+            mod_openssl_session_ticket_key_rotate();
+            stek_rotate_ts = cur_ts;
+            mod_openssl_shm_stek_save();
+        }
+        mod_openssl_shm_unlock();
+        return;
     }
+  #endif
+
+    mod_openssl_session_ticket_key_rotate();
+    stek_rotate_ts = cur_ts;
 }
 
 #endif /* TLSEXT_TYPE_session_ticket */
@@ -531,6 +960,10 @@ static int mod_openssl_init_once_openssl (server *srv)
   #endif
     ssl_is_init = 1;
 
+  #ifdef MOD_OPENSSL_SHM
+    mod_openssl_shm_init(srv);
+  #endif
+
     if (0 == RAND_status()) {
         log_error(srv->errh, __FILE__, __LINE__,
           "SSL: not enough entropy in the pool");
@@ -550,6 +983,9 @@ static void mod_openssl_free_openssl (void)
     OPENSSL_cleanse(session_ticket_keys, sizeof(session_ticket_keys));
     stek_rotate_ts = 0;
   #endif
+  #ifdef MOD_OPENSSL_SHM
+    mod_openssl_shm_free();
+  #endif
 
   #if OPENSSL_VERSION_NUMBER >= 0x10100000L \
    && !defined(LIBRESSL_VERSION_NUMBER)
@@ -2448,6 +2884,17 @@ network_init_ssl (server *srv, plugin_config_socket *s, plugin_data *p)
                                              SSL_SESS_CACHE_OFF
                                            | SSL_SESS_CACHE_NO_AUTO_CLEAR
                                            | SSL_SESS_CACHE_NO_INTERNAL);
+      #ifdef MOD_OPENSSL_SHM_SESS
+        else if (ssl_shm && ssl_shm->nsess) {
+            /* session cache in memory shared between workers */
+            SSL_CTX_set_session_cache_mode(s->ssl_ctx,
+                                             SSL_SESS_CACHE_SERVER
+                                           | SSL_SESS_CACHE_NO_INTERNAL);
+            SSL_CTX_sess_set_new_cb(s->ssl_ctx, mod_openssl_shm_sess_new);
+            SSL_CTX_sess_set_get_cb(s->ssl_ctx, mod_openssl_shm_sess_get);
+            SSL_CTX_sess_set_remove_cb(s->ssl_ctx,mod_openssl_shm_sess_remove);
+        }
+      #endif
 
         SSL_CTX_set_options(s->ssl_ctx, ssloptions);
         SSL_CTX_set_info_callback(s->ssl_ctx, ssl_info_callback);
@@ -3278,6 +3725,7 @@ connection_write_cq_ssl (connection * const con, chunkqueue * const cq, off_t ma
             return mod_openssl_write_err(ssl, wr, con, errh);
 
         chunkqueue_mark_written(cq, wr);
+        tls_write_bytes += (uint64_t)wr;
 
         /* yield if wrote less than read or read less than requested
          * (if starting cqlen was less than requested read amount, then
@@ -3303,13 +3751,32 @@ connection_write_cq_ssl_ktls (connection * const con, chunkqueue * const cq, off
     if (__builtin_expect( (0 != hctx->close_notify), 0))
         return mod_openssl_close_notify(hctx);
 
-    /* not done: scan cq for FILE_CHUNK within first max_bytes rather than
-     * only using SSL_sendfile() if the first chunk is FILE_CHUNK.
-     * Checking first chunk for FILE_CHUNK means that initial response headers
-     * and beginning of file will be read into memory before subsequent writes
-     * use SSL_sendfile().  TBD: possible to be further optimized? */
+    /* Write MEM_CHUNKs preceding a FILE_CHUNK (e.g. response headers) with
+     * SSL_write(), limited to the length of those MEM_CHUNKs, so that the
+     * beginning of the file is not read into memory, and then send file with
+     * SSL_sendfile() (sendfile() on kTLS socket; encrypted by kernel) */
+
+    for (chunk *c; (c = cq->first); ) {
+        if (c->type == MEM_CHUNK) {
+            off_t mlen = 0;
+            do {
+                mlen += (off_t)buffer_clen(c->mem) - c->offset;
+            } while ((c = c->next) && c->type == MEM_CHUNK && mlen < max_bytes);
+            if (NULL == c || c->type != FILE_CHUNK || mlen >= max_bytes)
+                break; /* no FILE_CHUNK follows within max_bytes */
+            if (0 == mlen) { /*(empty MEM_CHUNKs; not expected)*/
+                chunkqueue_remove_finished_chunks(cq);
+                continue;
+            }
+            const off_t bytes_out = cq->bytes_out;
+            int rc = connection_write_cq_ssl(con, cq, mlen);
+            if (0 != rc) return rc;
+            max_bytes -= cq->bytes_out - bytes_out;
+            if (cq->bytes_out - bytes_out < mlen)
+                return 0; /* try again later */
+            continue;
+        }
 
-    for (chunk *c; (c = cq->first) && c->type == FILE_CHUNK; ) {
         off_t len = c->file.length - c->offset;
         if (len > max_bytes) len = max_bytes;
         if (0 == len) break; /*(FILE_CHUNK or max_bytes should not be 0)*/
@@ -3341,6 +3808,7 @@ connection_write_cq_ssl_ktls (connection * const con, chunkqueue * const cq, off
 
         chunkqueue_mark_written(cq, wr);
         max_bytes -= wr;
+        ktls_sendfile_bytes += (uint64_t)wr;
 
         if (wr < len) return 0; /* try again later */
     }
@@ -3381,11 +3849,18 @@ connection_read_cq_ssl (connection * const con, chunkqueue * const cq, off_t max
         }
 
       #if OPENSSL_VERSION_NUMBER >= 0x30000000L
-        /* ideally should be done only once, after handshake completes,
-         * so check each time for HTTP/2 so that we do not re-enable */
-        if (hctx->r->http_version < HTTP_VERSION_2
-            && BIO_get_ktls_send(SSL_get_wbio(hctx->ssl)) > 0)
-            con->network_write = connection_write_cq_ssl_ktls;
+        /* check once, after handshake completes, if kTLS offload enabled
+         * (before ALPN h2 check below, which resets to default for h2) */
+        if (!hctx->ktls_checked && SSL_is_init_finished(hctx->ssl)) {
+            hctx->ktls_checked = 1;
+            if (BIO_get_ktls_send(SSL_get_wbio(hctx->ssl)) > 0) {
+                plugin_stats_inc("openssl.ktls-tx-conns");
+                if (hctx->r->http_version < HTTP_VERSION_2)
+                    con->network_write = connection_write_cq_ssl_ktls;
+            }
+            if (BIO_get_ktls_recv(SSL_get_rbio(hctx->ssl)) > 0)
+                plugin_stats_inc("openssl.ktls-rx-conns");
+        }
       #endif
       #ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
         if (hctx->alpn) {
@@ -3902,6 +4377,20 @@ REQUEST_FUNC(mod_openssl_handle_request_reset)
 TRIGGER_FUNC(mod_openssl_handle_trigger) {
     const plugin_data * const p = p_d;
     const unix_time64_t cur_ts = log_epoch_secs;
+
+  #if defined(MOD_OPENSSL_SHM) && defined(TLSEXT_TYPE_session_ticket)
+    /* load STEK if rotated by another worker */
+    mod_openssl_shm_stek_sync();
+  #endif
+
+    /* (kbytes; int counters) */
+    plugin_stats_set("openssl.write-kbytes",
+                     sizeof("openssl.write-kbytes")-1,
+                     (int)(tls_write_bytes >> 10));
+    plugin_stats_set("openssl.ktls-sendfile-kbytes",
+                     sizeof("openssl.ktls-sendfile-kbytes")-1,
+                     (int)(ktls_sendfile_bytes >> 10));
+
     if (cur_ts & 0x3f) return HANDLER_GO_ON; /*(continue once each 64 sec)*/
     UNUSED(srv);
     UNUSED(p);
@@ -3918,6 +4407,18 @@ TRIGGER_FUNC(mod_openssl_handle_trigger) {
 }
 
 
+#ifdef MOD_OPENSSL_SHM
+SERVER_FUNC(mod_openssl_worker_init)
+{
+    /* count memfd kept open for shared memory
+     * (opened in set_defaults, before srv->cur_fds is (re)initialized) */
+    if (-1 != ssl_shm_fd) ++srv->cur_fds;
+    UNUSED(p_d);
+    return HANDLER_GO_ON;
+}
+#endif
+
+
 __attribute_cold__
 __declspec_dllexport__
 int mod_openssl_plugin_init (plugin *p);
@@ -3936,6 +4437,9 @@ int mod_openssl_plugin_init (plugin *p)
     p->handle_request_env        = mod_openssl_handle_request_env;
     p->handle_request_reset      = mod_openssl_handle_request_reset;
     p->handle_trigger            = mod_openssl_handle_trigger;
+  #ifdef MOD_OPENSSL_SHM
+    p->worker_init               = mod_openssl_worker_init;
+  #endif
 
     return 0;
 }
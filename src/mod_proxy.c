@@ -18,7 +18,9 @@
  * HTTP reverse proxy
  *
  * TODO:      - HTTP/1.1
- *            - HTTP/1.1 persistent connection with upstream servers
+ *
+ * HTTP/1.1 persistent connections with upstream servers are reused if
+ * enabled for backend host ("keep-alive-max-idle" in proxy.server host)
  */
 
 /* (future: might split struct and move part to http-header-glue.c) */
@@ -875,7 +877,8 @@ static handler_t proxy_create_env(gw_handler_ctx *gwhctx) {
 			http_header_remap_host(b, buffer_clen(b) - alen, &hctx->conf.header, 1, alen);
 		}
 	} else {
-		/* no Host header available; must send HTTP/1.0 request */
+		/* no Host header available; must send HTTP/1.0 request
+		 * (backend_keep_alive already disabled in check_extension) */
 		b->ptr[b->used-2] = '0'; /*(overwrite end of request line)*/
 	}
 
@@ -989,16 +992,23 @@ static handler_t proxy_create_env(gw_handler_ctx *gwhctx) {
 		http_header_remap_uri(b, buffer_clen(b) - vlen, &hctx->conf.header, 1);
 	}
 
+	/* mod_proxy sends Connection: close to backend unless the connection
+	 * to backend might be reused (backend_keep_alive decided in
+	 * mod_proxy_check_extension(), before any idle connection reused) */
+
 	if (connhdr && !hctx->conf.header.force_http10 && r->http_version >= HTTP_VERSION_1_1
 	    && !buffer_eq_icase_slen(connhdr, CONST_STR_LEN("close"))) {
-		/* mod_proxy always sends Connection: close to backend */
-		buffer_append_string_len(b, CONST_STR_LEN("\r\nConnection: close"));
 		/* (future: might be pedantic and also check Connection header for each
 		 * token using http_header_str_contains_token() */
-		if (te)
-			buffer_append_string_len(b, CONST_STR_LEN(", te"));
-		if (upgrade)
-			buffer_append_string_len(b, CONST_STR_LEN(", upgrade"));
+		if (!hctx->gw.opts.backend_keep_alive) {
+			buffer_append_string_len(b, CONST_STR_LEN("\r\nConnection: close"));
+			if (te)
+				buffer_append_string_len(b, CONST_STR_LEN(", te"));
+			if (upgrade)
+				buffer_append_string_len(b, CONST_STR_LEN(", upgrade"));
+		}
+		else if (te)
+			buffer_append_string_len(b, CONST_STR_LEN("\r\nConnection: te"));
 		buffer_append_string_len(b, CONST_STR_LEN("\r\n\r\n"));
 	}
 	else if (r->h2_connect_ext) {
@@ -1019,7 +1029,9 @@ static handler_t proxy_create_env(gw_handler_ctx *gwhctx) {
 		                              "\r\nUpgrade: websocket"
 		                              "\r\nConnection: close, upgrade\r\n\r\n"));
 	}
-	else    /* mod_proxy always sends Connection: close to backend */
+	else if (hctx->gw.opts.backend_keep_alive)
+		buffer_append_string_len(b, CONST_STR_LEN("\r\n\r\n"));
+	else
 		buffer_append_string_len(b, CONST_STR_LEN("\r\nConnection: close\r\n\r\n"));
 
 	hctx->gw.wb_reqlen = buffer_clen(b);
@@ -1063,6 +1075,13 @@ static handler_t proxy_response_headers(request_st * const r, struct http_respon
     if (opts->upgrade == 2)
         gw_set_transparent(&hctx->gw);
 
+    /* response to HEAD, and 204 and 304 responses, do not have a body,
+     * even if Content-Length is present (needed to reuse connection) */
+    if (opts->backend_keep_alive
+        && (r->http_method == HTTP_METHOD_HEAD
+            || r->http_status == 204 || r->http_status == 304))
+        r->resp_body_scratchpad = 0;
+
     /* rewrite paths, if needed */
 
     if (NULL == remap_hdrs->urlpaths && NULL == remap_hdrs->hosts_response)
@@ -1105,11 +1124,28 @@ static handler_t mod_proxy_check_extension(request_st * const r, void *p_d) {
 		hctx->gw.create_env = proxy_create_env;
 		hctx->gw.response = chunk_buffer_acquire();
 		hctx->gw.opts.backend = BACKEND_PROXY;
+		hctx->gw.opts.splice_relay = 1;
 		hctx->gw.opts.pdata = hctx;
 		hctx->gw.opts.headers = proxy_response_headers;
 
 		hctx->conf = p->conf; /*(copies struct)*/
 		hctx->conf.header.http_host = r->http_host;
+		/* decide backend keep-alive before gw_write_request() might check
+		 * out an idle connection to backend; must match conditions under
+		 * which proxy_create_env() sends Connection: close (or HTTP/1.0) */
+		/*(Upgrade already unset in gw_check_extension if not allowed)*/
+		const buffer * const upgrade =
+		  http_header_request_get(r, HTTP_HEADER_UPGRADE,
+		                          CONST_STR_LEN("Upgrade"));
+		hctx->gw.opts.backend_keep_alive =
+		  !hctx->conf.header.force_http10
+		  && r->http_method != HTTP_METHOD_CONNECT
+		  && !r->h2_connect_ext
+		  && hctx->gw.host->keep_alive_max_idle
+		  && (NULL == upgrade || buffer_is_blank(upgrade))
+		  && ((hctx->conf.replace_http_host
+		       && !buffer_is_blank(hctx->gw.host->id))
+		      || (r->http_host && !buffer_is_unset(r->http_host)));
 		/* mod_proxy currently sends all backend requests as http.
 		 * https-remap is a flag since it might not be needed if backend
 		 * honors Forwarded or X-Forwarded-Proto headers, e.g. by using
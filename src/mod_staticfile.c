@@ -1,7 +1,9 @@
 #include "first.h"
 
+#include "base.h"
 #include "log.h"
 #include "buffer.h"
+#include "http_header.h"
 
 #include "plugin.h"
 
@@ -11,6 +13,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "sys-stat.h"
 
 /**
  * this is a staticfile for a lighttpd plugin
@@ -20,6 +23,7 @@
 
 typedef struct {
 	const array *exclude_ext;
+	const array *precompressed;
 	unsigned short etags_used;
 	unsigned short disable_pathinfo;
 } plugin_config;
@@ -45,6 +49,9 @@ static void mod_staticfile_merge_config_cpv(plugin_config * const pconf, const c
       case 2: /* static-file.disable-pathinfo */
         pconf->disable_pathinfo = cpv->v.u;
         break;
+      case 3: /* static-file.precompressed */
+        pconf->precompressed = cpv->v.a;
+        break;
       default:/* should not happen */
         return;
     }
@@ -66,6 +73,16 @@ static void mod_staticfile_patch_config(request_st * const r, plugin_data * cons
     }
 }
 
+static const char *
+mod_staticfile_precompressed_ext (const buffer * const enc)
+{
+    /* map Content-Encoding to file extension of precompressed sidecar file */
+    if (buffer_eq_slen(enc, CONST_STR_LEN("br")))   return ".br";
+    if (buffer_eq_slen(enc, CONST_STR_LEN("zstd"))) return ".zst";
+    if (buffer_eq_slen(enc, CONST_STR_LEN("gzip"))) return ".gz";
+    return NULL;
+}
+
 SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
     static const config_plugin_keys_t cpk[] = {
       { CONST_STR_LEN("static-file.exclude-extensions"),
@@ -77,6 +94,9 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
      ,{ CONST_STR_LEN("static-file.disable-pathinfo"),
         T_CONFIG_BOOL,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("static-file.precompressed"),
+        T_CONFIG_ARRAY_VLIST,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -86,6 +106,32 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_staticfile"))
         return HANDLER_ERROR;
 
+    /* process and validate config directives
+     * (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
+        config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            switch (cpv->k_id) {
+              case 3: /* static-file.precompressed */
+                for (uint32_t j = 0; j < cpv->v.a->used; ++j) {
+                    const buffer * const v =
+                      &((data_string *)cpv->v.a->data[j])->value;
+                    if (NULL == mod_staticfile_precompressed_ext(v)) {
+                        log_error(srv->errh, __FILE__, __LINE__,
+                          "unsupported encoding for %s: %s "
+                          "(expecting \"br\", \"zstd\", or \"gzip\")",
+                          cpk[cpv->k_id].k, v->ptr);
+                        return HANDLER_ERROR;
+                    }
+                }
+                if (0 == cpv->v.a->used) cpv->v.a = NULL;
+                break;
+              default:
+                break;
+            }
+        }
+    }
+
     /* initialize p->defaults from global config context */
     p->defaults.etags_used = 1; /* etags enabled */
     if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
@@ -107,6 +153,110 @@ mod_staticfile_not_handled(request_st * const r, const char * const msg)
     return HANDLER_GO_ON;
 }
 
+static int
+mod_staticfile_accept_encoding (const buffer * const ae, const buffer * const enc)
+{
+    /* check if encoding is listed in Accept-Encoding, and not with q=0 */
+    const uint32_t elen = buffer_clen(enc);
+    for (const char *s = ae->ptr; *s; ) {
+        while (*s == ' ' || *s == '\t' || *s == ',') ++s;
+        const char * const v = s;
+        while (*s!=' ' && *s!='\t' && *s!=',' && *s!=';' && *s!='\0') ++s;
+        const int match = ((uint32_t)(s - v) == elen
+                           && buffer_eq_icase_ssn(v, enc->ptr, elen));
+        int q0 = 0;
+        if (*s == ';' || *s == ' ' || *s == '\t') {
+            const char *q = s;
+            while (*s != ',' && *s != '\0') ++s;
+            for (; q < s; ++q) {
+                if ((*q == 'q' || *q == 'Q') && q[1] == '=') {
+                    q += 2;
+                    if (*q == '0') {
+                        do { ++q; } while (*q == '.' || *q == '0');
+                        q0 = (q == s || *q == ' ' || *q == '\t' || *q == ';');
+                    }
+                    break;
+                }
+            }
+        }
+        if (match) return !q0;
+    }
+    return 0;
+}
+
+static int
+mod_staticfile_precompressed (request_st * const r, const array * const a)
+{
+    const buffer * const ae =
+      http_header_request_get(r, HTTP_HEADER_ACCEPT_ENCODING,
+                              CONST_STR_LEN("Accept-Encoding"));
+    if (NULL == ae) return 0;
+
+    /* original file must exist; precompressed file must not be older */
+    stat_cache_entry *sce = r->tmp_sce;
+    if (NULL == sce) {
+        sce = stat_cache_get_entry(&r->physical.path);
+        if (NULL == sce || !S_ISREG(sce->st.st_mode)) return 0;
+    }
+    const unix_time64_t mtime = TIME64_CAST(sce->st.st_mtime);
+    const buffer * const content_type = stat_cache_content_type_get(sce, r);
+    if (NULL == content_type || buffer_is_blank(content_type)) return 0;
+
+    buffer * const tb = r->tmp_buf;
+    for (uint32_t i = 0; i < a->used; ++i) {
+        const buffer * const enc = &((data_string *)a->data[i])->value;
+        if (!mod_staticfile_accept_encoding(ae, enc)) continue;
+        buffer_copy_buffer(tb, &r->physical.path);
+        buffer_append_string(tb, mod_staticfile_precompressed_ext(enc));
+        sce = stat_cache_get_entry_open(tb, r->conf.follow_symlink);
+        if (NULL == sce || !S_ISREG(sce->st.st_mode)
+            || (sce->fd < 0 && 0 != sce->st.st_size)
+            || TIME64_CAST(sce->st.st_mtime) < mtime)
+            continue;
+
+        /* Content-Type of original file, not of precompressed file */
+        http_header_response_set(r, HTTP_HEADER_CONTENT_TYPE,
+                                 CONST_STR_LEN("Content-Type"),
+                                 BUF_PTR_LEN(content_type));
+        http_header_response_set(r, HTTP_HEADER_CONTENT_ENCODING,
+                                 CONST_STR_LEN("Content-Encoding"),
+                                 BUF_PTR_LEN(enc));
+        buffer * const vb =
+          http_header_response_get(r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+        if (NULL == vb)
+            http_header_response_set(r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"),
+                                     CONST_STR_LEN("Accept-Encoding"));
+        else if (!http_header_str_contains_token(BUF_PTR_LEN(vb),
+                                                 CONST_STR_LEN("Accept-Encoding")))
+            buffer_append_string_len(vb, CONST_STR_LEN(",Accept-Encoding"));
+
+        /* ETag of precompressed file, with encoding appended (as mod_deflate)
+         * (distinct from ETag of original file, and from ETag of response
+         *  compressed on-the-fly by mod_deflate if precompressed file later
+         *  removed, since precompressed file has different inode/mtime) */
+        if (0 != r->conf.etag_flags
+            && !light_btst(r->resp_htags, HTTP_HEADER_ETAG)) {
+            const buffer * const etag =
+              stat_cache_etag_get(sce, r->conf.etag_flags);
+            const uint32_t etaglen = etag ? buffer_clen(etag) : 0;
+            if (etaglen > 2) {
+                buffer * const eb =
+                  http_header_response_set_ptr(r, HTTP_HEADER_ETAG,
+                                               CONST_STR_LEN("ETag"));
+                buffer_append_str3(eb, etag->ptr, etaglen-1,
+                                       CONST_STR_LEN("-"),
+                                       BUF_PTR_LEN(enc));
+                buffer_append_char(eb, '"');
+            }
+        }
+
+        http_response_send_file(r, &sce->name, sce);
+        return 1;
+    }
+
+    return 0;
+}
+
 static handler_t
 mod_staticfile_process (request_st * const r, plugin_config * const pconf)
 {
@@ -127,6 +277,12 @@ mod_staticfile_process (request_st * const r, plugin_config * const pconf)
     if (r->tmp_sce && !buffer_is_equal(&r->tmp_sce->name, &r->physical.path))
         r->tmp_sce = NULL;
 
+    if (pconf->precompressed
+        && light_btst(r->rqst_htags, HTTP_HEADER_ACCEPT_ENCODING)
+        && !light_btst(r->resp_htags, HTTP_HEADER_CONTENT_ENCODING)
+        && mod_staticfile_precompressed(r, pconf->precompressed))
+        return HANDLER_FINISHED;
+
     http_response_send_file(r, &r->physical.path, r->tmp_sce);
 
     return HANDLER_FINISHED;
@@ -5,11 +5,16 @@
 #include "http_chunk.h"
 #include "http_header.h"
 #include "log.h"
+#include "stat_cache.h"
 
 #include "plugin.h"
 
 #include <sys/types.h>
 #include "sys-time.h"
+#if defined(HAVE_FORK) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#define MOD_STATUS_SHARED
+#endif
 
 #include <fcntl.h>
 #include <stdlib.h>
@@ -24,6 +29,29 @@ typedef struct {
     int sort;
 } plugin_config;
 
+#ifdef MOD_STATUS_SHARED
+/* counters shared across server.max-worker processes
+ * (anonymous shared mmap created before fork() of workers)
+ * (5s sliding window slots may be approximate due to unlocked slot reuse) */
+typedef struct {
+	off_t abs_traffic_out;
+	off_t abs_requests;
+	struct {
+		unix_time64_t ts;
+		off_t traffic_out;
+		off_t requests;
+	} s5[5];
+	/* chunk pool statistics published by each worker once per second
+	 * (slot claimed by worker pid; slot not updated recently is reused) */
+	uint32_t npools;
+	struct {
+		pid_t pid;
+		unix_time64_t ts;
+		chunk_pool_stats cps;
+	} pools[];
+} mod_status_shared;
+#endif
+
 typedef struct {
 	PLUGIN_DATA;
 	plugin_config defaults;
@@ -37,12 +65,26 @@ typedef struct {
 	off_t traffic_out_5s[5];
 	off_t requests_5s[5];
 	int ndx_5s;
+  #ifdef MOD_STATUS_SHARED
+	mod_status_shared *shared;
+	size_t shared_sz;
+  #endif
 } plugin_data;
 
 INIT_FUNC(mod_status_init) {
     return ck_calloc(1, sizeof(plugin_data));
 }
 
+FREE_FUNC(mod_status_free) {
+  #ifdef MOD_STATUS_SHARED
+    plugin_data * const p = p_d;
+    if (p->shared)
+        munmap(p->shared, p->shared_sz);
+  #else
+    UNUSED(p_d);
+  #endif
+}
+
 static void mod_status_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
     switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
       case 0: /* status.status-url */
@@ -129,6 +171,26 @@ SETDEFAULTS_FUNC(mod_status_set_defaults) {
             mod_status_merge_config(&p->defaults, cpv);
     }
 
+  #ifdef MOD_STATUS_SHARED
+    /* aggregate counters across workers if server.max-worker is configured
+     * (set_defaults is run before workers are forked) */
+    if (srv->srvconf.max_worker && NULL == p->shared) {
+        const uint32_t npools = srv->srvconf.max_worker;
+        const size_t sz = sizeof(*p->shared)
+                        + npools * sizeof(p->shared->pools[0]);
+        void * const ptr = mmap(NULL, sz, PROT_READ|PROT_WRITE,
+                                MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED != ptr) {
+            p->shared = ptr; /*(zero-initialized)*/
+            p->shared_sz = sz;
+            p->shared->npools = npools;
+        }
+        else
+            log_perror(srv->errh, __FILE__, __LINE__,
+              "mmap() shared counters; statistics will be per-worker");
+    }
+  #endif
+
     return HANDLER_GO_ON;
 }
 
@@ -652,11 +714,92 @@ static handler_t mod_status_handle_server_status_json(server *srv, request_st *
 }
 
 
-static handler_t mod_status_handle_server_statistics(request_st * const r) {
+#ifdef MOD_STATUS_SHARED
+static void mod_status_shared_pool_publish(mod_status_shared * const sh, const pid_t pid) {
+    /* publish chunk pool statistics of this worker
+     * (claim slot of this pid, else slot not updated in last few secs,
+     *  e.g. slot of worker which has exited) */
+    const unix_time64_t cur_ts = log_monotonic_secs;
+    uint32_t i;
+    for (i = 0; i < sh->npools; ++i) {
+        if (__atomic_load_n(&sh->pools[i].pid, __ATOMIC_ACQUIRE) == pid)
+            break;
+    }
+    for (uint32_t j = 0; i == sh->npools && j < sh->npools; ++j) {
+        pid_t opid = __atomic_load_n(&sh->pools[j].pid, __ATOMIC_ACQUIRE);
+        if (cur_ts - __atomic_load_n(&sh->pools[j].ts, __ATOMIC_ACQUIRE) > 2
+            && __atomic_compare_exchange_n(&sh->pools[j].pid, &opid, pid, 0,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            i = j;
+    }
+    if (i == sh->npools) return; /*(not expected)*/
+    chunkqueue_chunk_pool_stats(&sh->pools[i].cps);
+    __atomic_store_n(&sh->pools[i].ts, cur_ts, __ATOMIC_RELEASE);
+}
+
+static uint32_t mod_status_shared_pool_load(const mod_status_shared * const sh, const pid_t pid, chunk_pool_stats * const cps) {
+    /* add chunk pool statistics published by other workers
+     * (sums may be approximate; slots are read without lock) */
+    const unix_time64_t cur_ts = log_monotonic_secs;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < sh->npools; ++i) {
+        if (__atomic_load_n(&sh->pools[i].pid, __ATOMIC_ACQUIRE) == pid
+            || cur_ts - __atomic_load_n(&sh->pools[i].ts,__ATOMIC_ACQUIRE) > 2)
+            continue;
+        const chunk_pool_stats * const ps = &sh->pools[i].cps;
+        cps->chunks += ps->chunks;
+        cps->oversized += ps->oversized;
+        cps->filechunks += ps->filechunks;
+        cps->bytes += ps->bytes;
+        cps->hugepage_allocs += ps->hugepage_allocs;
+        cps->hugepage_numa_binds += ps->hugepage_numa_binds;
+        ++n;
+    }
+    return n;
+}
+#endif
+
+
+static handler_t mod_status_handle_server_statistics(request_st * const r, plugin_data * const p) {
 	http_header_response_set(r, HTTP_HEADER_CONTENT_TYPE,
 	                         CONST_STR_LEN("Content-Type"),
 	                         CONST_STR_LEN("text/plain"));
 
+	/* refresh chunk pool statistics (summed across workers, if shared) */
+	chunk_pool_stats cps;
+	chunkqueue_chunk_pool_stats(&cps);
+	uint32_t nworkers = 1;
+  #ifdef MOD_STATUS_SHARED
+	if (p->shared)
+		nworkers += mod_status_shared_pool_load(p->shared, r->con->srv->pid, &cps);
+  #else
+	UNUSED(p);
+  #endif
+	plugin_stats_set("chunkqueue.pool-workers",
+	                 sizeof("chunkqueue.pool-workers")-1, (int)nworkers);
+	plugin_stats_set("chunkqueue.pool-chunks",
+	                 sizeof("chunkqueue.pool-chunks")-1, (int)cps.chunks);
+	plugin_stats_set("chunkqueue.pool-oversized",
+	                 sizeof("chunkqueue.pool-oversized")-1, (int)cps.oversized);
+	plugin_stats_set("chunkqueue.pool-filechunks",
+	                 sizeof("chunkqueue.pool-filechunks")-1,(int)cps.filechunks);
+	plugin_stats_set("chunkqueue.pool-bytes",
+	                 sizeof("chunkqueue.pool-bytes")-1,
+	                 cps.bytes < INT32_MAX ? (int)cps.bytes : INT32_MAX);
+	uint32_t prewarm_entries, prewarm_fds;
+	stat_cache_prewarm_stats(&prewarm_entries, &prewarm_fds);
+	plugin_stats_set("stat-cache.prewarm-entries",
+	                 sizeof("stat-cache.prewarm-entries")-1,
+	                 (int)prewarm_entries);
+	plugin_stats_set("stat-cache.prewarm-fds",
+	                 sizeof("stat-cache.prewarm-fds")-1, (int)prewarm_fds);
+	plugin_stats_set("chunkqueue.hugepage-allocs",
+	                 sizeof("chunkqueue.hugepage-allocs")-1,
+	                 (int)cps.hugepage_allocs);
+	plugin_stats_set("chunkqueue.hugepage-numa-binds",
+	                 sizeof("chunkqueue.hugepage-numa-binds")-1,
+	                 (int)cps.hugepage_numa_binds);
+
 	const array * const st = &plugin_stats;
 	if (0 == st->used) {
 		/* we have nothing to send */
@@ -681,8 +824,53 @@ static handler_t mod_status_handle_server_statistics(request_st * const r) {
 }
 
 
+#ifdef MOD_STATUS_SHARED
+static void mod_status_shared_accum(mod_status_shared * const sh, const off_t traffic_out, const off_t requests) {
+    __atomic_fetch_add(&sh->abs_traffic_out, traffic_out, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sh->abs_requests, requests, __ATOMIC_RELAXED);
+
+    const unix_time64_t cur_ts = log_monotonic_secs;
+    __typeof__(sh->s5[0]) * const s5 = sh->s5 + (cur_ts % 5);
+    unix_time64_t ts = __atomic_load_n(&s5->ts, __ATOMIC_ACQUIRE);
+    if (ts != cur_ts
+        && __atomic_compare_exchange_n(&s5->ts, &ts, cur_ts, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* first worker in this second resets the slot */
+        __atomic_store_n(&s5->traffic_out, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s5->requests, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&s5->traffic_out, traffic_out, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s5->requests, requests, __ATOMIC_RELAXED);
+}
+
+static void mod_status_shared_load(plugin_data * const p) {
+    /* replace per-worker counters with counters aggregated across workers */
+    const mod_status_shared * const sh = p->shared;
+    p->abs_traffic_out = __atomic_load_n(&sh->abs_traffic_out,__ATOMIC_RELAXED);
+    p->abs_requests = __atomic_load_n(&sh->abs_requests, __ATOMIC_RELAXED);
+    const unix_time64_t cur_ts = log_monotonic_secs;
+    for (int i = 0; i < 5; ++i) {
+        const unix_time64_t ts = __atomic_load_n(&sh->s5[i].ts,__ATOMIC_ACQUIRE);
+        if (cur_ts - ts < 5) {
+            p->traffic_out_5s[i] =
+              __atomic_load_n(&sh->s5[i].traffic_out, __ATOMIC_RELAXED);
+            p->requests_5s[i] =
+              __atomic_load_n(&sh->s5[i].requests, __ATOMIC_RELAXED);
+        }
+        else {
+            p->traffic_out_5s[i] = 0;
+            p->requests_5s[i] = 0;
+        }
+    }
+}
+#endif
+
+
 static handler_t mod_status_handle_server_status(request_st * const r, plugin_data * const p) {
 	server * const srv = r->con->srv;
+  #ifdef MOD_STATUS_SHARED
+	if (p->shared) mod_status_shared_load(p);
+  #endif
 	if (buffer_is_equal_string(&r->uri.query, CONST_STR_LEN("auto"))) {
 		mod_status_handle_server_status_text(srv, r, p);
 	} else if (buffer_clen(&r->uri.query) >= sizeof("json")-1
@@ -807,7 +995,7 @@ static handler_t mod_status_handler(request_st * const r, void *p_d) {
 		return mod_status_handle_server_config(r);
 	} else if (p->conf.statistics_url &&
 	    buffer_is_equal(p->conf.statistics_url, &r->uri.path)) {
-		return mod_status_handle_server_statistics(r);
+		return mod_status_handle_server_statistics(r, p);
 	}
 
 	return HANDLER_GO_ON;
@@ -827,6 +1015,12 @@ TRIGGER_FUNC(mod_status_trigger) {
 
     p->abs_traffic_out += p->bytes_written_1s;
     p->abs_requests += p->requests_1s;
+  #ifdef MOD_STATUS_SHARED
+    if (p->shared) {
+        mod_status_shared_accum(p->shared, p->bytes_written_1s, p->requests_1s);
+        mod_status_shared_pool_publish(p->shared, srv->pid);
+    }
+  #endif
 
     p->bytes_written_1s = 0;
     p->requests_1s = 0;
@@ -855,6 +1049,7 @@ int mod_status_plugin_init(plugin *p) {
 
 	p->init        = mod_status_init;
 	p->set_defaults= mod_status_set_defaults;
+	p->cleanup     = mod_status_free;
 
 	p->handle_uri_clean    = mod_status_handler;
 	p->handle_trigger      = mod_status_trigger;
@@ -21,6 +21,10 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#include <linux/filter.h>
+#endif
+
 #ifdef _WIN32
 /* (Note: assume overwrite == 1 in this setenv() replacement) */
 /*#define setenv(name,value,overwrite)  SetEnvironmentVariable((name),(value))*/
@@ -376,6 +380,241 @@ static void network_srv_socket_init_token (server_socket * const srv_socket, con
         srv_socket->srv_token_colon = network_srv_token_colon(srv_token);
 }
 
+#ifdef SO_REUSEPORT
+
+/* server.feature-flags += ("server.reuseport-workers" => "enable")
+ *
+ * With server.max-worker, open one SO_REUSEPORT listen socket per worker
+ * (instead of all workers sharing (and contending to accept() from) one
+ * listen socket) and, on Linux, steer new connections to the listen socket
+ * of worker (receiving CPU % max-worker) with SO_ATTACH_REUSEPORT_CBPF.
+ * Worker k is pinned to the CPUs c for which (c % max-worker == k) (see
+ * server.c) so that connection processing stays on the CPU which received
+ * the connection.  If max-worker exceeds the number of online CPUs, some
+ * workers would never be selected by CPU, so connections are instead
+ * distributed by the kernel (hash) and the BPF program is not attached.
+ *
+ * The original listen socket is index 0 in the reuseport group and is used
+ * by worker 0; the additional sockets are bound in order for workers 1..n-1.
+ * The parent holds all listen sockets so that the group is not reordered
+ * when a worker exits and is restarted.  Upon graceful restart, sockets are
+ * added or closed (highest index first, so that the kernel does not reorder
+ * the group) to match the new max-worker, and the BPF program is replaced. */
+
+static int network_reuseport_enabled (const server * const srv) {
+    return srv->srvconf.max_worker > 1
+        && config_feature_bool(srv, "server.reuseport-workers", 0);
+}
+
+static int network_reuseport_socket (server * const srv, const server_socket * const srv_socket, const network_socket_config * const s, const socklen_t addr_len, const int set_v6only) {
+    const int family = sock_addr_get_family(&srv_socket->addr);
+    const int fd = fdevent_socket_nb_cloexec(family, SOCK_STREAM, IPPROTO_TCP);
+    if (-1 == fd) {
+        log_serror(srv->errh, __FILE__, __LINE__, "socket()");
+        return -1;
+    }
+  #ifdef _WIN32
+    ++srv->cur_fds;
+  #else
+    srv->cur_fds = fd;
+  #endif
+
+    int opt = 1;
+    if (fdevent_set_so_reuseaddr(fd, 1) < 0
+        || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0
+        || fdevent_set_tcp_nodelay(fd, 1) < 0) {
+        log_serror(srv->errh, __FILE__, __LINE__, "setsockopt()");
+        fdio_close_socket(fd);
+        return -1;
+    }
+  #ifdef HAVE_IPV6
+    if (set_v6only) {
+        opt = (set_v6only > 0);
+        if (-1 == setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt))){
+            log_serror(srv->errh, __FILE__, __LINE__,"setsockopt(IPV6_V6ONLY)");
+            fdio_close_socket(fd);
+            return -1;
+        }
+    }
+  #else
+    UNUSED(set_v6only);
+  #endif
+
+    if (0 != bind(fd, (struct sockaddr *)&srv_socket->addr, addr_len)) {
+        log_serror(srv->errh, __FILE__, __LINE__,
+          "bind() %s (SO_REUSEPORT)", srv_socket->srv_token->ptr);
+        fdio_close_socket(fd);
+        return -1;
+    }
+    if (-1 == listen(fd, s->listen_backlog)) {
+        log_serror(srv->errh, __FILE__, __LINE__, "listen()");
+        fdio_close_socket(fd);
+        return -1;
+    }
+  #ifdef TCP_DEFER_ACCEPT
+    if (!s->ssl_enabled && s->defer_accept) {
+        opt = s->defer_accept;
+        if (-1 == setsockopt(fd,IPPROTO_TCP,TCP_DEFER_ACCEPT,&opt,sizeof(opt)))
+            log_serror(srv->errh,__FILE__,__LINE__,"setsockopt(TCP_DEFER_ACCEPT)");
+    }
+  #endif
+    return fd;
+}
+
+int network_reuseport_cpu_steering (const server * const srv) {
+  #if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return srv->srvconf.max_worker > 1
+        && (ncpus <= 0 || srv->srvconf.max_worker <= ncpus);
+  #else
+    UNUSED(srv);
+    return 0;
+  #endif
+}
+
+static void network_reuseport_steering (server * const srv, server_socket * const srv_socket) {
+  #if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    /* select socket index in reuseport group: (receiving CPU % max-worker)
+     * (attached to one socket; applies to entire reuseport group)
+     * (replaces program attached by prior config, if any) */
+    if (!network_reuseport_cpu_steering(srv)) {
+      #ifdef SO_DETACH_REUSEPORT_BPF
+        int opt = 0;
+        setsockopt(srv_socket->fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF,
+                   &opt, sizeof(opt)); /*(ENOENT if none attached)*/
+      #endif
+        return;
+    }
+    struct sock_filter code[] = {
+      { BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+      { BPF_ALU | BPF_MOD | BPF_K, 0, 0, srv->srvconf.max_worker },
+      { BPF_RET | BPF_A,           0, 0, 0 }
+    };
+    struct sock_fprog prog = { sizeof(code)/sizeof(*code), code };
+    if (0 != setsockopt(srv_socket->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                        &prog, sizeof(prog)))
+        log_serror(srv->errh, __FILE__, __LINE__,
+          "setsockopt(SO_ATTACH_REUSEPORT_CBPF) %s",srv_socket->srv_token->ptr);
+  #else
+    UNUSED(srv);
+    UNUSED(srv_socket);
+  #endif
+}
+
+static int network_reuseport_init (server * const srv, server_socket * const srv_socket, const network_socket_config * const s, const socklen_t addr_len, const int set_v6only) {
+    const uint32_t n = srv->srvconf.max_worker - 1;
+    srv_socket->reuseport_fds = ck_malloc(n * sizeof(int));
+    for (uint32_t i = 0; i < n; ++i) {
+        int fd = network_reuseport_socket(srv, srv_socket, s, addr_len,
+                                          set_v6only);
+        if (-1 == fd) return -1;
+        srv_socket->reuseport_fds[srv_socket->reuseport_n++] = fd;
+    }
+
+    network_reuseport_steering(srv, srv_socket);
+    return 0;
+}
+
+__attribute_cold__
+static int network_reuseport_resize (server * const srv, server_socket * const srv_socket, const network_socket_config * const s) {
+    /* graceful restart: listen socket (and reuseport group) kept from prior
+     * config; match number of sockets in group to current max-worker */
+    const uint32_t n = network_reuseport_enabled(srv)
+                     ? srv->srvconf.max_worker - 1
+                     : 0;
+    if (0 == srv_socket->reuseport_n) {
+        if (0 == n) return 0;
+        /* create group if listen socket was created with SO_REUSEPORT
+         * (server.reuseport-workers enabled with max-worker <= 1) */
+        if (sock_addr_get_family(&srv_socket->addr) == AF_UNIX) return 0;
+        int opt = 0;
+        socklen_t optlen = sizeof(opt);
+        if (0 != getsockopt(srv_socket->fd, SOL_SOCKET, SO_REUSEPORT,
+                            &opt, &optlen) || !opt) {
+            log_error(srv->errh, __FILE__, __LINE__,
+              "server.reuseport-workers: listen socket %s does not have "
+              "SO_REUSEPORT set (inherited, or created before the feature was "
+              "enabled); workers share the listen socket.  A full restart "
+              "(not graceful) is required for one listen socket per worker.",
+              srv_socket->srv_token->ptr);
+            return 0;
+        }
+    }
+
+    /* close sockets for workers which no longer exist (highest index first;
+     * kernel moves last socket into slot of removed socket) */
+    while (srv_socket->reuseport_n > n) {
+        const int fd = srv_socket->reuseport_fds[--srv_socket->reuseport_n];
+        if (-1 != fd) fdio_close_socket(fd);
+    }
+
+    if (srv_socket->reuseport_n < n) {
+        const int family = sock_addr_get_family(&srv_socket->addr);
+        const socklen_t addr_len = (socklen_t)
+         #ifdef HAVE_IPV6
+          (family == AF_INET6)
+            ? sizeof(struct sockaddr_in6)
+            :
+         #endif
+              sizeof(struct sockaddr_in);
+        int set_v6only = 0;
+      #ifdef HAVE_IPV6
+        if (family == AF_INET6) {
+            int opt = 0;
+            socklen_t optlen = sizeof(opt);
+            if (0 == getsockopt(srv_socket->fd, IPPROTO_IPV6, IPV6_V6ONLY,
+                                &opt, &optlen))
+                set_v6only = opt ? 1 : -1;
+        }
+      #endif
+        ck_realloc_u32((void **)&srv_socket->reuseport_fds,
+                       srv_socket->reuseport_n,
+                       n - srv_socket->reuseport_n, sizeof(int));
+        while (srv_socket->reuseport_n < n) {
+            const int fd = network_reuseport_socket(srv, srv_socket, s,
+                                                    addr_len, set_v6only);
+            if (-1 == fd) return -1;
+            srv_socket->reuseport_fds[srv_socket->reuseport_n++] = fd;
+        }
+    }
+
+    if (0 == srv_socket->reuseport_n) {
+        network_reuseport_close(srv_socket);
+        /*(SO_REUSEPORT remains set on srv_socket->fd; no other sockets)*/
+    }
+    network_reuseport_steering(srv, srv_socket);
+    return 0;
+}
+
+#endif /* SO_REUSEPORT */
+
+void network_reuseport_close (server_socket * const srv_socket) {
+    for (uint32_t i = 0; i < srv_socket->reuseport_n; ++i) {
+        if (-1 != srv_socket->reuseport_fds[i])
+            fdio_close_socket(srv_socket->reuseport_fds[i]);
+    }
+    free(srv_socket->reuseport_fds);
+    srv_socket->reuseport_fds = NULL;
+    srv_socket->reuseport_n = 0;
+}
+
+void network_reuseport_worker (server * const srv, const int worker) {
+    /* select listen socket for worker and close listen sockets of others
+     * (called in worker after fork(), before network_register_fdevents()) */
+    for (uint32_t i = 0; i < srv->srv_sockets.used; ++i) {
+        server_socket * const srv_socket = srv->srv_sockets.ptr[i];
+        if (0 == srv_socket->reuseport_n) continue;
+        if (worker > 0 && (uint32_t)worker <= srv_socket->reuseport_n) {
+            int * const fdp = srv_socket->reuseport_fds + worker - 1;
+            fdio_close_socket(srv_socket->fd);
+            srv_socket->fd = *fdp;
+            *fdp = -1;
+        }
+        network_reuseport_close(srv_socket);
+    }
+}
+
+
 static int network_server_init(server *srv, const network_socket_config *s, buffer *host_token, size_t sidx, int stdin_fd) {
 	server_socket *srv_socket;
 	const char *host;
@@ -401,6 +640,9 @@ static int network_server_init(server *srv, const network_socket_config *s, buff
 			if ((unsigned short)~0u == srv->srv_sockets.ptr[i]->sidx) {
 				srv->srv_sockets.ptr[i]->sidx = sidx;
 				srv->srv_sockets.ptr[i]->is_ssl = s->ssl_enabled;
+			  #ifdef SO_REUSEPORT
+				return network_reuseport_resize(srv, srv->srv_sockets.ptr[i], s);
+			  #endif
 			}
 			return 0;
 		}
@@ -455,6 +697,9 @@ static int network_server_init(server *srv, const network_socket_config *s, buff
 			if ((unsigned short)~0u == srv->srv_sockets.ptr[i]->sidx) {
 				srv->srv_sockets.ptr[i]->sidx = sidx;
 				srv->srv_sockets.ptr[i]->is_ssl = s->ssl_enabled;
+			  #ifdef SO_REUSEPORT
+				return network_reuseport_resize(srv, srv->srv_sockets.ptr[i], s);
+			  #endif
 			}
 			return 0;
 		}
@@ -576,6 +821,20 @@ static int network_server_init(server *srv, const network_socket_config *s, buff
 		return -1;
 	}
 
+  #ifdef SO_REUSEPORT
+	/* (SO_REUSEPORT is set even if max-worker <= 1 so that the group can
+	 *  be created upon graceful restart with a larger max-worker) */
+	const int reuseport = (-1 == stdin_fd && family != AF_UNIX
+	                       && config_feature_bool(srv, "server.reuseport-workers", 0));
+	if (reuseport) {
+		int opt = 1;
+		if (-1 == setsockopt(srv_socket->fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+			log_serror(srv->errh, __FILE__, __LINE__, "setsockopt(SO_REUSEPORT)");
+			return -1;
+		}
+	}
+  #endif
+
 	if (family != AF_UNIX) {
 		if (fdevent_set_tcp_nodelay(srv_socket->fd, 1) < 0) {
 			log_serror(srv->errh, __FILE__, __LINE__, "setsockopt(TCP_NODELAY)");
@@ -641,6 +900,18 @@ static int network_server_init(server *srv, const network_socket_config *s, buff
 #endif
 #endif
 
+  #ifdef SO_REUSEPORT
+	if (reuseport && network_reuseport_enabled(srv)
+	    && 0 != network_reuseport_init(srv, srv_socket, s, addr_len,
+	                                  #ifdef HAVE_IPV6
+	                                   set_v6only
+	                                  #else
+	                                   0
+	                                  #endif
+	                                  ))
+		return -1;
+  #endif
+
 	return 0;
 }
 
@@ -651,6 +922,7 @@ int network_close(server *srv) {
 			network_unregister_sock(srv, srv_socket);
 			fdio_close_socket(srv_socket->fd);
 		}
+		network_reuseport_close(srv_socket);
 
 		buffer_free(srv_socket->srv_token);
 
@@ -23,4 +23,13 @@ void network_unregister_sock(server *srv, struct server_socket *srv_socket);
 __attribute_cold__
 void network_socket_activation_to_env (server *srv);
 
+__attribute_cold__
+void network_reuseport_close (struct server_socket *srv_socket);
+
+__attribute_cold__
+void network_reuseport_worker (server *srv, int worker);
+
+__attribute_cold__
+int network_reuseport_cpu_steering (const server *srv);
+
 #endif
@@ -11,6 +11,7 @@
 #include "sys-unistd.h" /* <unistd.h> */
 
 #include <errno.h>
+#include <fcntl.h>      /* splice() */
 #include <string.h>
 
 
@@ -72,6 +73,11 @@
 #if defined HAVE_SYS_UIO_H && defined HAVE_WRITEV
 # define NETWORK_WRITE_USE_WRITEV
 #endif
+
+#if defined(NETWORK_WRITE_USE_LINUX_SENDFILE) && defined(HAVE_PREADV2) \
+ && defined(HAVE_LINUX_IO_URING_H)
+# define NETWORK_WRITE_USE_LINUX_IO_URING
+#endif
 #ifdef _WIN32
 # define NETWORK_WRITE_USE_WRITEV
 #endif
@@ -193,6 +199,26 @@ static int network_write_file_chunk_no_mmap(const int fd, chunkqueue * const cq,
 
 
 
+#ifdef HAVE_SPLICE
+/* next chunk must be FILE_CHUNK with pipe (c->file.is_pipe).
+ * splice() from pipe to socket (see chunkqueue_append_splice_sock_pipe()) */
+__attribute_noinline__
+static int network_write_pipe_chunk(const int fd, chunkqueue * const cq, off_t * const p_max_bytes, log_error_st * const errh) {
+    chunk* const c = cq->first;
+    off_t toSend = c->file.length - c->offset;
+
+    if (toSend > *p_max_bytes) toSend = *p_max_bytes;
+    if (toSend <= 0) return network_remove_finished_chunks(cq, toSend);
+
+    ssize_t wr = splice(c->file.fd, NULL, fd, NULL, (size_t)toSend,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    return network_write_accounting(fd, cq, p_max_bytes, errh, wr, toSend);
+}
+#endif
+
+
+
+
 #if defined(NETWORK_WRITE_USE_MMAP)
 
 #include "sys-setjmp.h"
@@ -535,6 +561,314 @@ static int network_write_file_chunk_sendfile(const int fd, chunkqueue * const cq
 
 
 
+#if defined(NETWORK_WRITE_USE_LINUX_IO_URING)
+
+/* "linux-io_uring" network backend
+ *
+ * Same as "linux-sendfile", except that a FILE_CHUNK block which is not in
+ * the page cache is read asynchronously with IORING_OP_READ into a memory
+ * buffer rather than having sendfile() block the event loop on disk I/O.
+ * The chunk is marked busy (2) and the connection yields while the read is in
+ * flight, without waiting for FDEVENT_OUT.  The io_uring fd is registered
+ * with fdevents; completions are reaped in its fdevent handler, which wakes
+ * the fdnode of the socket (as if FDEVENT_OUT).  The data is then written
+ * from the buffer.  Blocks already in the page cache are sent with
+ * sendfile(), as before.
+ *
+ * An op is tied to its chunk by id (c->file.aio), which is ((gen << 8) | slot)
+ * and is also the user_data of the read.  When the chunk is released, the op
+ * is released, or the read is cancelled if still in flight.  An op slot (and
+ * its buffer) is not reused until the completion of its read is reaped. */
+
+#include "sys-io_uring.h"
+#include "fdevent.h"
+#include "plugin_config.h" /* plugin_stats_inc() */
+#include "sys-stat.h"
+
+#define NETWORK_URING_BLOCKSZ 131072
+#define NETWORK_URING_SLOTS   32
+#define NETWORK_URING_UD_CANCEL (~(uint64_t)0)
+
+typedef struct {
+    char *buf;
+    fdnode *fdn;      /* fdnode of socket to which data is written (wake) */
+    off_t offset;     /* file offset of data at buf + pos */
+    dev_t dev;
+    ino_t ino;
+    uint32_t id;      /* (gen << 8) | slot; matches c->file.aio */
+    int sockfd;
+    int state;        /* 0 free, 1 read in flight, 2 read complete,
+                       * 3 read cancelled (in flight; chunk released) */
+    uint32_t pos;
+    uint32_t len;
+} network_uring_op;
+
+static struct {
+    sys_io_uring ring;
+    int init;         /* 0 not yet initialized, 1 ready, -1 unavailable */
+    uint32_t gen;
+    uint32_t inflight;/* ops in state 1 or 3 */
+    fdnode *fdn;
+    server *srv;
+    network_uring_op ops[NETWORK_URING_SLOTS];
+} network_uring;
+
+static void network_uring_wake(network_uring_op * const op) {
+    /* wake connection waiting on async read (FDEVENT_OUT is not set)
+     * (op->fdn is dereferenced only if still registered for op->sockfd) */
+    fdnode * const fdn = op->fdn;
+    if (fdn == fdevent_fdnode_get(network_uring.srv->ev, op->sockfd)
+        && NULL != fdn && (fdevent_handler)NULL != fdn->handler)
+        (*fdn->handler)(fdn->ctx, FDEVENT_OUT);
+}
+
+static void network_uring_reap(void) {
+    sys_io_uring * const ring = &network_uring.ring;
+    if (sys_io_uring_sq_pending(ring)) /*(retry earlier failed submit)*/
+        sys_io_uring_enter(ring, 0, 0, NULL, 0);
+    for (const struct io_uring_cqe *cqe; (cqe = sys_io_uring_peek_cqe(ring)); ){
+        const uint64_t ud = cqe->user_data;
+        const int res = cqe->res;
+        sys_io_uring_cqe_seen(ring);
+        if (ud == NETWORK_URING_UD_CANCEL) continue;
+        network_uring_op * const op =
+          network_uring.ops + (ud & (NETWORK_URING_SLOTS-1));
+        if (op->id != (uint32_t)ud || (1 != op->state && 3 != op->state))
+            continue; /*(should not happen)*/
+        --network_uring.inflight;
+        if (3 == op->state) { /* chunk released; op slot is now free */
+            op->state = 0;
+            continue;
+        }
+        op->len = res > 0 ? (uint32_t)res : 0;
+        op->state = 2;
+        network_uring_wake(op);
+    }
+}
+
+/* called when chunk with c->file.aio == id is released */
+static void network_uring_release(const uint32_t id) {
+    network_uring_op * const op =
+      network_uring.ops + (id & (NETWORK_URING_SLOTS-1));
+    if (op->id != id) return;
+    op->fdn = NULL;
+    if (2 == op->state)
+        op->state = 0;
+    else if (1 == op->state) {
+        /* read in flight; buffer must not be reused until read completes */
+        op->state = 3;
+        sys_io_uring * const ring = &network_uring.ring;
+        struct io_uring_sqe * const sqe = sys_io_uring_get_sqe(ring);
+        if (NULL == sqe) return; /*(read completes in due course)*/
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)id;
+        sqe->user_data = NETWORK_URING_UD_CANCEL;
+        sys_io_uring_commit_sqe(ring);
+        sys_io_uring_enter(ring, 0, 0, NULL, 0);/*(on err, resubmit in reap)*/
+        plugin_stats_inc("network.io_uring-cancels");
+    }
+}
+
+static handler_t network_uring_fdevent(void * const ctx, const int revents) {
+    UNUSED(ctx);
+    UNUSED(revents);
+    network_uring_reap();
+    return HANDLER_FINISHED;
+}
+
+__attribute_cold__
+__attribute_noinline__
+static int network_uring_init(log_error_st * const errh) {
+    /* (initialized upon first use, which is after fork() of workers) */
+    if (0 == sys_io_uring_init(&network_uring.ring, NETWORK_URING_SLOTS, 0)) {
+        server * const srv = network_uring.srv;
+        network_uring.fdn = fdevent_register(srv->ev, network_uring.ring.fd,
+                                             network_uring_fdevent, NULL);
+        fdevent_fdnode_event_set(srv->ev, network_uring.fdn, FDEVENT_IN);
+        ++srv->cur_fds;
+        chunkqueue_set_aio_release(network_uring_release);
+        network_uring.init = 1;
+    }
+    else {
+        network_uring.init = -1;
+        log_perror(errh, __FILE__, __LINE__,
+          "io_uring setup failed; using sendfile() only");
+    }
+    return network_uring.init;
+}
+
+__attribute_cold__
+static void network_uring_reset(server * const srv) {
+    /* (graceful restart in same process; prior srv->ev has been freed) */
+    if (1 == network_uring.init) {
+        /* cancel reads in flight and wait for their completions before the
+         * ring is freed; kernel must not write into buffers after reuse */
+        for (uint32_t i = 0; i < NETWORK_URING_SLOTS; ++i) {
+            network_uring_op * const op = network_uring.ops+i;
+            if (1 == op->state || 3 == op->state) {
+                op->state = 1;
+                network_uring_release(op->id);
+            }
+            else
+                op->state = 0;
+            op->fdn = NULL;
+        }
+        sys_io_uring * const ring = &network_uring.ring;
+        while (network_uring.inflight) {
+            if (sys_io_uring_enter(ring, 1, IORING_ENTER_GETEVENTS, NULL, 0)
+                < 0 && errno != EINTR) {
+                /*(should not happen; leak ring (and buffers) rather than
+                 * risk kernel writing into memory which is later reused)*/
+                memset(ring, 0, sizeof(*ring));
+                ring->fd = -1;
+                memset(network_uring.ops, 0, sizeof(network_uring.ops));
+                network_uring.inflight = 0;
+                break;
+            }
+            network_uring_reap();
+        }
+        sys_io_uring_free(ring);
+        chunkqueue_set_aio_release(0);
+        network_uring.fdn = NULL;
+        network_uring.init = 0;
+    }
+    network_uring.srv = srv;
+}
+
+static network_uring_op * network_uring_op_find(const chunk * const c) {
+    network_uring_op * const op =
+      network_uring.ops + (c->file.aio & (NETWORK_URING_SLOTS-1));
+    return (op->id == c->file.aio && (1 == op->state || 2 == op->state))
+      ? op
+      : NULL;
+}
+
+static network_uring_op * network_uring_op_acquire(void) {
+    for (uint32_t i = 0; i < NETWORK_URING_SLOTS; ++i) {
+        network_uring_op * const op = network_uring.ops + i;
+        if (0 == op->state) {
+            if (0 == (++network_uring.gen & 0xFFFFFF))
+                ++network_uring.gen; /*(id is never 0)*/
+            op->id = (network_uring.gen << 8) | i;
+            return op;
+        }
+    }
+    return NULL;
+}
+
+static int network_uring_submit_read(const int sockfd, chunk * const c, const off_t len) {
+    fdnode * const fdn = fdevent_fdnode_get(network_uring.srv->ev, sockfd);
+    if (NULL == fdn) return -1;
+    struct stat st;
+    if (0 != fstat(c->file.fd, &st)) return -1;
+    sys_io_uring * const ring = &network_uring.ring;
+    network_uring_op * const op = network_uring_op_acquire();
+    if (NULL == op) return -1;
+    struct io_uring_sqe * const sqe = sys_io_uring_get_sqe(ring);
+    if (NULL == sqe) return -1;
+    if (NULL == op->buf) op->buf = ck_malloc(NETWORK_URING_BLOCKSZ);
+    op->fdn = fdn;
+    op->sockfd = sockfd;
+    op->offset = c->offset;
+    op->dev = st.st_dev;
+    op->ino = st.st_ino;
+    op->pos = 0;
+    op->len = (uint32_t)len;
+    op->state = 1;
+    ++network_uring.inflight;
+    c->file.aio = op->id;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = c->file.fd;
+    sqe->off = (uint64_t)c->offset;
+    sqe->addr = (uint64_t)(uintptr_t)op->buf;
+    sqe->len = (uint32_t)len;
+    sqe->user_data = (uint64_t)op->id;
+    sys_io_uring_commit_sqe(ring);
+    sys_io_uring_enter(ring, 0, 0, NULL, 0);/*(on err, resubmit in reap)*/
+    plugin_stats_inc("network.io_uring-reads");
+    return 0;
+}
+
+static void network_uring_op_done(network_uring_op * const op, chunk * const c) {
+    op->state = 0;
+    op->fdn = NULL;
+    c->file.aio = 0;
+}
+
+/* write data from completed async read */
+static int network_write_file_chunk_uring_op(const int fd, chunkqueue * const cq, off_t * const p_max_bytes, log_error_st * const errh, network_uring_op * const op) {
+    chunk * const c = cq->first;
+    struct stat st;
+    c->file.busy = 0;
+    if (0 == op->len || op->offset != c->offset || 0 != fstat(c->file.fd, &st)
+        || st.st_ino != op->ino || st.st_dev != op->dev) {
+        network_uring_op_done(op, c); /*(read error or not the same data)*/
+        return network_write_file_chunk_sendfile(fd, cq, p_max_bytes, errh);
+    }
+
+    off_t toSend = c->file.length - c->offset;
+    if (toSend > *p_max_bytes) toSend = *p_max_bytes;
+    if (toSend > (off_t)op->len) toSend = (off_t)op->len;
+    ssize_t wr = network_write_data_len(fd, op->buf + op->pos, toSend);
+    if (wr > 0) {
+        op->pos += (uint32_t)wr;
+        op->len -= (uint32_t)wr;
+        op->offset += wr;
+        if (0 == op->len || wr == c->file.length - c->offset)
+            network_uring_op_done(op, c);
+    }
+    return network_write_accounting(fd, cq, p_max_bytes, errh, wr, toSend);
+}
+
+static int network_write_file_chunk_io_uring(const int fd, chunkqueue * const cq, off_t * const p_max_bytes, log_error_st * const errh) {
+    chunk * const c = cq->first;
+    off_t toSend = c->file.length - c->offset;
+    if (toSend > *p_max_bytes) toSend = *p_max_bytes;
+    if (toSend <= 0) return network_remove_finished_chunks(cq, toSend);
+
+    if (c->file.fd < 0 && 0 != chunk_open_file_chunk(c, errh)) return -1;
+
+    if (__builtin_expect( (network_uring.init <= 0), 0)
+        && network_uring_init(errh) < 0)
+        return network_write_file_chunk_sendfile(fd, cq, p_max_bytes, errh);
+
+    network_uring_reap();
+    network_uring_op * const op = c->file.aio ? network_uring_op_find(c) : NULL;
+    if (NULL != op) {
+        if (1 == op->state) {
+            c->file.busy = 2;
+            return -3; /* read in flight; yield (woken upon completion) */
+        }
+        return network_write_file_chunk_uring_op(fd,cq,p_max_bytes,errh,op);
+    }
+
+    if (c->file.is_temp) /*(temp files expected to be in page cache)*/
+        return network_write_file_chunk_sendfile(fd, cq, p_max_bytes, errh);
+
+    /* check (without blocking) if end of next block is in page cache */
+    if (toSend > NETWORK_URING_BLOCKSZ) toSend = NETWORK_URING_BLOCKSZ;
+    char b;
+    struct iovec iov[1] = { { &b, 1 } };
+    if (-1 == preadv2(c->file.fd, iov, 1, c->offset + toSend - 1, RWF_NOWAIT)
+        && errno == EAGAIN && 0 == network_uring_submit_read(fd, c, toSend)) {
+        c->file.busy = 2;
+        return -3; /* read in flight; yield (woken upon completion) */
+    }
+    c->file.busy = 0;
+
+    /* send resident block with sendfile() */
+    off_t max_bytes = toSend;
+    int rc = network_write_file_chunk_sendfile(fd, cq, &max_bytes, errh);
+    *p_max_bytes -= toSend - max_bytes;
+    return (-3 == rc && 0 == max_bytes && *p_max_bytes > 0) ? 0 : rc;
+}
+
+#endif /* NETWORK_WRITE_USE_LINUX_IO_URING */
+
+
+
+
 /* return values:
  * >= 0 : no error
  *   -1 : error (on our side)
@@ -554,6 +888,11 @@ static int network_write_chunkqueue_writev(const int fd, chunkqueue * const cq,
           #endif
             break;
         case FILE_CHUNK:
+          #ifdef HAVE_SPLICE
+            if (cq->first->file.is_pipe)
+                rc = network_write_pipe_chunk(fd, cq, &max_bytes, errh);
+            else
+          #endif
           #ifdef NETWORK_WRITE_USE_MMAP
             rc = network_write_file_chunk_mmap(fd, cq, &max_bytes, errh);
           #else
@@ -587,6 +926,11 @@ static int network_write_chunkqueue_sendfile(const int fd, chunkqueue * const cq
           #endif
             break;
         case FILE_CHUNK:
+          #ifdef HAVE_SPLICE
+            if (cq->first->file.is_pipe)
+                rc = network_write_pipe_chunk(fd, cq, &max_bytes, errh);
+            else
+          #endif
           #if defined(NETWORK_WRITE_USE_SENDFILE)
             rc = network_write_file_chunk_sendfile(fd, cq, &max_bytes, errh);
           #elif defined(NETWORK_WRITE_USE_MMAP)
@@ -605,12 +949,30 @@ static int network_write_chunkqueue_sendfile(const int fd, chunkqueue * const cq
 }
 #endif
 
+#if defined(NETWORK_WRITE_USE_LINUX_IO_URING)
+static int network_write_chunkqueue_io_uring(const int fd, chunkqueue * const cq, off_t max_bytes, log_error_st * const errh) {
+    while (NULL != cq->first) {
+        int rc = (MEM_CHUNK == cq->first->type)
+          ? network_writev_mem_chunks(fd, cq, &max_bytes, errh)
+         #ifdef HAVE_SPLICE
+          : cq->first->file.is_pipe
+          ? network_write_pipe_chunk(fd, cq, &max_bytes, errh)
+         #endif
+          : network_write_file_chunk_io_uring(fd, cq, &max_bytes, errh);
+        if (__builtin_expect( (0 != rc), 0)) return (-3 == rc) ? 0 : rc;
+    }
+
+    return 0;
+}
+#endif
+
 int network_write_init(server *srv) {
     typedef enum {
         NETWORK_BACKEND_UNSET,
         NETWORK_BACKEND_WRITE,
         NETWORK_BACKEND_WRITEV,
         NETWORK_BACKEND_SENDFILE,
+        NETWORK_BACKEND_IO_URING,
     } network_backend_t;
 
     network_backend_t backend;
@@ -624,6 +986,7 @@ int network_write_init(server *srv) {
         { NETWORK_BACKEND_SENDFILE, "linux-sendfile" },
         { NETWORK_BACKEND_SENDFILE, "freebsd-sendfile" },
         { NETWORK_BACKEND_SENDFILE, "solaris-sendfilev" },
+        { NETWORK_BACKEND_IO_URING, "linux-io_uring" },
         { NETWORK_BACKEND_WRITEV,   "writev" },
         { NETWORK_BACKEND_WRITE,    "write" },
         { NETWORK_BACKEND_UNSET,    NULL }
@@ -649,6 +1012,12 @@ int network_write_init(server *srv) {
     }
 
     switch(backend) {
+    case NETWORK_BACKEND_IO_URING:
+      #if defined(NETWORK_WRITE_USE_LINUX_IO_URING)
+        srv->network_backend_write = network_write_chunkqueue_io_uring;
+        network_uring_reset(srv);
+        break;
+      #endif
     case NETWORK_BACKEND_SENDFILE:
       #if defined(NETWORK_WRITE_USE_SENDFILE)
         srv->network_backend_write = network_write_chunkqueue_sendfile;
@@ -688,6 +1057,11 @@ const char * network_write_show_handlers(void) {
      #else
       "\t- solaris-sendfilev\n"
      #endif
+     #if defined NETWORK_WRITE_USE_LINUX_IO_URING
+      "\t+ linux-io_uring\n"
+     #else
+      "\t- linux-io_uring\n"
+     #endif
      #if defined NETWORK_WRITE_USE_WRITEV
       "\t+ writev\n"
      #else
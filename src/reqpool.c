@@ -94,14 +94,100 @@ request_init (connection * const con)
 {
     request_st * const r = ck_calloc(1, sizeof(request_st));
     request_init_data(r, con, con->srv);
+    plugin_stats_inc("request.pool-alloc");
     return r;
 }
 
 
+/* per-request arena
+ *
+ * Objects which live no longer than the request (e.g. handler contexts of
+ * gw_backend modules: mod_proxy, mod_fastcgi, mod_scgi, ...) are carved from
+ * a block which is kept with the (request_st *) in the request pool, and are
+ * released in bulk by request_reset() (after handle_request_reset hooks).
+ * Allocations which do not fit in the block are allocated individually and
+ * are freed upon reset; the block is then enlarged for subsequent requests.
+ * Instrumentation in plugin_stats (status.statistics-url):
+ *   request.arena-bytes     bytes allocated from request arenas
+ *   request.arena-overflow  allocations which did not fit in arena block */
+
+#define REQUEST_ARENA_MIN  2048
+#define REQUEST_ARENA_MAX 16384
+
+typedef struct request_arena_ext {
+    struct request_arena_ext *next;
+    size_t sz; /*(header padded to 16 bytes on 64-bit; data follows)*/
+} request_arena_ext;
+
+
+__attribute_cold__
+__attribute_noinline__
+__attribute_returns_nonnull__
+static void *
+request_arena_calloc_slow (request_st * const r, const size_t sz)
+{
+    if (NULL == r->arena) {
+        uint32_t bsz = r->arena_hint ? r->arena_hint : REQUEST_ARENA_MIN;
+        while (bsz < sz && bsz < REQUEST_ARENA_MAX) bsz <<= 1;
+        if (sz <= bsz) {
+            r->arena = ck_malloc(bsz);
+            r->arena_size = bsz;
+            r->arena_used = (uint32_t)sz;
+            return memset(r->arena, 0, sz);
+        }
+    }
+    plugin_stats_inc("request.arena-overflow");
+    request_arena_ext * const ext = ck_calloc(1, sizeof(*ext) + sz);
+    ext->next = r->arena_ext;
+    ext->sz = sz;
+    r->arena_ext = ext;
+    return ext+1;
+}
+
+
+void *
+request_arena_calloc (request_st * const r, size_t sz)
+{
+    sz = (sz + 15) & ~(size_t)15;
+    *plugin_stats_get_ptr("request.arena-bytes",
+                          sizeof("request.arena-bytes")-1) += (int)sz;
+    if (__builtin_expect( (sz > r->arena_size - r->arena_used), 0))
+        return request_arena_calloc_slow(r, sz);
+    char * const p = r->arena + r->arena_used;
+    r->arena_used += (uint32_t)sz;
+    return memset(p, 0, sz);
+}
+
+
+static void
+request_arena_reset (request_st * const r)
+{
+    r->arena_used = 0;
+    if (__builtin_expect( (NULL == r->arena_ext), 1)) return;
+    /* enlarge block for subsequent requests to fit total allocated */
+    size_t total = r->arena_size;
+    for (request_arena_ext *ext = r->arena_ext, *next; ext; ext = next) {
+        next = ext->next;
+        total += ext->sz;
+        free(ext);
+    }
+    r->arena_ext = NULL;
+    uint32_t bsz = r->arena_size ? r->arena_size : REQUEST_ARENA_MIN;
+    while (bsz < total && bsz < REQUEST_ARENA_MAX) bsz <<= 1;
+    if (bsz != r->arena_size) {
+        free(r->arena);
+        r->arena = NULL;
+        r->arena_size = 0;
+        r->arena_hint = bsz;
+    }
+}
+
+
 void
 request_reset (request_st * const r)
 {
     plugins_call_handle_request_reset(r);
+    request_arena_reset(r);
 
     http_response_reset(r);
 
@@ -253,6 +339,9 @@ request_free_data (request_st * const r)
     free(r->pathinfo.ptr);
     free(r->server_name_buf.ptr);
 
+    request_arena_reset(r);
+    free(r->arena);
+
     free(r->plugin_ctx);
     free(r->cond_cache);
   #ifdef HAVE_PCRE
@@ -277,6 +366,59 @@ request_free_data (request_st * const r)
 
 /* linked list of (request_st *) cached for reuse */
 static request_st *reqpool;
+static uint32_t reqpool_len;
+static uint32_t reqpool_min; /* low watermark since last request_pool_trim()*/
+
+
+static size_t
+request_array_mem_size (const array * const a)
+{
+    size_t sz = a->size * 2 * sizeof(*a->data); /*(a->data, a->sorted)*/
+    for (uint32_t i = 0; i < a->size; ++i) {
+        const data_string * const ds = (const data_string *)a->data[i];
+        if (ds)
+            sz += sizeof(*ds) + ds->key.size + ds->value.size;
+    }
+    return sz;
+}
+
+
+static size_t
+request_mem_size (const request_st * const r)
+{
+    /* memory held by (request_st *) and its buffers for reuse
+     * (excludes chunkqueues, which release chunks to chunk pool on reset) */
+    return sizeof(*r)
+         + r->arena_size
+         + r->target.size
+         + r->target_orig.size
+         + r->pathinfo.size
+         + r->server_name_buf.size
+         + r->uri.scheme.size
+         + r->uri.authority.size
+         + r->uri.path.size
+         + r->uri.query.size
+         + r->physical.path.size
+         + r->physical.basedir.size
+         + r->physical.doc_root.size
+         + r->physical.rel_path.size
+         + request_array_mem_size(&r->rqst_headers)
+         + request_array_mem_size(&r->resp_headers)
+         + request_array_mem_size(&r->env);
+}
+
+
+static void
+request_pool_stats (void)
+{
+    size_t sz = 0;
+    for (const request_st *r = reqpool; r; r = (request_st *)r->con)
+        sz += request_mem_size(r);
+    plugin_stats_set("request.pool-used", sizeof("request.pool-used")-1,
+                     (int)reqpool_len);
+    plugin_stats_set("request.pool-bytes", sizeof("request.pool-bytes")-1,
+                     sz < INT32_MAX ? (int)sz : INT32_MAX);
+}
 
 
 void
@@ -288,6 +430,33 @@ request_pool_free (void)
         request_free_data(r);
         free(r);
     }
+    reqpool_len = reqpool_min = 0;
+}
+
+
+void
+request_pool_trim (void)
+{
+    /* free (request_st *) which remained unused in pool since prior trim,
+     * and keep the rest, so that steady load (e.g. many HTTP/2 streams)
+     * does not repeatedly allocate and free requests and their buffers.
+     * Pool is LIFO, so (request_st *) at end of list were least recently
+     * used.  (A burst of requests is released after two trim intervals.) */
+    if (reqpool_min) {
+        request_st **rp = &reqpool;
+        for (uint32_t n = reqpool_len - reqpool_min; n; --n)
+            rp = (request_st **)&(*rp)->con;
+        request_st *r = *rp;
+        *rp = NULL;
+        reqpool_len -= reqpool_min;
+        for (request_st *next; r; r = next) {
+            next = (request_st *)r->con; /*(reuse r->con as next ptr)*/
+            request_free_data(r);
+            free(r);
+        }
+    }
+    reqpool_min = reqpool_len;
+    request_pool_stats();
 }
 
 
@@ -296,6 +465,7 @@ request_pool_push (request_st * const r)
 {
     r->con = (connection *)reqpool; /*(reuse r->con as next ptr)*/
     reqpool = r;
+    ++reqpool_len;
 }
 
 
@@ -305,6 +475,8 @@ request_pool_pop (void)
     /*assert(reqpool);*//*(caller should check non-NULL)*/
     request_st * const r = reqpool;
     reqpool = (request_st *)r->con; /*(reuse r->con as next ptr)*/
+    if (--reqpool_len < reqpool_min)
+        reqpool_min = reqpool_len;
     return r;
 }
 
@@ -25,4 +25,7 @@ void request_free_data (request_st *r);
 __attribute_cold__
 void request_pool_free (void);
 
+__attribute_cold__
+void request_pool_trim (void);
+
 #endif
@@ -209,9 +209,23 @@ struct request_st {
     struct stat_cache_entry *tmp_sce; /*(value valid only in sequential code)*/
     int cond_captures;
     int h2_connect_ext;
+
+    /* per-request arena (see request_arena_calloc()) */
+    char *arena;
+    uint32_t arena_used;
+    uint32_t arena_size;
+    uint32_t arena_hint; /* block size for next request after overflow */
+    void *arena_ext;     /* allocations which did not fit in arena block */
 };
 
 
+/* zeroed memory valid until request_reset(); must not be free()d
+ * (for objects which live no longer than the request, e.g. handler ctx) */
+__attribute_malloc__
+__attribute_returns_nonnull__
+void * request_arena_calloc (request_st *r, size_t sz);
+
+
 /* intended only for use by lighttpd base code, not by modules */
 #define request_set_state(r, n) ((r)->state = (n))
 
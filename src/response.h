@@ -46,6 +46,8 @@ typedef struct http_response_opts_t {
   uint8_t local_redir; /* 0,1,2 */
   uint8_t upgrade; /* 0,1,2 */
   uint8_t xsendfile_allow; /* bool */
+  uint8_t backend_keep_alive; /* bool */
+  uint8_t splice_relay; /* bool */
   const array *xsendfile_docroot;
   void *pdata;
   handler_t(*parse)(request_st *, struct http_response_opts_t *, buffer *, size_t);
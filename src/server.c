@@ -16,7 +16,7 @@
 #include "plugins.h"
 #include "plugin_config.h"  /* config_plugin_value_tobool() */
 #include "network_write.h"  /* network_write_show_handlers() */
-#include "reqpool.h"        /* request_pool_init() request_pool_free() */
+#include "reqpool.h"        /* request_pool_free() request_pool_trim() */
 #include "response.h"       /* http_dispatch[] strftime_cache_reset() */
 
 #ifdef HAVE_VERSIONSTAMP_H
@@ -40,6 +40,9 @@ static const buffer default_server_tag =
 #include <fcntl.h>
 #include <stdlib.h>
 #include <signal.h>
+#ifdef __linux__
+#include <sched.h>      /* sched_setaffinity() */
+#endif
 #include <locale.h>
 #ifdef _WIN32
 #include <mbctype.h>    /* _setmbcp() */
@@ -454,6 +457,21 @@ server_monotonic_secs (void)
   #endif
 }
 
+static int
+server_poll_timeout_ms (void)
+{
+    /* wake at next monotonic second boundary for periodic maintenance,
+     * so that timeouts in connection timer wheel are checked promptly */
+  #ifdef _MSC_VER
+    return (int)(1000 - GetTickCount64() % 1000);
+  #else
+    unix_timespec64_t ts;
+    return (0 == log_clock_gettime(clockid_mono_coarse, &ts))
+      ? (int)(1000 - ts.tv_nsec / 1000000)
+      : 1000;
+  #endif
+}
+
 static unix_time64_t
 server_epoch_secs (server * const srv, unix_time64_t mono_ts_delta)
 {
@@ -1053,6 +1071,7 @@ static void server_sockets_close (server *srv) {
         if (2 != srv->sockets_disabled) network_unregister_sock(srv,srv_socket);
         fdio_close_socket(srv_socket->fd);
         srv_socket->fd = -1;
+        network_reuseport_close(srv_socket);
         /* network_close() will cleanup after us */
     }
     srv->sockets_disabled = 3;
@@ -1191,6 +1210,87 @@ static int server_graceful_state_bg (server *srv) {
     return 1;
 }
 
+static size_t server_rss_budget; /* bytes; 0 if disabled */
+static int server_rss_budget_exceeded;
+static unix_time64_t server_rss_budget_next_ts; /* earliest next release */
+static size_t server_rss_budget_released_rss;   /* rss after last release */
+
+__attribute_cold__
+static void
+server_rss_budget_set (server * const srv, const uint32_t mb)
+{
+  #ifdef __linux__
+    UNUSED(srv);
+    server_rss_budget = (size_t)mb << 20;
+  #else
+    if (mb)
+        log_warn(srv->errh, __FILE__, __LINE__,
+          "server.rss-budget not supported on this platform; ignored");
+  #endif
+}
+
+#ifdef __linux__
+static size_t
+server_rss_bytes (void)
+{
+    /* resident set size (2nd field of /proc/self/statm, in pages) */
+    char buf[128];
+    const int fd = fdevent_open_cloexec("/proc/self/statm", 1, O_RDONLY, 0);
+    if (fd < 0) return 0;
+    const ssize_t rd = read(fd, buf, sizeof(buf)-1);
+    close(fd);
+    if (rd <= 0) return 0;
+    buf[rd] = '\0';
+    const char * const s = strchr(buf, ' ');
+    return s ? (size_t)strtoul(s+1, NULL, 10) * (size_t)sysconf(_SC_PAGESIZE)
+             : 0;
+}
+#else
+#define server_rss_bytes() 0
+#endif
+
+__attribute_noinline__
+static void
+server_rss_budget_check (server * const srv)
+{
+    const size_t rss = server_rss_bytes();
+    if (rss <= server_rss_budget) {
+        server_rss_budget_exceeded = 0;
+        return;
+    }
+
+    /* while exceeded, release again only after exponential backoff
+     * (2s, 4s, 8s, ... 64s), or sooner if rss grew > 1/8 budget since last
+     * release; releasing pools each second is churn if rss remains over
+     * budget for reasons other than pooled memory (e.g. active load) */
+    if (server_rss_budget_exceeded) {
+        if (server_rss_budget_next_ts > log_monotonic_secs
+            && rss <= server_rss_budget_released_rss + (server_rss_budget>>3))
+            return;
+        if (server_rss_budget_exceeded < 32)
+            server_rss_budget_exceeded <<= 1;
+    }
+
+    /* release memory held in pools for reuse (e.g. after traffic spike) */
+    chunkqueue_chunk_pool_clear();
+    request_pool_free();
+    connections_pool_clear(srv);
+  #if defined(HAVE_MALLOC_TRIM)
+    if (malloc_trim_fn) malloc_trim_fn(0);
+  #endif
+    plugin_stats_inc("server.rss-budget-release");
+
+    if (!server_rss_budget_exceeded) { /*(log once while exceeded)*/
+        server_rss_budget_exceeded = 1;
+        log_notice(srv->errh, __FILE__, __LINE__,
+          "resident set size %zu MB exceeds server.rss-budget %zu MB; "
+          "releasing pooled memory", rss >> 20, server_rss_budget >> 20);
+    }
+    server_rss_budget_next_ts = log_monotonic_secs
+                              + (server_rss_budget_exceeded << 1);
+    server_rss_budget_released_rss = server_rss_bytes();
+}
+
 __attribute_cold__
 __attribute_noinline__
 static void server_graceful_shutdown_maint (server *srv) {
@@ -1278,6 +1378,42 @@ static void server_load_check (server *srv) {
 }
 
 #ifdef HAVE_FORK
+__attribute_cold__
+static void server_worker_cpu_affinity (server * const srv, const int worker) {
+  #if defined(__linux__) && defined(CPU_SET)
+    /* pin worker k to CPUs c for which (c % max-worker == k), i.e. the CPUs
+     * from which connections are steered to worker k (see network.c).
+     * If not steering by CPU, or none of those CPUs are in process CPU
+     * affinity mask, pin worker k to the k-th CPU (mod ncpus) in the mask */
+    cpu_set_t cpuset, pinset;
+    if (0 != sched_getaffinity(0, sizeof(cpuset), &cpuset)) return;
+    const int ncpus = CPU_COUNT(&cpuset);
+    if (ncpus <= 1) return;
+    CPU_ZERO(&pinset);
+    if (network_reuseport_cpu_steering(srv)) {
+        const int n = (int)srv->srvconf.max_worker;
+        for (int cpu = worker; cpu < CPU_SETSIZE; cpu += n) {
+            if (CPU_ISSET(cpu, &cpuset))
+                CPU_SET(cpu, &pinset);
+        }
+    }
+    if (0 == CPU_COUNT(&pinset)) {
+        for (int cpu = 0, n = worker % ncpus; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpuset) && 0 == n--) {
+                CPU_SET(cpu, &pinset);
+                break;
+            }
+        }
+    }
+    if (0 != sched_setaffinity(0, sizeof(pinset), &pinset))
+        log_perror(srv->errh, __FILE__, __LINE__,
+          "sched_setaffinity() worker %d", worker);
+  #else
+    UNUSED(srv);
+    UNUSED(worker);
+  #endif
+}
+
 __attribute_noinline__
 static int server_main_setup_workers (server * const srv, const int npids) {
     pid_t pid;
@@ -1287,8 +1423,17 @@ static int server_main_setup_workers (server * const srv, const int npids) {
     pid_t pids[npids];
     for (int n = 0; n < npids; ++n) pids[n] = -1;
     server_graceful_signal_prev_generation();
+    /* optional stat cache shared by workers (created before fork) */
+    const int32_t sc_shared =
+      config_feature_int(srv, "server.stat-cache-shared", 0);
+    if (sc_shared > 0)
+        stat_cache_shm_init((uint32_t)sc_shared, srv->errh);
+    /* pre-warm stat cache once (inherited by workers) */
+    stat_cache_prewarm(srv->errh);
+    int worker = 0;
     while (!child && !srv_shutdown && !graceful_shutdown) {
         if (num_childs > 0) {
+            for (worker = 0; worker < npids && -1 != pids[worker]; ++worker) ;
             switch ((pid = fork())) {
               case -1:
                 return -1;
@@ -1298,12 +1443,7 @@ static int server_main_setup_workers (server * const srv, const int npids) {
                 break;
               default:
                 num_childs--;
-                for (int n = 0; n < npids; ++n) {
-                    if (-1 == pids[n]) {
-                        pids[n] = pid;
-                        break;
-                    }
-                }
+                pids[worker] = pid;
                 break;
             }
         }
@@ -1398,6 +1538,14 @@ static int server_main_setup_workers (server * const srv, const int npids) {
     fdlog_pipes_abandon_pids();
     srv->pid = getpid();
     li_rand_reseed();
+    stat_cache_shm_worker(worker);
+
+    /*(no-op unless listen sockets were created with SO_REUSEPORT group)*/
+    network_reuseport_worker(srv, worker);
+    if (config_feature_bool(srv, "server.reuseport-workers", 0)) {
+        server_worker_cpu_affinity(srv, worker);
+        chunkqueue_set_chunk_numa_local();
+    }
 
     return 1; /* child worker */
 }
@@ -2016,8 +2164,49 @@ static int server_main_setup (server * const srv, int argc, char **argv) {
 
 	chunkqueue_internal_pipes(config_feature_bool(srv, "chunkqueue.splice", 1));
 
+	/* relay proxied response bodies from backend to client through pipes
+	 * (pipe fds are counted in srv->cur_fds) */
+	chunkqueue_set_splice_relay(
+	  config_feature_bool(srv, "chunkqueue.splice-relay", 0), &srv->cur_fds);
+
+	/* chunk pool watermarks (num chunks kept in pool; kept at trim) */
+	const int32_t pool_high =
+	  config_feature_int(srv, "chunkqueue.pool-high", 0);
+	const int32_t pool_low =
+	  config_feature_int(srv, "chunkqueue.pool-low", 0);
+	const int32_t pool_oversized_high =
+	  config_feature_int(srv, "chunkqueue.pool-oversized-high", 64);
+	const int32_t pool_oversized_low =
+	  config_feature_int(srv, "chunkqueue.pool-oversized-low", 0);
+	chunkqueue_set_chunk_pool_limits(
+	  pool_high > 0 ? (uint32_t)pool_high : 0,
+	  pool_low > 0 ? (uint32_t)pool_low : 0,
+	  pool_oversized_high > 0 ? (uint32_t)pool_oversized_high : 0,
+	  pool_oversized_low > 0 ? (uint32_t)pool_oversized_low : 0);
+
+	/* back large chunk buffers with transparent hugepages, if enabled */
+	if (0 != chunkqueue_set_chunk_hugepages(
+	           config_feature_bool(srv, "chunkqueue.hugepages", 0)))
+		log_warn(srv->errh, __FILE__, __LINE__,
+		  "chunkqueue.hugepages: transparent hugepages not available");
+
+	/* release pooled memory if resident set size exceeds budget (MB) */
+	const int32_t rss_budget =
+	  config_feature_int(srv, "server.rss-budget", 0);
+	server_rss_budget_set(srv, rss_budget > 0 ? (uint32_t)rss_budget : 0);
+
+	/* cache stat() ENOENT/ENOTDIR up to limit on num entries (0 disables) */
+	const int32_t sc_negative =
+	  config_feature_int(srv, "server.stat-cache-negative", 0);
+	stat_cache_negative_max(sc_negative > 0 ? (uint32_t)sc_negative : 0);
+
+	/* stat() up to limit on num files in dir when dir is first monitored */
+	const int32_t sc_prefetch =
+	  config_feature_int(srv, "server.stat-cache-prefetch", 0);
+	stat_cache_prefetch_max(sc_prefetch > 0 ? (uint32_t)sc_prefetch : 0);
+
 	/* might fail if user is using fam (not gamin) and famd isn't running */
-	if (!stat_cache_init(srv->ev, srv->errh)) {
+	if (!stat_cache_init(srv->ev, &srv->cur_fds, srv->errh)) {
 		log_error(srv->errh, __FILE__, __LINE__,
 		  "stat-cache could not be setup, dying.");
 		return -1;
@@ -2128,9 +2317,10 @@ static void server_handle_sigalrm (server * const srv, unix_time64_t mono_ts, un
 					/* free logger buffers every 64 secs */
 					fdlog_flushall(srv->errh);
 					/* free excess chunkqueue buffers every 64 secs */
-					chunkqueue_chunk_pool_clear();
-					/* clear request and connection pools every 64 secs */
-					request_pool_free();
+					chunkqueue_chunk_pool_trim();
+					/* trim request pool and clear connection pool
+					 * every 64 secs */
+					request_pool_trim();
 					connections_pool_clear(srv);
 				  #if defined(HAVE_MALLOC_TRIM)
 					if (malloc_trim_fn) malloc_trim_fn(malloc_top_pad);
@@ -2143,6 +2333,9 @@ static void server_handle_sigalrm (server * const srv, unix_time64_t mono_ts, un
 				stat_cache_trigger_cleanup();
 				/* reset global/aggregate rate limit counters */
 				config_reset_config_bytes_sec(srv->config_data_base);
+				/* release pooled memory if over memory budget */
+				if (server_rss_budget)
+					server_rss_budget_check(srv);
 				/* if graceful_shutdown, accelerate cleanup of recently completed request/responses */
 				if (graceful_shutdown && !srv_shutdown)
 					server_graceful_shutdown_maint(srv);
@@ -2233,7 +2426,9 @@ static void server_main_loop (server * const srv) {
 		log_con_jqueue = sentinel;
 		server_run_con_queue(joblist, sentinel);
 
-		if (fdevent_poll(srv->ev, log_con_jqueue != sentinel ? 0 : 1000) > 0)
+		if (fdevent_poll(srv->ev, log_con_jqueue != sentinel
+		                            ? 0
+		                            : server_poll_timeout_ms()) > 0)
 			last_active_ts = log_monotonic_secs;
 	}
 }
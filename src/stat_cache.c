@@ -2,13 +2,15 @@
 
 #include "stat_cache.h"
 
+#include "sys-dirent.h"
 #include "sys-stat.h"
 #include "sys-unistd.h" /* <unistd.h> */
 
 #include "log.h"
 #include "fdevent.h"
 #include "http_etag.h"
-#include "algo_splaytree.h"
+#include "algo_hmap.h"
+#include "algo_md.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -25,10 +27,16 @@
 # include <sys/extattr.h>
 #endif
 
+#if defined(HAVE_FORK) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#define STAT_CACHE_SHM
+#endif
+
 /*
  * stat-cache
  *
- * - a splay-tree is used as we can use the caching effect of it
+ * - an open-addressing hash map (algo_hmap.h) indexed by path hash is used
+ *   (lookups do not modify the map and probe contiguous memory)
  */
 
 enum {
@@ -40,33 +48,58 @@ enum {
 };
 
 struct stat_cache_fam;  /* declaration */
+struct stat_cache_shm_entry;  /* declaration */
 
 typedef struct stat_cache {
 	int stat_cache_engine;
-	splay_tree *files; /* nodes of tree are (stat_cache_entry *) */
+	hmap files; /* indexed by path hash; data is (stat_cache_entry *) */
 	struct stat_cache_fam *scf;
+  #ifdef STAT_CACHE_SHM
+	struct stat_cache_shm_entry *shm; /* shared by workers (if enabled) */
+	uint32_t shm_mask;
+	uint32_t shm_scan;  /* owner scan position */
+	int shm_owner;      /* worker monitoring dirs on behalf of all workers */
+	int shm_fam;        /* shared entries might be monitored by owner */
+  #endif
+	uint32_t neg_used;  /* num negative entries (path not found) */
+	uint32_t neg_max;   /* limit on num negative entries (0 to disable) */
+	uint32_t prefetch_max; /* limit on files stat() in newly monitored dir */
+	const array *prewarm;           /* dirs to walk or manifest files */
+	const array *prewarm_mimetypes; /* global scope mimetype.assign */
+	int prewarm_etag_flags;         /* global scope etag flags */
+	int prewarm_use_xattr;          /* global scope mimetype.use-xattr */
+	uint32_t prewarm_max;           /* limit on num entries pre-warmed */
+	uint32_t prewarm_fds;           /* num pre-warmed entries to hold open */
+	uint32_t prewarm_n;             /* num entries pre-warmed */
+	uint32_t prewarm_nfds;          /* num pre-warmed files held open */
+	unix_time64_t prewarm_ts;       /* time at which pre-warm completed */
+	int *cur_fds;                   /* &srv->cur_fds */
 } stat_cache;
 
 static stat_cache sc;
 
 
-__attribute_noinline__
-static void * stat_cache_sptree_ndx(splay_tree ** const sptree,
-                                    int * const ndxp,
-                                    const char * const name,
-                                    uint32_t len)
+__attribute_pure__
+static uint32_t stat_cache_hash(const char * const name, const uint32_t len)
+{
+    return djbhash(name, len, DJBHASH_INIT);
+}
+
+static void * stat_cache_hmap_ndx(const hmap * const h,
+                                  uint32_t * const ndxp,
+                                  const char * const name,
+                                  uint32_t len)
 {
-    const int ndx = splaytree_djbhash(name, len);
+    const uint32_t ndx = stat_cache_hash(name, len);
     if (ndxp) *ndxp = ndx;
-    *sptree = splaytree_splay(*sptree, ndx);
-    return (*sptree && (*sptree)->key == ndx) ? (*sptree)->data : NULL;
+    return hmap_find(h, ndx);
 }
 
-static void * stat_cache_sptree_find(splay_tree ** const sptree,
-                                     const char * const name,
-                                     uint32_t len)
+static void * stat_cache_hmap_find(const hmap * const h,
+                                   const char * const name,
+                                   uint32_t len)
 {
-    return stat_cache_sptree_ndx(sptree, NULL, name, len);
+    return stat_cache_hmap_ndx(h, NULL, name, len);
 }
 
 
@@ -130,9 +163,10 @@ static void * stat_cache_sptree_find(splay_tree ** const sptree,
  *
  * Internal note: lighttpd walks the caches to prune trees in stat_cache when an
  * event is received for a directory (or symlink to a directory) which has been
- * deleted or renamed.  The splaytree data structure is suboptimal for frequent
- * changes of large directories trees where there have been a large number of
- * different files recently accessed and part of the stat_cache.
+ * deleted or renamed.  Each walk is a linear scan of the hash map, which is
+ * suboptimal for frequent changes of large directories trees where there have
+ * been a large number of different files recently accessed and part of the
+ * stat_cache.
  */
 
 #if defined(HAVE_SYS_INOTIFY_H) \
@@ -152,7 +186,7 @@ typedef int FAMRequest; /*(fr)*/
         inotify_rm_watch(*(fd), *(wd))
 #define fam_watch_mask ( IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF \
                        | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM \
-                       | IN_EXCL_UNLINK | IN_ONLYDIR )
+                       | IN_MOVED_TO | IN_EXCL_UNLINK | IN_ONLYDIR )
                      /*(note: follows symlinks; not providing IN_DONT_FOLLOW)*/
 #define FAMMonitorDirectory(fd, fn, wd, userData) \
         ((*(wd) = inotify_add_watch(*(fd), (fn), (fam_watch_mask))) < 0)
@@ -219,6 +253,13 @@ typedef enum FAMCodes { /*(copied from fam.h to define arbitrary enum values)*/
 
 #endif
 
+#if defined(HAVE_SYS_INOTIFY_H) \
+ || (defined(HAVE_SYS_EVENT_H) && defined(HAVE_KQUEUE))
+/* file creation in monitored dir is reported for name of file (inotify)
+ * or as change to dir (kqueue), so negative entries can be monitored */
+#define STAT_CACHE_NEG_MONITOR
+#endif
+
 typedef struct fam_dir_entry {
 	buffer name;
 	int refcnt;
@@ -230,9 +271,9 @@ typedef struct fam_dir_entry {
 } fam_dir_entry;
 
 typedef struct stat_cache_fam {
-	splay_tree *dirs; /* indexed by path; node data is fam_dir_entry */
+	hmap dirs; /* indexed by path hash; data is fam_dir_entry */
   #ifdef HAVE_SYS_INOTIFY_H
-	splay_tree *wds;  /* indexed by inotify watch descriptor */
+	hmap wds;  /* indexed by inotify watch descriptor */
   #elif defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE
   #else
 	FAMConnection fam;
@@ -278,85 +319,71 @@ static void fam_dir_invalidate_node(fam_dir_entry *fam_dir)
 }
 
 /*
- * walk though splay_tree and collect contents of dir tree.
- * remove tagged entries in a second loop
+ * walk though hash map and remove entries no longer referenced
  */
 
-static void fam_dir_tag_refcnt(splay_tree *t, int *keys, int *ndx)
-{
-    if (*ndx == 512) return; /*(must match num array entries in keys[])*/
-    if (t->left)  fam_dir_tag_refcnt(t->left,  keys, ndx);
-    if (t->right) fam_dir_tag_refcnt(t->right, keys, ndx);
-    if (*ndx == 512) return; /*(must match num array entries in keys[])*/
-
-    fam_dir_entry * const fam_dir = t->data;
-    if (0 == fam_dir->refcnt) {
-        fam_dir_invalidate_node(fam_dir);
-        keys[(*ndx)++] = t->key;
-    }
-}
-
 __attribute_noinline__
 static void fam_dir_periodic_cleanup(void) {
     stat_cache_fam * const scf = sc.scf;
-    int max_ndx, i;
-    int keys[512]; /* 2k size on stack */
+    hmap * const dirs = &scf->dirs;
   #if defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE
     struct kevent kevl[512]; /* 32k size on stack to batch kevent EV_DELETE */
+    struct timespec t0 = { 0, 0 };
+    int n = 0;
   #endif
-    do {
-        if (!scf->dirs) break;
-        max_ndx = 0;
-        fam_dir_tag_refcnt(scf->dirs, keys, &max_ndx);
-        for (i = 0; i < max_ndx; ++i) {
-            {
-                scf->dirs = splaytree_splay_nonnull(scf->dirs, keys[i]);
-                fam_dir_entry *fam_dir = scf->dirs->data;
-                scf->dirs = splaytree_delete_splayed_node(scf->dirs);
-              #ifdef HAVE_SYS_INOTIFY_H
-                scf->wds = splaytree_delete(scf->wds, fam_dir->req);
-              #elif defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE
-                /* batch process kevent removal; defer cancel */
-                EV_SET(kevl+i, fam_dir->req, EVFILT_VNODE, EV_DELETE, 0, 0, 0);
-                fam_dir->req = -1; /*(make FAMCancelMonitor() a no-op)*/
-              #endif
-                FAMCancelMonitor(&scf->fam, &fam_dir->req);
-                fam_dir_entry_free(fam_dir);
-            }
+    for (uint32_t i = 0; i < hmap_slots(dirs); ) {
+        fam_dir_entry * const fam_dir = dirs->slots[i].data;
+        if (NULL == fam_dir || 0 != fam_dir->refcnt) {
+            ++i;
+            continue;
         }
+        fam_dir_invalidate_node(fam_dir);
+        hmap_remove_at(dirs, i); /*(examine slot i again)*/
+      #ifdef HAVE_SYS_INOTIFY_H
+        hmap_remove(&scf->wds, (uint32_t)fam_dir->req);
+      #elif defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE
+        /* batch process kevent removal; defer cancel */
+        EV_SET(kevl+n, fam_dir->req, EVFILT_VNODE, EV_DELETE, 0, 0, 0);
+        fam_dir->req = -1; /*(make FAMCancelMonitor() a no-op)*/
+      #endif
+        FAMCancelMonitor(&scf->fam, &fam_dir->req);
+        fam_dir_entry_free(fam_dir);
       #if defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE
+        if (++n < (int)(sizeof(kevl)/sizeof(*kevl))) continue;
         /* batch process: kevent() to submit EV_DELETE, then close dir fds */
-        if (0 == max_ndx) break;
-        struct timespec t0 = { 0, 0 };
-        kevent(scf->fd, kevl, max_ndx, NULL, 0, &t0);
-        for (i = 0; i < max_ndx; ++i)
-            close((int)kevl[i].ident);
+        kevent(scf->fd, kevl, n, NULL, 0, &t0);
+        for (int j = 0; j < n; ++j)
+            close((int)kevl[j].ident);
+        n = 0;
       #endif
-    } while (max_ndx == sizeof(keys)/sizeof(int));
+    }
+  #if defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE
+    if (0 == n) return;
+    kevent(scf->fd, kevl, n, NULL, 0, &t0);
+    for (int j = 0; j < n; ++j)
+        close((int)kevl[j].ident);
+  #endif
 }
 
-static void fam_dir_invalidate_tree(splay_tree *t, const char *name, size_t len)
+static void fam_dir_invalidate_tree(const hmap * const dirs, const char *name, size_t len)
 {
   #ifdef __clang_analyzer__
     force_assert(name);
   #endif
-    /*force_assert(t);*/
-    if (t->left)  fam_dir_invalidate_tree(t->left,  name, len);
-    if (t->right) fam_dir_invalidate_tree(t->right, name, len);
-
-    fam_dir_entry * const fam_dir = t->data;
-  #ifdef __clang_analyzer__
-    force_assert(fam_dir);
-  #endif
-    const buffer * const b = &fam_dir->name;
-    size_t blen = buffer_clen(b);
-    if (blen > len && b->ptr[len] == '/' && 0 == memcmp(b->ptr, name, len))
-        fam_dir_invalidate_node(fam_dir);
+    for (uint32_t i = 0, used = hmap_slots(dirs); i < used; ++i) {
+        fam_dir_entry * const fam_dir = dirs->slots[i].data;
+        if (NULL == fam_dir) continue;
+        const buffer * const b = &fam_dir->name;
+        size_t blen = buffer_clen(b);
+        if (blen > len && b->ptr[len] == '/' && 0 == memcmp(b->ptr, name, len))
+            fam_dir_invalidate_node(fam_dir);
+    }
 }
 
 /* declarations */
 static void stat_cache_delete_tree(const char *name, uint32_t len);
 static void stat_cache_invalidate_dir_tree(const char *name, size_t len);
+static void stat_cache_prefetch_dir(fam_dir_entry *fam_dir);
 static void stat_cache_handle_fdevent_fn(stat_cache_fam * const scf, fam_dir_entry * const fam_dir, const char * const fn, const uint32_t fnlen, int code);
 
 static void stat_cache_handle_fdevent_in(stat_cache_fam *scf)
@@ -382,8 +409,6 @@ static void stat_cache_handle_fdevent_in(stat_cache_fam *scf)
             if (len > sizeof(buf)) break; /*(should not happen)*/
             i += sizeof(struct inotify_event) + len;
             if (i > rd) break; /*(should not happen (partial record))*/
-            if (in->mask & IN_CREATE)
-                continue; /*(see comment below for FAMCreated)*/
             if (in->mask & IN_Q_OVERFLOW) {
                 log_error(scf->errh, __FILE__, __LINE__,
                           "inotify queue overflow");
@@ -391,17 +416,16 @@ static void stat_cache_handle_fdevent_in(stat_cache_fam *scf)
             }
             /* ignore events which may have been pending for
              * paths recently cancelled via FAMCancelMonitor() */
-            scf->wds = splaytree_splay(scf->wds, in->wd);
-            if (!scf->wds || scf->wds->key != in->wd)
-                continue;
-            fam_dir_entry *fam_dir = scf->wds->data;
-            if (NULL == fam_dir)        /*(should not happen)*/
+            fam_dir_entry *fam_dir = hmap_find(&scf->wds, (uint32_t)in->wd);
+            if (NULL == fam_dir)
                 continue;
             if (fam_dir->req != in->wd) /*(should not happen)*/
                 continue;
             /*(specific to use here in stat_cache.c)*/
             int code = 0;
-            if (in->mask & (IN_ATTRIB | IN_MODIFY))
+            if (in->mask & (IN_CREATE | IN_MOVED_TO))
+                code = FAMCreated; /*(see comment below for FAMCreated)*/
+            else if (in->mask & (IN_ATTRIB | IN_MODIFY))
                 code = FAMChanged;
             else if (in->mask & (IN_DELETE | IN_DELETE_SELF | IN_UNMOUNT))
                 code = FAMDeleted;
@@ -425,11 +449,10 @@ static void stat_cache_handle_fdevent_in(stat_cache_fam *scf)
             const struct kevent * const kev = kevl+i;
             /* ignore events which may have been pending for
              * paths recently cancelled via FAMCancelMonitor() */
-            int ndx = (int)(intptr_t)kev->udata;
-            scf->dirs = splaytree_splay(scf->dirs, ndx);
-            if (!scf->dirs || scf->dirs->key != ndx)
+            const uint32_t ndx = (uint32_t)(uintptr_t)kev->udata;
+            fam_dir_entry *fam_dir = hmap_find(&scf->dirs, ndx);
+            if (NULL == fam_dir)
                 continue;
-            fam_dir_entry *fam_dir = scf->dirs->data;
             if (fam_dir->req != (int)kev->ident)
                 continue;
             /*(specific to use here in stat_cache.c)*/
@@ -452,18 +475,17 @@ static void stat_cache_handle_fdevent_in(stat_cache_fam *scf)
         }
     } while (n == sizeof(kevl)/sizeof(*kevl));
   #else
-    for (int i = 0, ndx; i || (i = FAMPending(&scf->fam)) > 0; --i) {
+    for (int i = 0; i || (i = FAMPending(&scf->fam)) > 0; --i) {
         FAMEvent fe;
         if (FAMNextEvent(&scf->fam, &fe) < 0) break;
 
         /* ignore events which may have been pending for
          * paths recently cancelled via FAMCancelMonitor() */
-        ndx = (int)(intptr_t)fe.userdata;
-        scf->dirs = splaytree_splay(scf->dirs, ndx);
-        if (!scf->dirs || scf->dirs->key != ndx) {
+        const uint32_t ndx = (uint32_t)(uintptr_t)fe.userdata;
+        fam_dir_entry *fam_dir = hmap_find(&scf->dirs, ndx);
+        if (NULL == fam_dir) {
             continue;
         }
-        fam_dir_entry *fam_dir = scf->dirs->data;
         if (FAMREQUEST_GETREQNUM(&fam_dir->req)
             != FAMREQUEST_GETREQNUM(&fe.fr)) {
             continue;
@@ -487,11 +509,17 @@ static void stat_cache_handle_fdevent_fn(stat_cache_fam * const scf, fam_dir_ent
             case FAMCreated:
                 /* file created in monitored dir modifies dir and
                  * we should get a separate FAMChanged event for dir.
-                 * Therefore, ignore file FAMCreated event here.
-                 * Also, if FAMNoExists() is used, might get spurious
-                 * FAMCreated events as changes are made e.g. in monitored
-                 * sub-sub-sub dirs and the library discovers new (already
-                 * existing) dir entries */
+                 * (FAM does not pass filename for FAMCreated; see above,
+                 *  since if FAMNoExists() is used, might get spurious
+                 *  FAMCreated events as changes are made e.g. in monitored
+                 *  sub-sub-sub dirs and the library discovers new (already
+                 *  existing) dir entries)
+                 * inotify reports name of file created or moved into dir;
+                 * invalidate (negative) stat_cache entry (if any) */
+                len = buffer_clen(n);
+                buffer_append_path_len(n, fn, fnlen);
+                stat_cache_invalidate_entry(BUF_PTR_LEN(n));
+                buffer_truncate(n, len);
                 return;
             case FAMChanged:
                 /* file changed in monitored dir does not modify dir */
@@ -508,7 +536,7 @@ static void stat_cache_handle_fdevent_fn(stat_cache_fam * const scf, fam_dir_ent
                 stat_cache_invalidate_entry(BUF_PTR_LEN(n));
 
                 fam_link = /*(check if might be symlink to monitored dir)*/
-                stat_cache_sptree_find(&scf->dirs, BUF_PTR_LEN(n));
+                stat_cache_hmap_find(&scf->dirs, BUF_PTR_LEN(n));
                 if (fam_link && !buffer_is_equal(&fam_link->name, n))
                     fam_link = NULL;
 
@@ -536,9 +564,7 @@ static void stat_cache_handle_fdevent_fn(stat_cache_fam * const scf, fam_dir_ent
         case FAMMoved:
             stat_cache_delete_tree(BUF_PTR_LEN(&fam_dir->name));
             fam_dir_invalidate_node(fam_dir);
-            if (scf->dirs)
-                fam_dir_invalidate_tree(scf->dirs,
-                                        BUF_PTR_LEN(&fam_dir->name));
+            fam_dir_invalidate_tree(&scf->dirs, BUF_PTR_LEN(&fam_dir->name));
             fam_dir_periodic_cleanup();
             break;
         default:
@@ -637,19 +663,18 @@ static void stat_cache_free_fam(stat_cache_fam *scf) {
 	if (NULL == scf) return;
 
       #ifdef HAVE_SYS_INOTIFY_H
-	while (scf->wds) {
-		scf->wds = splaytree_delete_splayed_node(scf->wds);
-	}
+	hmap_free(&scf->wds);
       #elif defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE
 	/*(quicker cleanup to close kqueue() before cancel per entry)*/
 	close(scf->fd);
 	scf->fd = -1;
       #endif
-	while (scf->dirs) {
+	for (uint32_t i = 0, used = hmap_slots(&scf->dirs); i < used; ++i) {
 		/*(skip entry invalidation and FAMCancelMonitor())*/
-		fam_dir_entry_free((fam_dir_entry *)scf->dirs->data);
-		scf->dirs = splaytree_delete_splayed_node(scf->dirs);
+		if (scf->dirs.slots[i].data)
+			fam_dir_entry_free((fam_dir_entry *)scf->dirs.slots[i].data);
 	}
+	hmap_free(&scf->dirs);
 
 	if (-1 != scf->fd) {
 		/*scf->fdn already cleaned up in fdevent_free()*/
@@ -676,9 +701,9 @@ static fam_dir_entry * fam_dir_monitor(stat_cache_fam *scf, char *fn, uint32_t d
         while (fn[--dirlen] != '/') ;
         if (0 == dirlen) dirlen = 1; /*(should not happen for file)*/
     }
-    int dir_ndx;
+    uint32_t dir_ndx;
     fam_dir_entry *fam_dir =
-      stat_cache_sptree_ndx(&scf->dirs, &dir_ndx, fn, dirlen);
+      stat_cache_hmap_ndx(&scf->dirs, &dir_ndx, fn, dirlen);
 
     if (NULL != fam_dir) {
         if (!buffer_eq_slen(&fam_dir->name, fn, dirlen)) {
@@ -716,27 +741,25 @@ static fam_dir_entry * fam_dir_monitor(stat_cache_fam *scf, char *fn, uint32_t d
          * not being monitored occurs (e.g. rename of unmonitored parent dir)*/
         if (st->st_dev != fam_dir->st_dev || st->st_ino != fam_dir->st_ino) {
             ck_lnk = 1;
-            /*(modifies scf->dirs but no need to re-splay for dir_ndx since
-             * fam_dir is not NULL and so splaytree_insert not called below)*/
-            if (scf->dirs) fam_dir_invalidate_tree(scf->dirs, fn, dirlen);
+            fam_dir_invalidate_tree(&scf->dirs, fn, dirlen);
             if (!fn_is_dir) /*(if dir, caller is updating stat_cache_entry)*/
                 stat_cache_update_entry(fn, dirlen, st, NULL);
             /*(must not delete tree since caller is holding a valid node)*/
             stat_cache_invalidate_dir_tree(fn, dirlen);
           #ifdef HAVE_SYS_INOTIFY_H
-            scf->wds = splaytree_delete(scf->wds, fam_dir->req);
+            hmap_remove(&scf->wds, (uint32_t)fam_dir->req);
           #endif
             if (0 != FAMCancelMonitor(&scf->fam, &fam_dir->req)
                 || 0 != FAMMonitorDirectory(&scf->fam, fam_dir->name.ptr,
                                             &fam_dir->req,
-                                            (void *)(intptr_t)dir_ndx)) {
+                                            (void *)(uintptr_t)dir_ndx)) {
                 fam_dir->stat_ts = 0; /* invalidate */
                 return NULL;
             }
             fam_dir->st_dev = st->st_dev;
             fam_dir->st_ino = st->st_ino;
           #ifdef HAVE_SYS_INOTIFY_H
-            scf->wds = splaytree_insert_splayed(scf->wds,fam_dir->req,fam_dir);
+            hmap_insert(&scf->wds, (uint32_t)fam_dir->req, fam_dir);
           #endif
         }
         fam_dir->stat_ts = cur_ts;
@@ -746,7 +769,7 @@ static fam_dir_entry * fam_dir_monitor(stat_cache_fam *scf, char *fn, uint32_t d
         fam_dir = fam_dir_entry_init(fn, dirlen);
 
         if (0 != FAMMonitorDirectory(&scf->fam,fam_dir->name.ptr,&fam_dir->req,
-                                     (void *)(intptr_t)dir_ndx)) {
+                                     (void *)(uintptr_t)dir_ndx)) {
           #if defined(HAVE_SYS_INOTIFY_H) \
            || (defined HAVE_SYS_EVENT_H && defined HAVE_KQUEUE)
             log_perror(scf->errh, __FILE__, __LINE__,
@@ -761,13 +784,17 @@ static fam_dir_entry * fam_dir_monitor(stat_cache_fam *scf, char *fn, uint32_t d
             return NULL;
         }
 
-        scf->dirs = splaytree_insert_splayed(scf->dirs, dir_ndx, fam_dir);
+        hmap_insert(&scf->dirs, dir_ndx, fam_dir);
       #ifdef HAVE_SYS_INOTIFY_H
-        scf->wds = splaytree_insert(scf->wds, fam_dir->req, fam_dir);
+        /*(inotify returns existing wd if dir (inode) is already monitored)*/
+        if (NULL == hmap_find(&scf->wds, (uint32_t)fam_dir->req))
+            hmap_insert(&scf->wds, (uint32_t)fam_dir->req, fam_dir);
       #endif
         fam_dir->stat_ts= cur_ts;
         fam_dir->st_dev = st->st_dev;
         fam_dir->st_ino = st->st_ino;
+        if (sc.prefetch_max)
+            stat_cache_prefetch_dir(fam_dir);
     }
 
     if (ck_lnk) {
@@ -797,6 +824,221 @@ static fam_dir_entry * fam_dir_monitor(stat_cache_fam *scf, char *fn, uint32_t d
 #endif
 
 
+#ifdef STAT_CACHE_SHM
+
+/* shared-memory stat cache (optional; server.max-worker > 1)
+ *
+ * Segment is created before workers are forked and is a direct-mapped table
+ * of stat() results indexed by path hash (same hash as sc.files).  A worker
+ * checks the table before calling stat(), and publishes the result after
+ * calling stat().  Each entry is protected by a seqlock: readers retry never,
+ * and use the entry only if sequence number is even and unchanged after copy.
+ * A writer takes the entry by atomically incrementing sequence to odd value;
+ * if another writer holds the entry, publishing is skipped (best effort).
+ *
+ * Entries are used if stat() was performed in the current second (as with
+ * server.stat-cache-engine = "simple").  With server.stat-cache-engine
+ * "inotify", "kqueue", or "fam", only one worker (worker 0) monitors dirs
+ * (single owner of inotify watches), and marks shared entries as monitored.
+ * Owner periodically scans the table and begins monitoring dirs of entries
+ * published by other workers.  Other workers use monitored entries for up
+ * to 16 seconds (same as owner), and owner invalidates shared entries upon
+ * receiving change events.  (Owner stops monitoring dirs only after its own
+ * entries have aged beyond 32 seconds, by which time the shared entries it
+ * published have already aged beyond 16 seconds.)
+ */
+
+#define STAT_CACHE_SHM_MONITORED 0x1
+
+typedef struct stat_cache_shm_entry {
+    uint32_t seq;          /* seqlock; odd while entry is being modified */
+    uint32_t hash;
+    uint32_t len;          /* 0 if entry is empty */
+    uint32_t flags;
+    unix_time64_t stat_ts;
+    struct stat st;
+    char name[512 - 24 - sizeof(struct stat)];
+} stat_cache_shm_entry;
+
+static int stat_cache_shm_lock (stat_cache_shm_entry * const e, uint32_t * const seq, int spin)
+{
+    do {
+        uint32_t v = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+        if (!(v & 1)
+            && __atomic_compare_exchange_n(&e->seq, &v, v+1, 0,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            *seq = v;
+            return 1;
+        }
+    } while (--spin > 0);
+    return 0;
+}
+
+static void stat_cache_shm_unlock (stat_cache_shm_entry * const e, const uint32_t seq)
+{
+    __atomic_store_n(&e->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+static int stat_cache_shm_get (const char * const name, const uint32_t len, const uint32_t hash, struct stat * const st)
+{
+    if (len >= sizeof(sc.shm->name)) return 0;
+    const stat_cache_shm_entry * const e = sc.shm + (hash & sc.shm_mask);
+    const uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) || e->hash != hash || e->len != len) return 0;
+    const unix_time64_t stat_ts = e->stat_ts;
+    const uint32_t flags = e->flags;
+    *st = e->st;
+    const int eq = (0 == memcmp(e->name, name, len));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq || !eq) return 0;
+
+    const unix_time64_t cur_ts = log_monotonic_secs;
+    return stat_ts == cur_ts
+        || ((flags & STAT_CACHE_SHM_MONITORED) && sc.shm_fam
+            && cur_ts - stat_ts < 16);
+}
+
+static void stat_cache_shm_put (const char * const name, const uint32_t len, const uint32_t hash, const struct stat * const st, const unix_time64_t stat_ts, const uint32_t flags)
+{
+    if (len >= sizeof(sc.shm->name)) return;
+    stat_cache_shm_entry * const e = sc.shm + (hash & sc.shm_mask);
+    uint32_t seq;
+    if (!stat_cache_shm_lock(e, &seq, 1)) return; /*(skip if busy)*/
+    e->hash = hash;
+    e->len = len;
+    e->flags = flags;
+    e->stat_ts = stat_ts;
+    e->st = *st;
+    memcpy(e->name, name, len);
+    stat_cache_shm_unlock(e, seq);
+}
+
+static void stat_cache_shm_clear (stat_cache_shm_entry * const e)
+{
+    uint32_t seq;
+    if (!stat_cache_shm_lock(e, &seq, 1024)) return; /*(should not happen)*/
+    e->len = 0;
+    e->flags = 0;
+    stat_cache_shm_unlock(e, seq);
+}
+
+static void stat_cache_shm_invalidate (const char * const name, const uint32_t len, const uint32_t hash)
+{
+    if (len >= sizeof(sc.shm->name)) return;
+    stat_cache_shm_entry * const e = sc.shm + (hash & sc.shm_mask);
+    /*(check without lock; entry cleared even if concurrently replaced)*/
+    if (e->len == len && e->hash == hash && 0 == memcmp(e->name, name, len))
+        stat_cache_shm_clear(e);
+}
+
+__attribute_noinline__
+static void stat_cache_shm_invalidate_tree (const char * const name, const uint32_t len)
+{
+    /* invalidate entries in dir tree (walk entire table; infrequent) */
+    stat_cache_shm_entry * const shm = sc.shm;
+    for (uint32_t i = 0; i <= sc.shm_mask; ++i) {
+        stat_cache_shm_entry * const e = shm+i;
+        const uint32_t elen = e->len;
+        if (elen > len && elen < sizeof(e->name) && e->name[len] == '/'
+            && 0 == memcmp(e->name, name, len))
+            stat_cache_shm_clear(e);
+    }
+}
+
+__attribute_noinline__
+static void stat_cache_shm_monitor (void)
+{
+    /* (owner) monitor dirs of entries published by other workers
+     * (scan portion of table each second) */
+    buffer * const b = buffer_init();
+    const unix_time64_t cur_ts = log_monotonic_secs;
+    uint32_t i = sc.shm_scan, n = sc.shm_mask < 8191 ? sc.shm_mask+1 : 8192;
+    for (uint32_t m = 0; n; --n, i = (i+1) & sc.shm_mask) {
+        stat_cache_shm_entry * const e = sc.shm+i;
+        const uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        const uint32_t len = e->len;
+        if ((seq & 1) || 0 == len || len >= sizeof(e->name)
+            || (e->flags & STAT_CACHE_SHM_MONITORED)
+            || cur_ts - e->stat_ts >= 16)
+            continue;
+        buffer_copy_string_len(b, e->name, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+      #ifdef HAVE_FAM_H
+        const stat_cache_entry * const sce = stat_cache_get_entry(b);
+        if (sce && sce->fam_dir)
+            stat_cache_shm_put(b->ptr, len, e->hash, &sce->st, sce->stat_ts,
+                               STAT_CACHE_SHM_MONITORED);
+      #endif
+        if (++m == 1024) break; /*(limit num dirs newly monitored per scan)*/
+    }
+    sc.shm_scan = i;
+    buffer_free(b);
+}
+
+#endif /* STAT_CACHE_SHM */
+
+__attribute_cold__
+void stat_cache_shm_init (uint32_t nentries, log_error_st * const errh)
+{
+  #ifdef STAT_CACHE_SHM
+    if (sc.stat_cache_engine == STAT_CACHE_ENGINE_NONE) return;
+    if (sc.shm) return;
+    uint32_t n = 64;
+    if (nentries > (1u << 20)) nentries = 1u << 20;
+    while (n < nentries) n <<= 1;
+    const size_t sz = n * sizeof(stat_cache_shm_entry);
+    void * const ptr =
+      mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == ptr) {
+        log_perror(errh, __FILE__, __LINE__,
+          "mmap() shared stat cache; stat cache will be per-worker");
+        return;
+    }
+    sc.shm = ptr; /*(zero-initialized)*/
+    sc.shm_mask = n - 1;
+  #else
+    UNUSED(nentries);
+    UNUSED(errh);
+  #endif
+}
+
+__attribute_cold__
+void stat_cache_shm_worker (int worker)
+{
+  #ifdef STAT_CACHE_SHM
+    if (NULL == sc.shm) return;
+    sc.shm_scan = 0;
+    sc.shm_owner = 0;
+    sc.shm_fam = 0;
+   #ifdef HAVE_FAM_H
+    if (sc.stat_cache_engine == STAT_CACHE_ENGINE_FAM) {
+        /* only one worker monitors dirs; others use simple engine and
+         * rely on owner to invalidate shared entries */
+        sc.shm_fam = 1;
+        if (0 == worker)
+            sc.shm_owner = 1;
+        else
+            sc.stat_cache_engine = STAT_CACHE_ENGINE_SIMPLE;
+    }
+   #endif
+  #endif
+    UNUSED(worker);
+}
+
+
+static void stat_cache_entry_close_fd(stat_cache_entry * const sce) {
+    close(sce->fd);
+    sce->fd = -1;
+    if (sce->fd_counted) { /*(fd held open by pre-warm)*/
+        sce->fd_counted = 0;
+        --sc.prewarm_nfds;
+        if (sc.cur_fds) --*sc.cur_fds;
+    }
+}
+
 __attribute_malloc__
 __attribute_noinline__
 __attribute_returns_nonnull__
@@ -807,12 +1049,73 @@ static stat_cache_entry * stat_cache_entry_init(void) {
     return sce;
 }
 
+#ifdef HAVE_FAM_H
+__attribute_cold__
+__attribute_noinline__
+static void stat_cache_prefetch_dir(fam_dir_entry * const fam_dir) {
+    /* stat() files in newly monitored dir in one pass, since requests for
+     * other files in same dir often follow (e.g. image gallery, dir listing).
+     * Entries are fresh while dir is monitored, so these are answered from
+     * stat_cache.  fstatat() relative to dir fd avoids path resolution of
+     * full path for each file.  Symlinks are skipped; the target might be
+     * in a dir which is not monitored, so symlinks are left to be stat()
+     * upon request (stat_cache_refresh_entry()). */
+  #ifndef _WIN32
+    buffer * const n = &fam_dir->name;
+    DIR * const dp = opendir(n->ptr);
+    if (NULL == dp) return;
+   #ifdef _ATFILE_SOURCE
+    const int dfd = dirfd(dp);
+   #endif
+    const uint32_t len = buffer_clen(n);
+    const unix_time64_t cur_ts = log_monotonic_secs;
+    struct dirent *dent;
+    for (uint32_t i = 0; i < sc.prefetch_max && (dent = readdir(dp)); ) {
+        const char * const d_name = dent->d_name;
+        if (d_name[0] == '.'
+            && (d_name[1] == '\0' || (d_name[1] == '.' && d_name[2] == '\0')))
+            continue;
+      #ifdef _DIRENT_HAVE_D_TYPE
+        if (dent->d_type != DT_REG && dent->d_type != DT_UNKNOWN)
+            continue;
+      #endif
+        ++i;
+        buffer_append_path_len(n, d_name, _D_EXACT_NAMLEN(dent));
+        uint32_t ndx;
+        struct stat st;
+        if (NULL == stat_cache_hmap_ndx(&sc.files, &ndx, BUF_PTR_LEN(n))
+          #ifdef _ATFILE_SOURCE
+            /*(do not follow symlinks; S_ISREG() false for symlinks)*/
+            && 0 == fstatat(dfd, d_name, &st, AT_SYMLINK_NOFOLLOW)
+          #else
+            && 0 == lstat(n->ptr, &st)
+          #endif
+            && S_ISREG(st.st_mode)) {
+            stat_cache_entry * const sce = stat_cache_entry_init();
+            buffer_copy_string_len(&sce->name, BUF_PTR_LEN(n));
+            sce->st = st;
+            sce->stat_ts = cur_ts;
+            sce->fam_dir = fam_dir;
+            ++fam_dir->refcnt;
+            hmap_insert(&sc.files, ndx, sce);
+        }
+        buffer_truncate(n, len);
+    }
+    closedir(dp);
+  #else
+    UNUSED(fam_dir);
+  #endif
+}
+#endif
+
 static void stat_cache_entry_free(void *data) {
     stat_cache_entry *sce = data;
     if (!sce) return;
 
     if (--sce->refcnt) return;
 
+    if (sce->neg_errno) --sc.neg_used;
+
   #ifdef HAVE_FAM_H
     /*(decrement refcnt only;
      * defer cancelling FAM monitor on dir even if refcnt reaches zero)*/
@@ -822,7 +1125,7 @@ static void stat_cache_entry_free(void *data) {
     free(sce->name.ptr);
     free(sce->etag.ptr);
     if (sce->content_type.size) free(sce->content_type.ptr);
-    if (sce->fd >= 0) close(sce->fd);
+    if (sce->fd >= 0) stat_cache_entry_close_fd(sce);
 
     free(sce);
 }
@@ -836,11 +1139,6 @@ void stat_cache_entry_refchg(void *data, int mod) {
         sce->refcnt += mod;
 }
 
-__attribute_nonnull__()
-static splay_tree * stat_cache_sptree_node_free(splay_tree *sptree) {
-    stat_cache_entry_free(sptree->data);
-    return splaytree_delete_splayed_node(sptree);
-}
 
 #if defined(HAVE_XATTR) || defined(HAVE_EXTATTR)
 
@@ -878,7 +1176,153 @@ static int stat_cache_attr_get(const char *name) {
 
 #endif
 
-int stat_cache_init(fdevents *ev, log_error_st *errh) {
+void stat_cache_negative_max(const uint32_t n) {
+    sc.neg_max = n;
+}
+
+void stat_cache_prefetch_max(const uint32_t n) {
+    sc.prefetch_max = n;
+}
+
+void stat_cache_prewarm_paths(const array * const a) {
+    sc.prewarm = a;
+}
+
+void stat_cache_prewarm_config(const array * const mimetypes, const int etag_flags, const int use_xattr, const uint32_t max, const uint32_t nfds) {
+    sc.prewarm_mimetypes = mimetypes;
+    sc.prewarm_etag_flags = etag_flags;
+    sc.prewarm_use_xattr = use_xattr;
+    sc.prewarm_max = max;
+    sc.prewarm_fds = nfds;
+}
+
+/* pre-warmed entries are not expired by stat_cache_periodic_cleanup() for
+ * this long after startup, unless refreshed (and then aged as usual) */
+#define STAT_CACHE_PREWARM_KEEP 300
+
+__attribute_cold__
+static const stat_cache_entry * stat_cache_prewarm_entry(buffer * const b, uint32_t * const n) {
+    stat_cache_entry * const sce = stat_cache_get_entry(b);
+    if (NULL == sce) return NULL;
+    if (!S_ISREG(sce->st.st_mode)) {
+        ++*n;
+        return sce;
+    }
+    if ((*n)++ < sc.prewarm_fds && sce->fd < 0) {
+        stat_cache_get_entry_open(b, 1); /*(hold fd open in sce->fd)*/
+        if (sce->fd >= 0) {
+            sce->fd_counted = 1;
+            ++sc.prewarm_nfds;
+            if (sc.cur_fds) ++*sc.cur_fds;
+        }
+    }
+    stat_cache_etag_get(sce, sc.prewarm_etag_flags);
+  #if defined(HAVE_XATTR) || defined(HAVE_EXTATTR)
+    stat_cache_content_type_get_by_xattr(sce, sc.prewarm_mimetypes,
+                                         sc.prewarm_use_xattr);
+  #else
+    stat_cache_content_type_get_by_ext(sce, sc.prewarm_mimetypes);
+  #endif
+    return sce;
+}
+
+#ifndef _WIN32
+__attribute_cold__
+static void stat_cache_prewarm_dir(buffer * const b, uint32_t * const n, const int depth) {
+    DIR * const dp = opendir(b->ptr);
+    if (NULL == dp) return;
+    const uint32_t blen = buffer_clen(b);
+    struct dirent *dent;
+    while (*n < sc.prewarm_max && NULL != (dent = readdir(dp))) {
+        const char * const d_name = dent->d_name;
+        if (d_name[0] == '.'
+            && (d_name[1] == '\0' || (d_name[1] == '.' && d_name[2] == '\0')))
+            continue;
+        buffer_append_path_len(b, d_name, _D_EXACT_NAMLEN(dent));
+        const stat_cache_entry * const sce = stat_cache_prewarm_entry(b, n);
+        if (sce && S_ISDIR(sce->st.st_mode) && depth < 32
+          #ifdef _DIRENT_HAVE_D_TYPE
+            && dent->d_type != DT_LNK /*(do not follow symlinks to dirs)*/
+          #endif
+           )
+            stat_cache_prewarm_dir(b, n, depth+1);
+        buffer_truncate(b, blen);
+    }
+    closedir(dp);
+}
+#endif
+
+__attribute_cold__
+static void stat_cache_prewarm_manifest(buffer * const b, uint32_t * const n, log_error_st * const errh) {
+    /* manifest: one absolute path per line (hottest first);
+     * blank lines and lines beginning with '#' are ignored */
+    off_t dlen = 256*1024*1024; /*(arbitrary limit: 256 MB)*/
+    char * const data = fdevent_load_file(b->ptr, &dlen, errh, malloc, free);
+    if (NULL == data) return;
+    for (char *s = data, *e; *s && *n < sc.prewarm_max; s = e) {
+        e = strchr(s, '\n');
+        const uint32_t len = e ? (uint32_t)(e - s) : (uint32_t)strlen(s);
+        e = e ? e+1 : s+len;
+        if (0 == len || s[0] != '/') continue; /*(includes '#' comments)*/
+        buffer_copy_string_len(b, s, len);
+        if (b->ptr[len-1] == '\r') buffer_truncate(b, len-1);
+        stat_cache_prewarm_entry(b, n);
+    }
+    free(data);
+}
+
+__attribute_cold__
+void stat_cache_prewarm(log_error_st * const errh) {
+    /* called before fork() of workers (if server.max-worker), and then from
+     * stat_cache_init(); pre-warm once, inherited by workers
+     * (deferred to stat_cache_init() in each worker if FAM, since FAM watches
+     *  are per-process) */
+    if (NULL == sc.prewarm || sc.prewarm_ts) return;
+    if (sc.stat_cache_engine == STAT_CACHE_ENGINE_NONE) return;
+  #ifdef HAVE_FAM_H
+    if (sc.stat_cache_engine == STAT_CACHE_ENGINE_FAM && NULL == sc.scf)
+        return;
+  #endif
+    buffer * const b = buffer_init();
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < sc.prewarm->used && n < sc.prewarm_max; ++i) {
+        const data_string * const ds = (const data_string *)sc.prewarm->data[i];
+        if (buffer_is_blank(&ds->value)) continue;
+        buffer_copy_buffer(b, &ds->value);
+        if (b->ptr[0] != '/') {
+            log_error(errh, __FILE__, __LINE__,
+              "server.stat-cache-prewarm path must be absolute: %s", b->ptr);
+            continue;
+        }
+        const stat_cache_st * const st = stat_cache_path_stat(b);
+        if (NULL == st) {
+            log_perror(errh, __FILE__, __LINE__,
+              "server.stat-cache-prewarm %s", b->ptr);
+            continue;
+        }
+        if (S_ISREG(st->st_mode))
+            stat_cache_prewarm_manifest(b, &n, errh);
+      #ifndef _WIN32
+        else if (S_ISDIR(st->st_mode)) {
+            if (buffer_clen(b) > 1 && b->ptr[buffer_clen(b)-1] == '/')
+                buffer_truncate(b, buffer_clen(b)-1);
+            stat_cache_prewarm_dir(b, &n, 0);
+        }
+      #endif
+    }
+    buffer_free(b);
+    sc.prewarm_n = n;
+    sc.prewarm_ts = log_monotonic_secs;
+}
+
+void stat_cache_prewarm_stats(uint32_t * const entries, uint32_t * const fds) {
+    *entries = sc.prewarm_n;
+    *fds = sc.prewarm_nfds;
+}
+
+int stat_cache_init(fdevents *ev, int * const cur_fds, log_error_st *errh) {
+    sc.cur_fds = cur_fds;
+
   #ifdef HAVE_FAM_H
     if (sc.stat_cache_engine == STAT_CACHE_ENGINE_FAM) {
         sc.scf = stat_cache_init_fam(ev, errh);
@@ -886,28 +1330,48 @@ int stat_cache_init(fdevents *ev, log_error_st *errh) {
     }
   #else
     UNUSED(ev);
-    UNUSED(errh);
   #endif
 
+    stat_cache_prewarm(errh);
+
     return 1;
 }
 
 void stat_cache_free(void) {
-    splay_tree *sptree = sc.files;
-    while (sptree) {
-        sptree = stat_cache_sptree_node_free(sptree);
+    sc.cur_fds = NULL; /*(srv->cur_fds is not adjusted upon free)*/
+    hmap * const files = &sc.files;
+    for (uint32_t i = 0, used = hmap_slots(files); i < used; ++i) {
+        if (files->slots[i].data)
+            stat_cache_entry_free(files->slots[i].data);
     }
-    sc.files = NULL;
+    hmap_free(files);
 
   #ifdef HAVE_FAM_H
     stat_cache_free_fam(sc.scf);
     sc.scf = NULL;
   #endif
 
+    /*(arrays are owned by config; reset for (possible) graceful restart)*/
+    sc.prewarm = NULL;
+    sc.prewarm_mimetypes = NULL;
+    sc.prewarm_n = 0;
+    sc.prewarm_nfds = 0;
+    sc.prewarm_ts = 0;
+
   #if defined(HAVE_XATTR) || defined(HAVE_EXTATTR)
     attrname = "Content-Type";
   #endif
 
+  #ifdef STAT_CACHE_SHM
+    if (sc.shm) {
+        munmap(sc.shm, (sc.shm_mask+1) * sizeof(stat_cache_shm_entry));
+        sc.shm = NULL;
+        sc.shm_mask = 0;
+        sc.shm_owner = 0;
+        sc.shm_fam = 0;
+    }
+  #endif
+
     sc.stat_cache_engine = STAT_CACHE_ENGINE_SIMPLE; /*(default)*/
 }
 
@@ -1112,10 +1576,18 @@ void stat_cache_update_entry(const char *name, uint32_t len,
     if (sc.stat_cache_engine == STAT_CACHE_ENGINE_NONE) return;
     if (__builtin_expect( (0 == len), 0)) return; /*(should not happen)*/
     if (name[len-1] == '/') { if (0 == --len) len = 1; }
-    splay_tree **sptree = &sc.files;
+    uint32_t ndx;
     stat_cache_entry *sce =
-      stat_cache_sptree_find(sptree, name, len);
+      stat_cache_hmap_ndx(&sc.files, &ndx, name, len);
+  #ifdef STAT_CACHE_SHM
+    if (sc.shm)
+        stat_cache_shm_invalidate(name, len, ndx);
+  #endif
     if (sce && buffer_is_equal_string(&sce->name, name, len)) {
+        if (sce->neg_errno) {
+            sce->neg_errno = 0;
+            --sc.neg_used;
+        }
         if (!stat_cache_stat_eq(&sce->st, st)) {
             /* etagb might be NULL to clear etag (invalidate) */
             buffer_clear(&sce->etag);
@@ -1125,14 +1597,13 @@ void stat_cache_update_entry(const char *name, uint32_t len,
             buffer_clear(&sce->content_type);
           #endif
             if (sce->fd >= 0) {
-                if (1 == sce->refcnt) {
-                    close(sce->fd);
-                    sce->fd = -1;
-                }
+                if (1 == sce->refcnt)
+                    stat_cache_entry_close_fd(sce);
                 else {
                     --sce->refcnt; /* stat_cache_entry_free(sce); */
-                    (*sptree)->data = sce = stat_cache_entry_init();
+                    sce = stat_cache_entry_init();
                     buffer_copy_string_len(&sce->name, name, len);
+                    hmap_insert(&sc.files, ndx, sce);
                 }
             }
             sce->st = *st;
@@ -1146,17 +1617,25 @@ void stat_cache_delete_entry(const char *name, uint32_t len)
     if (sc.stat_cache_engine == STAT_CACHE_ENGINE_NONE) return;
     if (__builtin_expect( (0 == len), 0)) return; /*(should not happen)*/
     if (name[len-1] == '/') { if (0 == --len) len = 1; }
-    splay_tree **sptree = &sc.files;
-    stat_cache_entry *sce = stat_cache_sptree_find(sptree, name, len);
+    uint32_t ndx;
+    stat_cache_entry *sce = stat_cache_hmap_ndx(&sc.files, &ndx, name, len);
+  #ifdef STAT_CACHE_SHM
+    if (sc.shm)
+        stat_cache_shm_invalidate(name, len, ndx);
+  #endif
     if (sce && buffer_is_equal_string(&sce->name, name, len)) {
-        *sptree = stat_cache_sptree_node_free(*sptree);
+        hmap_remove(&sc.files, ndx);
+        stat_cache_entry_free(sce);
     }
 }
 
 void stat_cache_invalidate_entry(const char *name, uint32_t len)
 {
-    splay_tree **sptree = &sc.files;
-    stat_cache_entry *sce = stat_cache_sptree_find(sptree, name, len);
+  #ifdef STAT_CACHE_SHM
+    if (sc.shm)
+        stat_cache_shm_invalidate(name, len, stat_cache_hash(name, len));
+  #endif
+    stat_cache_entry *sce = stat_cache_hmap_find(&sc.files, name, len);
     if (sce && buffer_is_equal_string(&sce->name, name, len)) {
         sce->stat_ts = 0;
       #ifdef HAVE_FAM_H
@@ -1170,73 +1649,57 @@ void stat_cache_invalidate_entry(const char *name, uint32_t len)
 
 #ifdef HAVE_FAM_H
 
-static void stat_cache_invalidate_dir_tree_walk(splay_tree *t,
-                                                const char *name, size_t len)
+static void stat_cache_invalidate_dir_tree(const char *name, size_t len)
 {
-    if (t->left)  stat_cache_invalidate_dir_tree_walk(t->left,  name, len);
-    if (t->right) stat_cache_invalidate_dir_tree_walk(t->right, name, len);
-
-    const buffer * const b = &((stat_cache_entry *)t->data)->name;
-    const size_t blen = buffer_clen(b);
-    if (blen > len && b->ptr[len] == '/' && 0 == memcmp(b->ptr, name, len)) {
-        stat_cache_entry *sce = t->data;
-        sce->stat_ts = 0;
-        if (sce->fam_dir != NULL) {
-            --((fam_dir_entry *)sce->fam_dir)->refcnt;
-            sce->fam_dir = NULL;
+  #ifdef STAT_CACHE_SHM
+    if (sc.shm) stat_cache_shm_invalidate_tree(name, (uint32_t)len);
+  #endif
+    const hmap * const files = &sc.files;
+    for (uint32_t i = 0, used = hmap_slots(files); i < used; ++i) {
+        stat_cache_entry * const sce = files->slots[i].data;
+        if (NULL == sce) continue;
+        const buffer * const b = &sce->name;
+        const size_t blen = buffer_clen(b);
+        if (blen > len && b->ptr[len] == '/' && 0 == memcmp(b->ptr, name, len)){
+            sce->stat_ts = 0;
+            if (sce->fam_dir != NULL) {
+                --((fam_dir_entry *)sce->fam_dir)->refcnt;
+                sce->fam_dir = NULL;
+            }
         }
     }
 }
 
-static void stat_cache_invalidate_dir_tree(const char *name, size_t len)
-{
-    splay_tree * const sptree = sc.files;
-    if (sptree) stat_cache_invalidate_dir_tree_walk(sptree, name, len);
-}
-
 #endif
 
 /*
- * walk though splay_tree and collect contents of dir tree.
- * remove tagged entries in a second loop
+ * walk though hash map and remove contents of dir tree
  */
 
-static void stat_cache_tag_dir_tree(splay_tree *t, const char *name, size_t len,
-                                    int *keys, int *ndx)
-{
-    if (*ndx == 8192) return; /*(must match num array entries in keys[])*/
-    if (t->left)  stat_cache_tag_dir_tree(t->left,  name, len, keys, ndx);
-    if (t->right) stat_cache_tag_dir_tree(t->right, name, len, keys, ndx);
-    if (*ndx == 8192) return; /*(must match num array entries in keys[])*/
-
-    const buffer * const b = &((stat_cache_entry *)t->data)->name;
-    const size_t blen = buffer_clen(b);
-    if (blen > len && b->ptr[len] == '/' && 0 == memcmp(b->ptr, name, len))
-        keys[(*ndx)++] = t->key;
-}
-
 __attribute_noinline__
 static void stat_cache_prune_dir_tree(const char *name, size_t len)
 {
-    splay_tree *sptree = sc.files;
-    int max_ndx, i;
-    int keys[8192]; /* 32k size on stack */
-    do {
-        if (!sptree) break;
-        max_ndx = 0;
-        stat_cache_tag_dir_tree(sptree, name, len, keys, &max_ndx);
-        for (i = 0; i < max_ndx; ++i) {
-            sptree = splaytree_splay_nonnull(sptree, keys[i]);
-            sptree = stat_cache_sptree_node_free(sptree);
+    hmap * const files = &sc.files;
+    for (uint32_t i = 0; i < hmap_slots(files); ) {
+        stat_cache_entry * const sce = files->slots[i].data;
+        const buffer * const b = sce ? &sce->name : NULL;
+        const size_t blen = b ? buffer_clen(b) : 0;
+        if (blen > len && b->ptr[len] == '/' && 0 == memcmp(b->ptr, name, len)){
+            hmap_remove_at(files, i); /*(examine slot i again)*/
+            stat_cache_entry_free(sce);
         }
-    } while (max_ndx == sizeof(keys)/sizeof(int));
-    sc.files = sptree;
+        else
+            ++i;
+    }
 }
 
 static void stat_cache_delete_tree(const char *name, uint32_t len)
 {
     stat_cache_delete_entry(name, len);
     stat_cache_prune_dir_tree(name, len);
+  #ifdef STAT_CACHE_SHM
+    if (sc.shm) stat_cache_shm_invalidate_tree(name, len);
+  #endif
 }
 
 void stat_cache_delete_dir(const char *name, uint32_t len)
@@ -1246,11 +1709,11 @@ void stat_cache_delete_dir(const char *name, uint32_t len)
     stat_cache_delete_tree(name, len);
   #ifdef HAVE_FAM_H
     if (sc.stat_cache_engine == STAT_CACHE_ENGINE_FAM) {
-        splay_tree **sptree = &sc.scf->dirs;
-        fam_dir_entry *fam_dir = stat_cache_sptree_find(sptree, name, len);
+        hmap * const dirs = &sc.scf->dirs;
+        fam_dir_entry *fam_dir = stat_cache_hmap_find(dirs, name, len);
         if (fam_dir && buffer_eq_slen(&fam_dir->name, name, len))
             fam_dir_invalidate_node(fam_dir);
-        if (*sptree) fam_dir_invalidate_tree(*sptree, name, len);
+        fam_dir_invalidate_tree(dirs, name, len);
         fam_dir_periodic_cleanup();
     }
   #endif
@@ -1258,7 +1721,67 @@ void stat_cache_delete_dir(const char *name, uint32_t len)
 
 __attribute_cold__
 __attribute_noinline__
-static stat_cache_entry * stat_cache_refresh_entry(const buffer * const name, uint32_t len, stat_cache_entry *sce, const int file_ndx, const int refresh) {
+static void stat_cache_refresh_negative(const buffer * const name, uint32_t len, stat_cache_entry *sce, const uint32_t file_ndx, const int refresh) {
+    /* cache ENOENT or ENOTDIR from stat() to answer repeated requests
+     * for paths which do not exist (e.g. from scanners) without stat().
+     * Negative entries are fresh for same duration as other entries in
+     * monitored dirs (STAT_CACHE_ENGINE_FAM), else for current second */
+    const int errnum = errno;
+    if (errnum != ENOENT && errnum != ENOTDIR) return;
+    /*(skip if trailing '/' since entry is keyed by name without '/')*/
+    if (len != buffer_clen(name)) return;
+
+    if (NULL == sce || 0 == sce->neg_errno) {
+        if (sc.neg_used >= sc.neg_max) return;
+        if (NULL != sce) { /* path removed; replace entry */
+            if (1 == sce->refcnt) {
+                if (sce->fd >= 0)
+                    stat_cache_entry_close_fd(sce);
+                buffer_clear(&sce->etag);
+              #if defined(HAVE_XATTR) || defined(HAVE_EXTATTR)
+                buffer_clear(&sce->content_type);
+              #endif
+            }
+            else {
+                --sce->refcnt; /* stat_cache_entry_free(sce); */
+                sce = NULL;
+            }
+        }
+        if (NULL == sce) {
+            sce = stat_cache_entry_init();
+            buffer_copy_string_len(&sce->name, name->ptr, len);
+            void * const odata = hmap_insert(&sc.files, file_ndx, sce);
+            if (NULL != odata && refresh < 0) {
+                /* hash collision: replace old entry */
+                stat_cache_entry_free(odata);
+            } /* else prior sce refcnt was > 1 and decremented above */
+        }
+        memset(&sce->st, 0, sizeof(sce->st));
+        ++sc.neg_used;
+    }
+    sce->neg_errno = errnum;
+
+  #ifdef HAVE_FAM_H
+    if (sce->fam_dir) {
+        --((fam_dir_entry *)sce->fam_dir)->refcnt;
+        sce->fam_dir = NULL;
+    }
+   #ifdef STAT_CACHE_NEG_MONITOR
+    /* monitor parent dir for creation of file */
+    if (sc.stat_cache_engine == STAT_CACHE_ENGINE_FAM && errnum == ENOENT) {
+        struct stat st = sce->st; /*(zeroed; not dir)*/
+        sce->fam_dir = fam_dir_monitor(sc.scf, name->ptr, len, &st);
+    }
+   #endif
+  #endif
+
+    sce->stat_ts = log_monotonic_secs;
+    errno = errnum;
+}
+
+__attribute_cold__
+__attribute_noinline__
+static stat_cache_entry * stat_cache_refresh_entry(const buffer * const name, uint32_t len, stat_cache_entry *sce, const uint32_t file_ndx, const int refresh) {
 
   #ifndef _WIN32
     /* sanity check; should not happen; should not be called with rel paths */
@@ -1270,16 +1793,28 @@ static stat_cache_entry * stat_cache_refresh_entry(const buffer * const name, ui
 
     /* use full path w/ stat(), even w/ trailing '/' ('len' may be shorter) */
     struct stat st;
-    if (-1 == stat(name->ptr, &st))
+  #ifdef STAT_CACHE_SHM
+    const int shm_hit =
+      (NULL != sc.shm
+       && stat_cache_shm_get(name->ptr, len, file_ndx, &st));
+    if (!shm_hit)
+  #endif
+    if (-1 == stat(name->ptr, &st)) {
+        if (sc.neg_max)
+            stat_cache_refresh_negative(name, len, sce, file_ndx, refresh);
         return NULL;
+    }
+
+    if (NULL != sce && sce->neg_errno) {
+        sce->neg_errno = 0;
+        --sc.neg_used;
+    }
 
     if (NULL == sce || !stat_cache_stat_eq(&sce->st, &st)) {
         if (NULL != sce && sce->fd >= 0) {
             /* close fd when refresh needed */
-            if (1 == sce->refcnt) {
-                close(sce->fd);
-                sce->fd = -1;
-            }
+            if (1 == sce->refcnt)
+                stat_cache_entry_close_fd(sce);
             else {
                 --sce->refcnt; /* stat_cache_entry_free(sce); */
                 sce = NULL;
@@ -1290,16 +1825,11 @@ static stat_cache_entry * stat_cache_refresh_entry(const buffer * const name, ui
             sce = stat_cache_entry_init();
             buffer_copy_string_len(&sce->name, name->ptr, len);
 
-            /* sptree already splayed to file_ndx in stat_cache_get_entry() */
-            splay_tree * const sptree = sc.files;
-            if (NULL != sptree && sptree->key == file_ndx) {
-                if (refresh < 0) { /* hash collision: replace old entry */
-                    stat_cache_entry_free(sptree->data);
-                } /* else prior sce refcnt was > 1 and decremented above */
-                sptree->data = sce;
-            }
-            else
-                sc.files = splaytree_insert_splayed(sptree, file_ndx, sce);
+            void * const odata = hmap_insert(&sc.files, file_ndx, sce);
+            if (NULL != odata && refresh < 0) {
+                /* hash collision: replace old entry */
+                stat_cache_entry_free(odata);
+            } /* else prior sce refcnt was > 1 and decremented above */
         }
         else {
             buffer_clear(&sce->etag);
@@ -1324,6 +1854,15 @@ static stat_cache_entry * stat_cache_refresh_entry(const buffer * const name, ui
     }
 
     sce->stat_ts = log_monotonic_secs;
+  #ifdef STAT_CACHE_SHM
+    if (NULL != sc.shm && (!shm_hit || sc.shm_owner))
+        stat_cache_shm_put(name->ptr, len, file_ndx, &sce->st,
+                           sce->stat_ts,
+                         #ifdef HAVE_FAM_H
+                           sce->fam_dir ? STAT_CACHE_SHM_MONITORED :
+                         #endif
+                           0);
+  #endif
     return sce;
 }
 
@@ -1339,9 +1878,9 @@ stat_cache_entry * stat_cache_get_entry(const buffer * const name) {
      * e.g. without repeated '/' */
 
     /* check if stat cache entry exists, matches name, and is fresh */
-    int file_ndx;
+    uint32_t file_ndx;
     stat_cache_entry *sce =
-      stat_cache_sptree_ndx(&sc.files, &file_ndx, name->ptr, len);
+      stat_cache_hmap_ndx(&sc.files, &file_ndx, name->ptr, len);
     int refresh = -1;/* -1 stat cache entry does not exist, or hash collision */
     if (NULL != sce) {
         /* check if the name is the same; we might have a hash collision */
@@ -1358,6 +1897,8 @@ stat_cache_entry * stat_cache_get_entry(const buffer * const name) {
                  * (gaps due to not continually monitoring an entire tree) */
                 refresh = !(cur_ts - sce->stat_ts < 16); /* 0 if fresh */
           #endif
+            else if (sce->neg_errno) /* negative entry; dir not monitored */
+                refresh = (sce->stat_ts != cur_ts);      /* 0 if fresh */
         }
         else /* hash collision; forget about entry */
             sce = NULL;
@@ -1367,6 +1908,10 @@ stat_cache_entry * stat_cache_get_entry(const buffer * const name) {
         sce = stat_cache_refresh_entry(name, len, sce, file_ndx, refresh);
         if (NULL == sce) return NULL;
     }
+    else if (sce->neg_errno) { /* path does not exist */
+        errno = sce->neg_errno;
+        return NULL;
+    }
 
     /* fix broken stat/open for symlinks to reg files with appended slash on
      * old freebsd, osx; fixed in freebsd around 2009:
@@ -1468,44 +2013,35 @@ int stat_cache_open_rdonly_fstat (const buffer *name, struct stat *st, int symli
 /**
  * remove stat() from cache which haven't been stat()ed for
  * more than 2 seconds
- *
- *
- * walk though the stat-cache, collect the ids which are too old
- * and remove them in a second loop
  */
 
-static void stat_cache_tag_old_entries(splay_tree * const t, int * const keys, int * const ndx, const time_t max_age, const unix_time64_t cur_ts) {
-    if (*ndx == 8192) return; /*(must match num array entries in keys[])*/
-    if (t->left)
-        stat_cache_tag_old_entries(t->left, keys, ndx, max_age, cur_ts);
-    if (t->right)
-        stat_cache_tag_old_entries(t->right, keys, ndx, max_age, cur_ts);
-    if (*ndx == 8192) return; /*(must match num array entries in keys[])*/
-
-    const stat_cache_entry * const sce = t->data;
-    if (cur_ts - sce->stat_ts > max_age)
-        keys[(*ndx)++] = t->key;
-}
-
 static void stat_cache_periodic_cleanup(const time_t max_age, const unix_time64_t cur_ts) {
-    splay_tree *sptree = sc.files;
-    int max_ndx, i;
-    int keys[8192]; /* 32k size on stack */
-    do {
-        if (!sptree) break;
-        max_ndx = 0;
-        stat_cache_tag_old_entries(sptree, keys, &max_ndx, max_age, cur_ts);
-        for (i = 0; i < max_ndx; ++i) {
-            sptree = splaytree_splay_nonnull(sptree, keys[i]);
-            sptree = stat_cache_sptree_node_free(sptree);
+    hmap * const files = &sc.files;
+    /*(keep pre-warmed entries for a while, even if not yet accessed)*/
+    const unix_time64_t prewarm_ts =
+      (sc.prewarm_ts && cur_ts - sc.prewarm_ts < STAT_CACHE_PREWARM_KEEP)
+        ? sc.prewarm_ts
+        : 0;
+    for (uint32_t i = 0; i < hmap_slots(files); ) {
+        stat_cache_entry * const sce = files->slots[i].data;
+        if (sce && cur_ts - sce->stat_ts > max_age
+            && (sce->stat_ts > prewarm_ts || 0 == sce->stat_ts)) {
+            hmap_remove_at(files, i); /*(examine slot i again)*/
+            stat_cache_entry_free(sce);
         }
-    } while (max_ndx == sizeof(keys)/sizeof(int));
-    sc.files = sptree;
+        else
+            ++i;
+    }
 }
 
 void stat_cache_trigger_cleanup(void) {
 	time_t max_age = 2;
 
+      #ifdef STAT_CACHE_SHM
+	if (sc.shm_owner)
+		stat_cache_shm_monitor();
+      #endif
+
       #ifdef HAVE_FAM_H
 	if (STAT_CACHE_ENGINE_FAM == sc.stat_cache_engine) {
 		if (log_monotonic_secs & 0x1F) return;
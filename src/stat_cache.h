@@ -16,6 +16,8 @@ typedef struct stat_cache_entry {
     unix_time64_t stat_ts;
     int fd;
     int refcnt;
+    int neg_errno; /* errno if negative entry (path not found), else 0 */
+    int fd_counted; /* fd opened by pre-warm and counted in srv->cur_fds */
   #if defined(HAVE_FAM_H) || defined(HAVE_SYS_INOTIFY_H) || defined(HAVE_SYS_EVENT_H)
     void *fam_dir;
   #endif
@@ -30,11 +32,35 @@ int stat_cache_choose_engine (const buffer *stat_cache_string, log_error_st *err
 struct fdevents;        /* declaration */
 
 __attribute_cold__
-int stat_cache_init(struct fdevents *ev, log_error_st *errh);
+void stat_cache_negative_max(uint32_t n);
+
+__attribute_cold__
+void stat_cache_prefetch_max(uint32_t n);
+
+__attribute_cold__
+void stat_cache_prewarm_paths(const array *a);
+
+__attribute_cold__
+void stat_cache_prewarm_config(const array *mimetypes, int etag_flags, int use_xattr, uint32_t max, uint32_t nfds);
+
+__attribute_cold__
+void stat_cache_prewarm(log_error_st *errh);
+
+__attribute_cold__
+int stat_cache_init(struct fdevents *ev, int *cur_fds, log_error_st *errh);
+
+/* num entries pre-warmed at startup; num pre-warmed files held open */
+void stat_cache_prewarm_stats(uint32_t *entries, uint32_t *fds);
 
 __attribute_cold__
 void stat_cache_free(void);
 
+__attribute_cold__
+void stat_cache_shm_init(uint32_t nentries, log_error_st *errh);
+
+__attribute_cold__
+void stat_cache_shm_worker(int worker);
+
 void stat_cache_entry_refchg(void *data, int mod);
 
 __attribute_cold__
@@ -0,0 +1,176 @@
+#ifndef LI_SYS_IO_URING_H
+#define LI_SYS_IO_URING_H
+#include "first.h"
+
+/* minimal io_uring ring setup and submission/completion queue access
+ * using raw syscalls (without liburing) */
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__linux__)
+
+#define HAVE_SYS_IO_URING 1
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include "sys-unistd.h" /* <unistd.h> */
+
+typedef struct sys_io_uring {
+    int fd;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t cq_mask;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_sz;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+} sys_io_uring;
+
+__attribute_cold__
+static inline void
+sys_io_uring_free (sys_io_uring * const ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_sz);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_sz);
+    if (-1 != ring->fd)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/* (io_uring fd is always created O_CLOEXEC)
+ * (requires IORING_FEAT_NODROP and IORING_FEAT_EXT_ARG (Linux 5.11)) */
+__attribute_cold__
+static inline int
+sys_io_uring_init (sys_io_uring * const ring, uint32_t entries,
+                   uint32_t cq_entries)
+{
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CLAMP;
+    if (cq_entries) {
+        p.flags |= IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (-1 == ring->fd) return -1;
+
+    if ((p.features & (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG))
+                   != (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)) {
+        sys_io_uring_free(ring);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_sz = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    ring->sqes_sz    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    void *ptr;
+    ptr = mmap(NULL, ring->sq_ring_sz, PROT_READ|PROT_WRITE,
+               MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sq_ring = (MAP_FAILED != ptr) ? ptr : NULL;
+    ptr = mmap(NULL, ring->cq_ring_sz, PROT_READ|PROT_WRITE,
+               MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->cq_ring = (MAP_FAILED != ptr) ? ptr : NULL;
+    ptr = mmap(NULL, ring->sqes_sz, PROT_READ|PROT_WRITE,
+               MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->sqes = (MAP_FAILED != ptr) ? ptr : NULL;
+    if (!ring->sq_ring || !ring->cq_ring || !ring->sqes) {
+        sys_io_uring_free(ring);
+        return -1;
+    }
+
+    char * const sq = ring->sq_ring;
+    char * const cq = ring->cq_ring;
+    ring->sq_head    = (uint32_t *)(sq + p.sq_off.head);
+    ring->sq_tail    = (uint32_t *)(sq + p.sq_off.tail);
+    ring->sq_mask    = *(uint32_t *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = *(uint32_t *)(sq + p.sq_off.ring_entries);
+    ring->cq_head    = (uint32_t *)(cq + p.cq_off.head);
+    ring->cq_tail    = (uint32_t *)(cq + p.cq_off.tail);
+    ring->cq_mask    = *(uint32_t *)(cq + p.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* identity map submission queue index array */
+    uint32_t * const sq_array = (uint32_t *)(sq + p.sq_off.array);
+    for (uint32_t i = 0; i < p.sq_entries; ++i)
+        sq_array[i] = i;
+
+    return 0;
+}
+
+static inline uint32_t
+sys_io_uring_sq_pending (const sys_io_uring * const ring)
+{
+    return *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* submit pending sqes and (optionally) wait for min_complete completions */
+static inline int
+sys_io_uring_enter (sys_io_uring * const ring, unsigned int min_complete,
+                    unsigned int flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, ring->fd,
+                        sys_io_uring_sq_pending(ring),
+                        min_complete, flags, arg, argsz);
+}
+
+/* get next free sqe (zeroed); flushes submission queue to kernel if full */
+static inline struct io_uring_sqe *
+sys_io_uring_get_sqe (sys_io_uring * const ring)
+{
+    if (sys_io_uring_sq_pending(ring) >= ring->sq_entries) {
+        if (sys_io_uring_enter(ring, 0, 0, NULL, 0) < 0)
+            return NULL;
+        if (sys_io_uring_sq_pending(ring) >= ring->sq_entries) {
+            errno = EAGAIN;
+            return NULL;
+        }
+    }
+    struct io_uring_sqe * const sqe =
+      ring->sqes + (*ring->sq_tail & ring->sq_mask);
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* queue sqe returned by most recent sys_io_uring_get_sqe() */
+static inline void
+sys_io_uring_commit_sqe (sys_io_uring * const ring)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/* peek at next cqe, if available */
+static inline const struct io_uring_cqe *
+sys_io_uring_peek_cqe (const sys_io_uring * const ring)
+{
+    const uint32_t head = *ring->cq_head;
+    return head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)
+      ? ring->cqes + (head & ring->cq_mask)
+      : NULL;
+}
+
+/* release cqe returned by sys_io_uring_peek_cqe() back to kernel */
+static inline void
+sys_io_uring_cqe_seen (sys_io_uring * const ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* HAVE_LINUX_IO_URING_H && __linux__ */
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * microbenchmark: lookup throughput of algo_hmap vs algo_splaytree
+ *
+ * not run as part of test suite; build and run manually, e.g.
+ *   cmake --build build --target bench_algo_hmap && build/build/bench_algo_hmap
+ */
+#include "first.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "algo_hmap.c"
+#include "algo_splaytree.c"
+
+static uint64_t bench_now_ns (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t bench_rand (uint32_t * const state) {
+    /* xorshift32 */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return (*state = x);
+}
+
+static void bench_run (const uint32_t n, const uint32_t nlookups) {
+    uint32_t * const keys = ck_malloc(n * sizeof(uint32_t));
+    uint32_t * const order = ck_malloc(nlookups * sizeof(uint32_t));
+    uint32_t state = 2463534242u;
+    for (uint32_t i = 0; i < n; ++i) /*(unique; splaytree keys are int)*/
+        keys[i] = (i * 2654435761u) & 0x7FFFFFFF;
+    for (uint32_t i = 0; i < nlookups; ++i)
+        order[i] = keys[bench_rand(&state) % n];
+
+    hmap h = { NULL, 0, 0, 0 };
+    splay_tree *t = NULL;
+    for (uint32_t i = 0; i < n; ++i) {
+        hmap_insert(&h, keys[i], keys+i);
+        t = splaytree_insert(t, (int)keys[i], keys+i);
+    }
+
+    uintptr_t sum = 0;
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < nlookups; ++i)
+        sum += (uintptr_t)hmap_find(&h, order[i]);
+    const uint64_t hmap_ns = bench_now_ns() - t0;
+
+    t0 = bench_now_ns();
+    for (uint32_t i = 0; i < nlookups; ++i) {
+        t = splaytree_splay(t, (int)order[i]);
+        if (t && t->key == (int)order[i]) sum -= (uintptr_t)t->data;
+    }
+    const uint64_t splay_ns = bench_now_ns() - t0;
+
+    printf("%8u entries: hmap %7.2f Mlookups/s  splaytree %7.2f Mlookups/s%s\n",
+           n, nlookups * 1000.0 / (double)hmap_ns,
+           nlookups * 1000.0 / (double)splay_ns, sum ? " (mismatch)" : "");
+
+    while (t) t = splaytree_delete_splayed_node(t);
+    hmap_free(&h);
+    free(order);
+    free(keys);
+}
+
+int main (void) {
+    bench_run(10000, 10000000);
+    bench_run(100000, 10000000);
+    bench_run(1000000, 10000000);
+    return 0;
+}
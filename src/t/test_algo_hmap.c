@@ -0,0 +1,99 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+
+#include "algo_hmap.c"
+
+static uint32_t test_algo_hmap_key (uint32_t i) {
+    /*(odd keys spread; even keys differ only in high bits)*/
+    return (i & 1) ? i * 2654435761u : i << 16;
+}
+
+static void test_algo_hmap_basic (void) {
+    hmap h = { NULL, 0, 0, 0 };
+    assert(NULL == hmap_find(&h, 1));
+    assert(0 == hmap_slots(&h));
+    assert(NULL == hmap_remove(&h, 1));
+
+    assert(NULL == hmap_insert(&h, 1, (void *)(uintptr_t)10));
+    assert(NULL == hmap_insert(&h, 0, (void *)(uintptr_t)20));
+    assert((void *)(uintptr_t)10 == hmap_find(&h, 1));
+    assert((void *)(uintptr_t)20 == hmap_find(&h, 0));
+    assert(2 == h.used);
+
+    /* replace returns prior data */
+    assert((void *)(uintptr_t)10 == hmap_insert(&h, 1, (void *)(uintptr_t)11));
+    assert((void *)(uintptr_t)11 == hmap_find(&h, 1));
+    assert(2 == h.used);
+
+    assert((void *)(uintptr_t)11 == hmap_remove(&h, 1));
+    assert(NULL == hmap_find(&h, 1));
+    assert(NULL == hmap_remove(&h, 1));
+    assert(1 == h.used);
+
+    hmap_free(&h);
+    assert(NULL == h.slots && 0 == h.used);
+}
+
+static void test_algo_hmap_grow_remove (void) {
+    hmap h = { NULL, 0, 0, 0 };
+    const uint32_t n = 10000;
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint32_t k = test_algo_hmap_key(i);
+        assert(NULL == hmap_insert(&h, k, (void *)(uintptr_t)(i+1)));
+    }
+    assert(n == h.used);
+    assert(h.used <= hmap_slots(&h) - (hmap_slots(&h) >> 3));
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint32_t k = test_algo_hmap_key(i);
+        assert((void *)(uintptr_t)(i+1) == hmap_find(&h, k));
+    }
+
+    /* remove every third entry by key */
+    for (uint32_t i = 0; i < n; i += 3) {
+        const uint32_t k = test_algo_hmap_key(i);
+        assert((void *)(uintptr_t)(i+1) == hmap_remove(&h, k));
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint32_t k = test_algo_hmap_key(i);
+        void * const data = hmap_find(&h, k);
+        assert(data == ((i % 3) ? (void *)(uintptr_t)(i+1) : NULL));
+    }
+
+    /* remove odd entries while iterating (re-examine slot after remove) */
+    for (uint32_t i = 0; i < hmap_slots(&h); ) {
+        const uintptr_t v = (uintptr_t)h.slots[i].data;
+        if (v && ((v-1) & 1))
+            hmap_remove_at(&h, i);
+        else
+            ++i;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < hmap_slots(&h); ++i) {
+        const uintptr_t v = (uintptr_t)h.slots[i].data;
+        if (0 == v) {
+            assert(0 == h.slots[i].dib);
+            continue;
+        }
+        ++count;
+        assert(!((v-1) & 1) && ((v-1) % 3));
+        assert(h.slots[i].key == test_algo_hmap_key((uint32_t)v-1));
+    }
+    assert(count == h.used);
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint32_t k = test_algo_hmap_key(i);
+        void * const data = hmap_find(&h, k);
+        assert(data == (((i % 3) && !(i & 1)) ? (void *)(uintptr_t)(i+1) : NULL));
+    }
+
+    hmap_free(&h);
+}
+
+void test_algo_hmap (void);
+void test_algo_hmap (void)
+{
+    test_algo_hmap_basic();
+    test_algo_hmap_grow_remove();
+}
@@ -3,6 +3,7 @@
 #undef NDEBUG
 #include <assert.h>
 
+void test_algo_hmap (void);
 void test_array (void);
 void test_base64 (void);
 void test_buffer (void);
@@ -14,6 +15,7 @@ void test_keyvalue (void);
 void test_request (void);
 
 int main(void) {
+    test_algo_hmap();
     test_array();
     test_base64();
     test_buffer();
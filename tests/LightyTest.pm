@@ -265,6 +265,13 @@ BIND_OVERRIDE
 
 		$ENV{'SRCDIR'} = $testdir;
 
+		# lighttpd server.max-worker parent signals its process group upon
+		# shutdown (kill(0, ...)); start in new session to not signal tests
+		if ($self->{SETSID} && !$self->{"win32native"}) {
+			require POSIX;
+			POSIX::setsid();
+		}
+
 		my @cmdline = ($self->{LIGHTTPD_PATH}, "-D", "-f", $conf, "-m", $modules_path);
 		splice(@cmdline, -2) if exists $ENV{LIGHTTPD_EXE_PATH};
 		if (!defined $ENV{"TRACEME"}) {
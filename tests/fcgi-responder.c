@@ -1,6 +1,7 @@
 /*
  * simple and trivial FastCGI server w/ hard-coded results for use in unit tests
  * - processes a single FastCGI request at a time (serially)
+ * - keeps connection open for next request if FCGI_KEEP_CONN
  * - listens on FCGI_LISTENSOCK_FILENO
  *   (socket on FCGI_LISTENSOCK_FILENO must be set up by invoker)
  *   expects to be started w/ listening socket already on FCGI_LISTENSOCK_FILENO
@@ -65,6 +66,9 @@ typedef uintptr_t FILE;
 #include "../src/compat/fastcgi.h"
 
 static int finished;
+static int keep_conn; /* FCGI_KEEP_CONN in FCGI_BEGIN_REQUEST */
+static int conn_idle; /* request done on kept connection; await next */
+static unsigned int conn_count; /* num connections accepted */
 static unsigned char buf[65536];
 
 
@@ -198,6 +202,7 @@ fcgi_process_params (FILE * const stream, int req_id, int role, unsigned char *
      *  generate response here based on query string values (indicating test) */
 
     const char *cdata = NULL;
+    int end_extra = 0;
 
     if (NULL != (p = fcgi_getenv(r, rlen, "QUERY_STRING", 12, &len))) {
         if (2 == len && 0 == memcmp(p, "lf", 2))
@@ -222,6 +227,14 @@ fcgi_process_params (FILE * const stream, int req_id, int role, unsigned char *
             cdata = "Status: 200 OK\r\n\r\n";
             finished = 1;
         }
+        else if (9 == len && 0 == memcmp(p, "end-extra", 9)) {
+            cdata = "Status: 200 OK\r\n\r\n";
+            end_extra = 1;
+        }
+        else if (10 == len && 0 == memcmp(p, "bad-header", 10)) {
+            cdata = "no colon in response header line\r\n\r\n";
+            p = NULL;
+        }
         else if (role == FCGI_AUTHORIZER
                  && len >= 5 && 0 == memcmp(p, "auth-", 5)) {
             if (7 == len && 0 == memcmp(p, "auth-ok", 7))
@@ -255,6 +268,15 @@ fcgi_process_params (FILE * const stream, int req_id, int role, unsigned char *
         cdata = fcgi_getenv(r, rlen, p+4, len-4, &len);
     else if (8 == len && 0 == memcmp(p, "auth-var", 8))
         cdata = fcgi_getenv(r, rlen, "X_LIGHTTPD_FCGI_AUTH", 20, &len);
+    else if (7 == len && 0 == memcmp(p, "conn-id", 7)) {
+        /* num connections accepted; same value if connection was reused */
+        static char num[16];
+        char *n = num + sizeof(num);
+        unsigned int i = conn_count;
+        do { *--n = '0' + (i % 10); } while ((i /= 10));
+        cdata = n;
+        len = (int)(num + sizeof(num) - n);
+    }
     else {
         cdata = "test123";
         len = sizeof("test123")-1;
@@ -269,6 +291,10 @@ fcgi_process_params (FILE * const stream, int req_id, int role, unsigned char *
     if (1 != fwrite(&endrec, sizeof(endrec), 1, stream))
         return -1; /* error writing FCGI_END_REQUEST; ignore */
 
+    /* (unexpected) data after FCGI_END_REQUEST */
+    if (end_extra && 0 != fcgi_puts(req_id, "extra", 5, stream))
+        return -1;
+
     return -2; /* done */
 }
 
@@ -306,15 +332,21 @@ fcgi_dispatch_packet (FILE *stream, ssize_t offset, uint32_t len)
       case FCGI_BEGIN_REQUEST:
         role = (buf[offset+FCGI_HEADER_LEN] << 8)
              |  buf[offset+FCGI_HEADER_LEN+1];
+        keep_conn = (buf[offset+FCGI_HEADER_LEN+2] & FCGI_KEEP_CONN);
+        conn_idle = 0;
         return 0;  /* ignore; could save req_id and match further packets */
       case FCGI_ABORT_REQUEST:
         return -2; /* done */
       case FCGI_END_REQUEST:
         return -1; /* unexpected; this server is not sending FastCGI requests */
       case FCGI_PARAMS:
+        if (0 == len)
+            return 0; /* ignore; end of params (after response sent) */
         return fcgi_process_params(stream, req_id, role,
                                    buf+offset+FCGI_HEADER_LEN, len);
       case FCGI_STDIN:
+        if (0 == len)
+            return 0; /* ignore; end of (empty) request body */
         /* XXX: TODO read and discard request body
          * (currently ignored in these FastCGI unit tests)
          * (make basic effort to read body; ignore any timeouts or errors) */
@@ -346,8 +378,13 @@ fcgi_recv_packet (FILE * const stream, ssize_t sz)
         if (sz - offset < (ssize_t)(FCGI_HEADER_LEN + len + pad))
             break;
         int rc = fcgi_dispatch_packet(stream, offset, len);
-        if (rc < 0)
-            return rc;
+        if (rc < 0) {
+            if (-2 != rc || !keep_conn)
+                return rc;
+            /* request done; keep connection open for next request */
+            fflush(stream);
+            conn_idle = 1;
+        }
         offset += (ssize_t)(FCGI_HEADER_LEN + len + pad);
     }
     return offset;
@@ -369,7 +406,8 @@ fcgi_recv (const int fd, FILE * const stream)
 
     do {
         struct pollfd pfd = { fd, POLLIN, 0 };
-        switch (poll(&pfd, 1, 25)) { /* 25ms timeout */
+        /* 25ms timeout (5s timeout waiting for next request on kept conn) */
+        switch (poll(&pfd, 1, conn_idle && 0 == offset ? 5000 : 25)) {
           default: /* 1; the only pfd has revents */
             break;
           case -1: /* error */
@@ -431,6 +469,8 @@ main (void)
         fd = accept(lfd, NULL, NULL);
         if (fd == INVALID_SOCKET)
             continue;
+        ++conn_count;
+        keep_conn = conn_idle = 0;
         /* XXX: skip checking FCGI_WEB_SERVER_ADDRS; not implemented */
 
         /* fdopen() is not valid on _WIN32 SOCKET; pass (FILE *)fd through */
@@ -457,6 +497,8 @@ main (void)
         fd = accept(FCGI_LISTENSOCK_FILENO, NULL, NULL);
         if (fd < 0)
             continue;
+        ++conn_count;
+        keep_conn = conn_idle = 0;
         /* XXX: skip checking FCGI_WEB_SERVER_ADDRS; not implemented */
 
         /* uses stdio to retain prior behavior of output buffering (default)
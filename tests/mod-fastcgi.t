@@ -7,7 +7,8 @@ BEGIN {
 }
 
 use strict;
-use Test::More tests => 24;
+use Test::More tests => 32;
+use IO::Socket;
 use LightyTest;
 
 my $tf = LightyTest->new();
@@ -15,12 +16,21 @@ my $tf = LightyTest->new();
 my $t;
 
 SKIP: {
-	skip "no fcgi-responder found", 24
+	skip "no fcgi-responder found", 32
 	  unless (   -x $tf->{BASEDIR}."/tests/fcgi-responder"
 		  || -x $tf->{BASEDIR}."/tests/fcgi-responder.exe");
 
 	my $ephemeral_port = LightyTest->get_ephemeral_tcp_port();
 	$ENV{EPHEMERAL_PORT} = $ephemeral_port;
+	my %ports = ( $ephemeral_port => 1 );
+	foreach (qw(EPHEMERAL_PORT_KEEP_CONN
+	            EPHEMERAL_PORT_CHASH_A EPHEMERAL_PORT_CHASH_B)) {
+		my $port;
+		do {
+			$port = LightyTest->get_ephemeral_tcp_port();
+		} while ($ports{$port}++);
+		$ENV{$_} = $port;
+	}
 
 	$tf->{CONFIGFILE} = 'fastcgi-responder.conf';
 	ok($tf->start_proc == 0, "Starting lighttpd with $tf->{CONFIGFILE}") or die();
@@ -188,6 +198,69 @@ EOF
 	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '' } ];
 	ok($tf->handle_http($t) == 0, 'SCRIPT_NAME (wsgi)');
 
+	# (fcgi-responder ?conn-id returns num connections accepted by backend)
+	$t->{REQUEST}  = ( <<EOF
+GET /index.fcgi?conn-id HTTP/1.0
+Host: keep-conn.example.org
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '1' } ];
+	ok($tf->handle_http($t) == 0, 'FCGI_KEEP_CONN new connection');
+
+	$t->{REQUEST}  = ( <<EOF
+GET /index.fcgi?conn-id HTTP/1.0
+Host: keep-conn.example.org
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '1' } ];
+	ok($tf->handle_http($t) == 0, 'FCGI_KEEP_CONN connection reused');
+
+	$t->{REQUEST}  = ( <<EOF
+GET /index.fcgi?bad-header HTTP/1.0
+Host: keep-conn.example.org
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 502 } ];
+	ok($tf->handle_http($t) == 0, 'FCGI_KEEP_CONN response header parse error');
+
+	$t->{REQUEST}  = ( <<EOF
+GET /index.fcgi?conn-id HTTP/1.0
+Host: keep-conn.example.org
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '2' } ];
+	ok($tf->handle_http($t) == 0, 'FCGI_KEEP_CONN not reused after header parse error');
+
+	$t->{REQUEST}  = ( <<EOF
+GET /index.fcgi?end-extra HTTP/1.0
+Host: keep-conn.example.org
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'test123' } ];
+	ok($tf->handle_http($t) == 0, 'FCGI_KEEP_CONN data after FCGI_END_REQUEST');
+
+	$t->{REQUEST}  = ( <<EOF
+GET /index.fcgi?conn-id HTTP/1.0
+Host: keep-conn.example.org
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '3' } ];
+	ok($tf->handle_http($t) == 0, 'FCGI_KEEP_CONN not reused after data after FCGI_END_REQUEST');
+
+	# (backends are spawned with BACKEND_ID "a" and "b" in environment)
+	my (@chash, %chash_seen);
+	for my $pass (0, 1) {
+		for my $i (0 .. 30) { # (odd num paths; round-robin would alternate)
+			my $id = get_content($tf, 'chash.example.org', "/chash/$i?env=BACKEND_ID");
+			$id = '' unless defined $id;
+			$chash[$i] = $id unless $pass;
+			$chash[$i] = '' if $pass && $chash[$i] ne $id;
+			$chash_seen{$id} = 1;
+		}
+	}
+	ok(0 == grep({ $_ eq '' } @chash), 'balance consistent: same backend for same path');
+	ok($chash_seen{a} && $chash_seen{b} && 2 == keys %chash_seen, 'balance consistent: paths spread across backends');
+
 
     # skip timing-sensitive test during CI testing, but run for user 'gps'
     my $user = `id -un`;
@@ -223,3 +296,18 @@ EOF
 
 	ok($tf->stop_proc == 0, "Stopping lighttpd");
 }
+
+sub get_content {
+	# (returns response body; handle_http() only compares to expected body)
+	my ($tf, $host, $uri) = @_;
+	my $remote =
+		IO::Socket::INET->new(
+			Proto    => "tcp",
+			PeerAddr => "127.0.0.1",
+			PeerPort => $tf->{PORT}) || return undef;
+	print $remote "GET $uri HTTP/1.0\r\nHost: $host\r\n\r\n";
+	local $/;
+	my $resp = <$remote>;
+	close($remote);
+	return (defined $resp && $resp =~ /\r\n\r\n(.*)\z/s) ? $1 : undef;
+}
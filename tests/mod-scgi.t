@@ -7,14 +7,14 @@ BEGIN {
 }
 
 use strict;
-use Test::More tests => 10;
+use Test::More tests => 11;
 use LightyTest;
 
 my $tf = LightyTest->new();
 my $t;
 
 SKIP: {
-	skip "no scgi-responder found", 10 unless -x $tf->{BASEDIR}."/tests/scgi-responder" || -x $tf->{BASEDIR}."/tests/scgi-responder.exe";
+	skip "no scgi-responder found", 11 unless -x $tf->{BASEDIR}."/tests/scgi-responder" || -x $tf->{BASEDIR}."/tests/scgi-responder.exe";
 
 	my $ephemeral_port = LightyTest->get_ephemeral_tcp_port();
 	$ENV{EPHEMERAL_PORT} = $ephemeral_port;
@@ -104,4 +104,28 @@ EOF
 
 
 	ok($tf->stop_proc == 0, "Stopping lighttpd");
+
+	# backend connection reuse is not implemented for SCGI;
+	# keep-alive-max-idle must be rejected rather than silently ignored
+	my $conf = $tf->{TESTDIR}.'/tmp/scgi-keep-alive.conf';
+	open(my $fh, '>', $conf) or die("open $conf: $!");
+	print $fh <<'EOF';
+server.document-root = env.SRCDIR + "/tmp/lighttpd/servers/www.example.org/pages/"
+server.errorlog      = env.SRCDIR + "/tmp/lighttpd/logs/lighttpd.error.log"
+server.modules += ( "mod_scgi" )
+scgi.server = ( "/" => ( (
+	"host" => "127.0.0.1",
+	"port" => env.EPHEMERAL_PORT,
+	"keep-alive-max-idle" => 4,
+) ) )
+EOF
+	close($fh);
+	{
+		# (lighttpd -tt loads modules and checks module config)
+		local $ENV{SRCDIR} = $tf->{TESTDIR};
+		my @cmdline = ($tf->{LIGHTTPD_PATH}, "-tt", "-f", $conf, "-m", $tf->{MODULES_PATH});
+		splice(@cmdline, -2) if exists $ENV{LIGHTTPD_EXE_PATH};
+		ok(0 != system(@cmdline), 'keep-alive-max-idle rejected for scgi.server');
+	}
+	unlink($conf);
 }
@@ -25,7 +25,8 @@ mkdir -p "${tmpdir}/servers/www.example.org/pages/"           \
          "${tmpdir}/servers/b.example.org/pages/b/"           \
          "${tmpdir}/logs/"                                    \
          "${tmpdir}/cache/"                                   \
-         "${tmpdir}/cache/compress/"
+         "${tmpdir}/cache/compress/"                          \
+         "${tmpdir}/cache/adaptive/"
 
 # copy everything into the right places
 cp "${srcdir}/docroot/"*.html \
@@ -54,6 +55,8 @@ touch "${tmpdir}/servers/www.example.org/pages/image.jpg" \
       "${tmpdir}/servers/www.example.org/pages/subdir/access.txt" \
       "${tmpdir}/servers/www.example.org/pages/subdir/modification.txt"
 echo "12345" > "${tmpdir}/servers/123.example.org/pages/12345.txt"
+echo "12345" > "${tmpdir}/servers/www.example.org/pages/subdir/precompressed.txt"
+echo "not really gzip" > "${tmpdir}/servers/www.example.org/pages/subdir/precompressed.txt.gz"
 echo "12345" > "${tmpdir}/servers/123.example.org/pages/12345.html"
 echo "12345" > "${tmpdir}/servers/123.example.org/pages/dummyfile.bla"
 echo "12345" > "${tmpdir}/servers/123.example.org/pages/range.disabled"
@@ -70,6 +73,13 @@ cat - <<HERE > "${tmpdir}/servers/123.example.org/pages/100.txt"
 abcdefghi
 HERE
 
+# (> 64k; compressed in mod_deflate worker thread, if thread pool enabled)
+i=0
+while [ $i -lt 4096 ]; do
+	echo "$i 0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmn"
+	i=$((i+1))
+done > "${tmpdir}/servers/www.example.org/pages/large.txt"
+
 printf "%-40s" "preparing infrastructure"
 [ -z "$MAKELEVEL" ] && echo
 
@@ -8,12 +8,35 @@ BEGIN {
 
 use strict;
 use IO::Socket;
-use Test::More tests => 164;
+use Test::More tests => 214;
 use LightyTest;
 
 my $tf = LightyTest->new();
 my $t;
 
+# (returns response to raw HTTP request, or undef)
+sub http_request {
+	my ($port, $req) = @_;
+	my $sock = IO::Socket::INET->new(
+		Proto    => "tcp",
+		PeerAddr => "127.0.0.1",
+		PeerPort => $port) or return undef;
+	print $sock $req;
+	my $resp = do { local $/; <$sock> };
+	close($sock);
+	return $resp;
+}
+
+# (returns counter from mod_status statistics-url, or undef if not present)
+sub get_statistic {
+	my ($srv, $key) = @_;
+	my $resp = http_request($srv->{PORT},
+	  "GET /server-statistics HTTP/1.0\r\nHost: status.example.org\r\n\r\n");
+	return (defined($resp) && $resp =~ /^\Q$key\E: (-?\d+)\r?$/m) ? $1 : undef;
+}
+
+$ENV{STAT_CACHE_ENGINE} = ($^O eq 'linux') ? 'inotify' : 'simple';
+$ENV{NETWORK_BACKEND}   = ($^O eq 'linux') ? 'linux-io_uring' : 'sendfile';
 ok($tf->start_proc == 0, "Starting lighttpd") or die();
 
 ## Basic Request-Handling
@@ -126,6 +149,79 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, '-HTTP-Content' => '', 'Content-Type' => 'text/html', 'Content-Length' => '6'} ];
 ok($tf->handle_http($t) == 0, 'HEAD request, mimetype text/html, content-length');
 
+$t->{REQUEST}  = ( <<EOF
+GET /12345.txt HTTP/1.0
+Host: 123.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "12345\n", 'Content-Length' => '6', '+ETag' => '' } ];
+ok($tf->handle_http($t) == 0, 'GET request, stat-cache-prewarm entry');
+ok((get_statistic($tf, 'stat-cache.prewarm-entries') || 0) >= 5
+   && (get_statistic($tf, 'stat-cache.prewarm-fds') || 0) == 2,
+   'stat-cache-prewarm: entries pre-warmed at startup, fds held open');
+
+# stat_cache negative entries (ENOENT) and invalidation upon file creation
+# (with inotify, entries remain until invalidated; else for up to 1 sec)
+do {
+	my $pages = $tf->{TESTDIR}.'/tmp/lighttpd/servers/www.example.org/pages';
+	my $fh;
+
+	$t->{REQUEST}  = ( <<EOF
+GET /stat-cache-negative.txt HTTP/1.0
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 404 } ];
+	ok($tf->handle_http($t) == 0 && $tf->handle_http($t) == 0, 'GET request, stat-cache negative entry');
+
+	# (create empty file; no IN_MODIFY for file with inotify, only IN_CREATE)
+	open($fh, '>', "$pages/stat-cache-negative.txt") && close($fh);
+	select(undef, undef, undef, 1.1);
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => '0' } ];
+	ok($tf->handle_http($t) == 0, 'GET request, stat-cache negative entry invalidated by file creation');
+
+	open($fh, '>', "$pages/stat-cache-renamed.txt") && print($fh "renamed over\n") && close($fh);
+	rename("$pages/stat-cache-renamed.txt", "$pages/stat-cache-negative.txt");
+	select(undef, undef, undef, 1.1);
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "renamed over\n", 'Content-Length' => '13' } ];
+	ok($tf->handle_http($t) == 0, 'GET request, stat-cache entry invalidated by rename over file');
+
+	unlink("$pages/stat-cache-negative.txt");
+} while (0);
+
+# stat_cache prefetch of newly monitored dir does not prefetch symlinks;
+# symlink target might be in a dir which is not monitored
+SKIP: {
+	skip "perl does not support symlinks", 1 unless eval { symlink("",""); 1 };
+	my $pages = $tf->{TESTDIR}.'/tmp/lighttpd/servers/www.example.org/pages';
+	my $fh;
+	mkdir("$pages/prefetch");
+	mkdir("$pages/prefetch-target");
+	open($fh, '>', "$pages/prefetch/a.txt") && print($fh "a\n") && close($fh);
+	# (empty target; file with st_size 0 is not opened, so not re-fstat())
+	open($fh, '>', "$pages/prefetch-target/t.txt") && close($fh);
+	symlink("../prefetch-target/t.txt", "$pages/prefetch/link.txt");
+
+	$t->{REQUEST}  = ( <<EOF
+GET /prefetch/a.txt HTTP/1.0
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "a\n" } ];
+	my $ok = ($tf->handle_http($t) == 0);
+
+	# (modify target in dir not monitored; symlink not yet requested)
+	open($fh, '>', "$pages/prefetch-target/t.txt") && print($fh "target modified\n") && close($fh);
+	$t->{REQUEST}  = ( <<EOF
+GET /prefetch/link.txt HTTP/1.0
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "target modified\n", 'Content-Length' => '16' } ];
+	ok($ok && $tf->handle_http($t) == 0, 'GET request, symlink in prefetched dir not stale');
+
+	unlink("$pages/prefetch/link.txt", "$pages/prefetch/a.txt", "$pages/prefetch-target/t.txt");
+	rmdir("$pages/prefetch");
+	rmdir("$pages/prefetch-target");
+}
+
 $t->{REQUEST}  = ( <<EOF
 HEAD http://123.example.org/12345.html HTTP/1.1
 Connection: close
@@ -1394,7 +1490,7 @@ ok($tf->handle_http($t) == 0, 'broken header via perl cgi');
 
 SKIP: {
     my $has_zlib = $tf->has_feature("zlib support");
-    skip "skipping tests requiring zlib", 9 unless $has_zlib;
+    skip "skipping tests requiring zlib", 12 unless $has_zlib;
 
 $t->{REQUEST}  = ( <<EOF
 GET /index.html HTTP/1.0
@@ -1481,9 +1577,74 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, '+Vary' => '', 'Content-Encoding' => 'gzip', 'Content-Type' => "text/plain" } ];
 ok($tf->handle_http($t) == 0, 'bzip2 requested but disabled');
 
+$t->{REQUEST}  = ( <<EOF
+GET /large.txt HTTP/1.0
+Accept-Encoding: gzip
+Host: deflate.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, '+Vary' => '', 'Content-Encoding' => 'gzip', '-Content-Length' => '' } ];
+ok($tf->handle_http($t) == 0, 'gzip - large response compressed in thread pool');
+
+$t->{REQUEST}  = ( <<EOF
+GET /large.txt HTTP/1.0
+Accept-Encoding: gzip
+Host: deflate-cache.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, '+Vary' => '', 'Content-Encoding' => 'gzip', '+Content-Length' => '' } ];
+ok($tf->handle_http($t) == 0, 'gzip - large response saved to cache-dir not offloaded');
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.html HTTP/1.0
+Accept-Encoding: gzip
+Host: deflate-adaptive.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, '+Vary' => '', 'Content-Encoding' => 'gzip', '+Content-Length' => '' } ];
+ok($tf->handle_http($t) == 0, 'gzip - adaptive-level');
+
 }
 
 
+## mod_staticfile static-file.precompressed
+
+$t->{REQUEST}  = ( <<EOF
+GET /subdir/precompressed.txt HTTP/1.0
+Host: precompressed.example.org
+Accept-Encoding: br, gzip
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => '16', 'Content-Encoding' => 'gzip', 'Content-Type' => 'text/plain', 'Vary' => 'Accept-Encoding', '+ETag' => '' } ];
+ok($tf->handle_http($t) == 0, 'precompressed - gzip sidecar file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /subdir/precompressed.txt HTTP/1.0
+Host: precompressed.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => '6', '-Content-Encoding' => '', 'Content-Type' => 'text/plain' } ];
+ok($tf->handle_http($t) == 0, 'precompressed - no Accept-Encoding');
+
+$t->{REQUEST}  = ( <<EOF
+GET /subdir/precompressed.txt HTTP/1.0
+Host: precompressed.example.org
+Accept-Encoding: br
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => '6', '-Content-Encoding' => '' } ];
+ok($tf->handle_http($t) == 0, 'precompressed - no br sidecar file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /subdir/precompressed.txt HTTP/1.0
+Host: precompressed.example.org
+Accept-Encoding: gzip;q=0, deflate
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => '6', '-Content-Encoding' => '' } ];
+ok($tf->handle_http($t) == 0, 'precompressed - gzip;q=0');
+
+
 ## mod_expire
 
 $t->{REQUEST} = ( <<EOF
@@ -1584,11 +1745,483 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '/some+test%3Axxx%20with%20space' } ];
 ok($tf_proxy->handle_http($t) == 0, 'rewrited urls work with encoded path');
 
+$t->{REQUEST}  = ( <<EOF
+HEAD /12345.html HTTP/1.0
+Host: 123.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, '-HTTP-Content' => '', 'Content-Length' => '6'} ];
+ok($tf_proxy->handle_http($t) == 0, 'HEAD request on reused backend connection');
+
+$t->{REQUEST}  = ( <<EOF
+GET /12345.html HTTP/1.0
+Host: 123.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '12345'."\n" } ];
+ok($tf_proxy->handle_http($t) == 0, 'GET request on reused backend connection');
+
+# (backend REMOTE_PORT identifies the connection from proxy to backend)
+my $remote_port = sub {
+	my $resp = http_request($tf_proxy->{PORT}, "GET /cgi.pl?env=REMOTE_PORT HTTP/1.0\r\n".$_[0]."\r\n");
+	return (defined($resp) && $resp =~ /\r\n\r\n(\d+)$/) ? $1 : -1;
+};
+my $port1 = $remote_port->("Host: www.example.org\r\n");
+my $port2 = $remote_port->("Host: www.example.org\r\n");
+ok($port1 > 0 && $port1 == $port2, 'backend connection reused');
+
+# request without Host is sent to backend as HTTP/1.0 without keep-alive;
+# it must not check out (and then close) the idle backend connection
+my $port3 = $remote_port->("");
+my $port4 = $remote_port->("Host: www.example.org\r\n");
+ok($port3 > 0 && $port3 != $port1 && $port4 == $port1, 'idle backend connection not used for request without keep-alive');
+
+# handler ctx of proxied requests is allocated from per-request arena
+# (same allocation for each request; fits in arena block)
+do {
+	my $bytes = get_statistic($tf_proxy, 'request.arena-bytes') || 0;
+	for (1..4) {
+		http_request($tf_proxy->{PORT}, "GET /12345.html HTTP/1.0\r\nHost: 123.example.org\r\n\r\n");
+	}
+	my $delta = (get_statistic($tf_proxy, 'request.arena-bytes') || 0) - $bytes;
+	ok($delta > 0 && 0 == $delta % 4
+	   && !get_statistic($tf_proxy, 'request.arena-overflow'),
+	   "request arena backs proxy handler ctx ($delta bytes / 4 requests)");
+} while (0);
+
+# (see tests/prepare.sh)
+my $large = join('', map { "$_ 0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmn\n" } 0..4095);
+$t->{REQUEST}  = ( <<EOF
+GET /large.txt HTTP/1.0
+Host: www.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => length($large), 'HTTP-Content' => $large } ];
+my $relayed = get_statistic($tf_proxy, 'response.splice-relay') || 0;
+ok($tf_proxy->handle_http($t) == 0, 'GET large response relayed through pipe');
+ok((get_statistic($tf_proxy, 'response.splice-relay') || 0) > $relayed, 'response.splice-relay: response body spliced through pipe');
+
+# proxy.balance = "p2c-ewma" sends requests to backend with lower
+# (load x average time to first response byte)
+SKIP: {
+	skip "unix domain sockets", 2 if $^O eq 'MSWin32' || $^O eq 'cygwin' || $^O eq 'msys';
+	require IO::Socket::UNIX;
+	my $sock = $tf->{TESTDIR}.'/tmp/p2c-slow.sock';
+	unlink($sock);
+	my $srv = IO::Socket::UNIX->new(Type => SOCK_STREAM(), Local => $sock, Listen => 8);
+	my $pid = $srv ? fork() : undef;
+	if (defined($pid) && 0 == $pid) {
+		$SIG{PIPE} = 'IGNORE';
+		while (my $c = $srv->accept()) {
+			my $req = '';
+			while ($req !~ /\r\n\r\n/ && sysread($c, $req, 1024, length($req))) {}
+			select(undef, undef, undef, 0.25);
+			print $c "HTTP/1.0 200 OK\r\nContent-Length: 5\r\n\r\nslow\n";
+			close($c);
+		}
+		require POSIX;
+		POSIX::_exit(0);
+	}
+	my ($fast, $slow, $other) = (0, 0, 0);
+	for (1..20) {
+		my $resp = http_request($tf_proxy->{PORT}, "GET /p2c/12345.html HTTP/1.0\r\nHost: 123.example.org\r\n\r\n");
+		if (!defined($resp)) { ++$other; }
+		elsif ($resp =~ /\r\n\r\n12345\n$/) { ++$fast; }
+		elsif ($resp =~ /\r\n\r\nslow\n$/) { ++$slow; }
+		else { ++$other; }
+	}
+	kill('KILL', $pid) && waitpid($pid, 0) if $pid;
+	close($srv) if $srv;
+	unlink($sock);
+	ok(0 == $other && 20 == $fast + $slow, 'p2c-ewma: all requests served');
+	# (backend without samples is costed at other's average, so slow backend
+	#  is chosen only until its first response time sample)
+	ok($slow <= 1, "p2c-ewma: slow backend avoided (fast: $fast, slow: $slow)");
+}
+
 ok($tf_proxy->stop_proc == 0, "Stopping lighttpd proxy");
 
 } while (0);
 
 
+## gw_backend active health checks
+
+SKIP: {
+	skip "unix domain sockets", 4 if $^O eq 'MSWin32' || $^O eq 'cygwin' || $^O eq 'msys';
+
+	require IO::Socket::UNIX;
+	my $tf_hc = LightyTest->new();
+	$tf_hc->{CONFIGFILE} = 'health-check.conf';
+	my $sock = $tf->{TESTDIR}.'/tmp/health-check.sock';
+	my $log  = $tf->{TESTDIR}.'/tmp/lighttpd/logs/health-check.error.log';
+	unlink($sock);
+
+	ok($tf_hc->start_proc == 0, "Starting lighttpd with health checks") or last;
+
+	# (health checks run once per sec; wait for message in error log)
+	my $wait_log = sub {
+		for (1..50) {
+			my $fh;
+			if (open($fh, '<', $log)) {
+				my $found = grep { /\Q$_[0]\E/ } <$fh>;
+				close($fh);
+				return 1 if $found;
+			}
+			select(undef, undef, undef, 0.1);
+		}
+		return 0;
+	};
+	my $backend = sub {
+		my $resp = http_request($tf_hc->{PORT}, "GET /backend/ HTTP/1.0\r\n\r\n");
+		return (defined($resp) && $resp =~ m{^HTTP/1\.\d (\d+)}) ? $1 : 0;
+	};
+
+	ok($wait_log->('health check failed (connect); gw-server disabled')
+	   && 503 == $backend->(), 'health check: dead backend marked down');
+
+	# (backend in child process; answers requests until killed)
+	my $srv = IO::Socket::UNIX->new(Type => SOCK_STREAM(), Local => $sock, Listen => 8);
+	my $pid = $srv ? fork() : undef;
+	if (defined($pid) && 0 == $pid) {
+		# (health checks connect and close without sending a request)
+		$SIG{PIPE} = 'IGNORE';
+		while (my $c = $srv->accept()) {
+			my $req = '';
+			while ($req !~ /\r\n\r\n/ && sysread($c, $req, 1024, length($req))) {}
+			print $c "HTTP/1.0 200 OK\r\nContent-Length: 3\r\n\r\nok\n"
+			  if $req =~ /\r\n\r\n/;
+			close($c);
+		}
+		require POSIX;
+		POSIX::_exit(0);
+	}
+	ok($wait_log->('health check passed; gw-server re-enabled')
+	   && 200 == $backend->(), 'health check: backend marked up again');
+	kill('KILL', $pid) && waitpid($pid, 0) if $pid;
+	close($srv) if $srv;
+	unlink($sock);
+
+	# unix socket listening, but backlog full (connect() EAGAIN):
+	# soft fail; backend cooled down (overloaded), not treated as up
+	my $overloaded = get_statistic($tf_hc, 'gw.backend.hc.0.overloaded') || 0;
+	$srv = IO::Socket::UNIX->new(Type => SOCK_STREAM(), Local => $sock, Listen => 0);
+	my @fill;
+	for (1..8) {
+		my $c = IO::Socket::UNIX->new(Type => SOCK_STREAM());
+		$c->blocking(0);
+		last unless connect($c, Socket::pack_sockaddr_un($sock));
+		push(@fill, $c);
+	}
+	my $n = 0;
+	for (1..50) {
+		$n = get_statistic($tf_hc, 'gw.backend.hc.0.overloaded') || 0;
+		last if $n > $overloaded;
+		select(undef, undef, undef, 0.1);
+	}
+	ok($n > $overloaded && $wait_log->('health check: backlog full'),
+	   'health check: full backlog cools down backend');
+	close($_) for (@fill);
+	close($srv) if $srv;
+	unlink($sock);
+
+	$tf_hc->stop_proc;
+}
+
+
+## server.stat-cache-shared
+
+do {
+
+my $tf_shared = LightyTest->new();
+$tf_shared->{CONFIGFILE} = 'stat-cache-shared.conf';
+$tf_shared->{SETSID} = 1; # (server.max-worker)
+
+ok($tf_shared->start_proc == 0, "Starting lighttpd with shared stat_cache") or last;
+
+my $file = $tf->{TESTDIR}.'/tmp/lighttpd/servers/www.example.org/pages/stat-cache-shared.txt';
+my $fh;
+open($fh, '>', $file) && print($fh "one\n") && close($fh);
+
+# (requests are accepted by either worker; repeat to reach both workers)
+$t->{REQUEST}  = ( <<EOF
+GET /stat-cache-shared.txt HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "one\n" } ];
+ok(0 == grep({ $tf_shared->handle_http($t) } 1..4), 'shared stat_cache: file served by workers');
+
+# (workers may serve stale entry for up to 1 sec after change)
+open($fh, '>', $file) && print($fh "changed\n") && close($fh);
+select(undef, undef, undef, 1.1);
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "changed\n" } ];
+ok(0 == grep({ $tf_shared->handle_http($t) } 1..4), 'shared stat_cache: file modified');
+
+unlink($file);
+select(undef, undef, undef, 1.1);
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 404 } ];
+ok(0 == grep({ $tf_shared->handle_http($t) } 1..4), 'shared stat_cache: file removed');
+
+ok($tf_shared->stop_proc == 0, "Stopping lighttpd with shared stat_cache");
+
+} while (0);
+
+
+## server.max-worker
+
+do {
+
+my $tf_mw = LightyTest->new();
+$tf_mw->{CONFIGFILE} = 'max-worker.conf';
+$tf_mw->{SETSID} = 1; # (server.max-worker)
+my $max_worker = sub {
+	my $fh;
+	open($fh, '>', $tf->{TESTDIR}.'/tmp/lighttpd/max-worker-n.conf')
+	  && print($fh "server.max-worker = $_[0]\n") && close($fh);
+};
+$max_worker->(1);
+local $ENV{EPHEMERAL_PORT} = LightyTest->get_ephemeral_tcp_port();
+ok($tf_mw->start_proc == 0
+   && 0 == $tf_mw->wait_for_port_with_proc($ENV{EPHEMERAL_PORT}, $tf_mw->{LIGHTTPD_PID}),
+   "Starting lighttpd with server.max-worker") or last;
+$tf_mw->{PORT} = $ENV{EPHEMERAL_PORT};
+
+# (number of listen sockets on port; -1 if unknown)
+my $listeners = sub {
+	my $fh;
+	open($fh, '<', '/proc/net/tcp') or return -1;
+	my $port = sprintf(':%04X ', $tf_mw->{PORT});
+	return scalar grep { /^\s*\d+: [0-9A-F]{8}\Q$port\E[0-9A-F:]+ 0A / } <$fh>;
+};
+
+# graceful restart from max-worker 1 to 2 creates SO_REUSEPORT group
+# (listen socket was created with SO_REUSEPORT while max-worker was 1)
+SKIP: {
+	skip "no /proc/net/tcp", 1 if $listeners->() < 0;
+	$max_worker->(2);
+	kill('USR1', $tf_mw->{LIGHTTPD_PID});
+	my $i = 0;
+	select(undef, undef, undef, 0.1) while $listeners->() != 2 && ++$i < 50;
+	ok($listeners->() == 2, 'server.reuseport-workers: listen socket per worker after graceful restart');
+}
+
+# (each request on new connection; connections are distributed to workers)
+my $n = 40;
+my $ok = grep({ (http_request($tf_mw->{PORT}, "GET /index.html HTTP/1.0\r\n\r\n") // '') =~ m{^HTTP/1\.0 200 } } 1..$n);
+ok($ok == $n, 'server.max-worker: requests served by workers');
+
+# (workers add counters to shared counters once per second)
+select(undef, undef, undef, 2.1);
+my $status = http_request($tf_mw->{PORT}, "GET /server-status?auto HTTP/1.0\r\n\r\n") // '';
+my ($total) = $status =~ /^Total Accesses: (\d+)$/m;
+ok(defined($total) && $total == $n, 'mod_status: requests summed across workers')
+  or diag("\nTotal Accesses: ".($total // 'none'));
+
+# chunk pool statistics are summed across workers
+# (each worker publishes its pool statistics once per second)
+do {
+	my $stats = http_request($tf_mw->{PORT}, "GET /server-statistics HTTP/1.0\r\n\r\n") // '';
+	my ($nworkers) = $stats =~ /^chunkqueue\.pool-workers: (\d+)$/m;
+	ok(($nworkers // 0) == 2, 'mod_status: chunk pool statistics summed across workers')
+	  or diag("\nchunkqueue.pool-workers: ".($nworkers // 'none'));
+} while (0);
+
+# chunk buffers (chunkqueue-chunk-sz is hugepage size) allocated by pinned
+# worker are hugepage-backed and bound to local NUMA node
+SKIP: {
+	my $fh;
+	my $thp = open($fh, '<', '/sys/kernel/mm/transparent_hugepage/enabled')
+	  ? <$fh> : '[never]';
+	skip "transparent hugepages not available", 2 if $thp =~ /\[never\]/;
+	my $stats = http_request($tf_mw->{PORT}, "GET /server-statistics HTTP/1.0\r\n\r\n") // '';
+	my ($allocs) = $stats =~ /^chunkqueue\.hugepage-allocs: (\d+)$/m;
+	my ($binds) = $stats =~ /^chunkqueue\.hugepage-numa-binds: (\d+)$/m;
+	ok(($allocs // 0) > 0, 'chunkqueue.hugepages: chunk buffers hugepage-backed')
+	  or diag("\nchunkqueue.hugepage-allocs: ".($allocs // 'none'));
+	skip "no NUMA support", 1 unless -d '/sys/devices/system/node/node0';
+	ok(($binds // 0) > 0, 'chunkqueue.hugepages: chunk buffers bound to local NUMA node')
+	  or diag("\nchunkqueue.hugepage-numa-binds: ".($binds // 'none'));
+}
+
+ok($tf_mw->stop_proc == 0, "Stopping lighttpd with server.max-worker");
+
+} while (0);
+
+
+## mod_openssl session cache and session ticket keys shared between workers
+
+SKIP: {
+	my $openssl = qx{openssl version 2>&1};
+	skip "no mod_openssl or openssl command", 6
+	  if $tf->{'win32native'}
+	  || !$tf->has_feature("OpenSSL support")
+	  || !defined($openssl) || $? != 0
+	  || !-x $tf->{BASEDIR}."/tests/fcgi-responder";
+
+	my $dir = $tf->{TESTDIR}.'/tmp/lighttpd';
+	system("openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost"
+	      ." -keyout '$dir/ssl-key.pem' -out '$dir/ssl-cert.pem' >/dev/null 2>&1");
+
+	my $tf_ssl = LightyTest->new();
+	$tf_ssl->{CONFIGFILE} = 'openssl.conf';
+	$tf_ssl->{SETSID} = 1; # (server.max-worker)
+	local $ENV{EPHEMERAL_PORT} = LightyTest->get_ephemeral_tcp_port();
+	ok($tf_ssl->start_proc == 0, "Starting lighttpd with mod_openssl") or last;
+
+	# (returns "New" or "Reused" from openssl s_client output)
+	my $s_client = sub {
+		my $out = qx{openssl s_client -connect 127.0.0.1:$tf_ssl->{PORT} -tls1_2 @_ </dev/null 2>/dev/null};
+		return $out =~ /^(New|Reused), /m ? $1 : '';
+	};
+
+	# (connections are accepted by either worker; repeat to reach both)
+	my $tickets = "$dir/ssl-sess-ticket.pem";
+	my $sess_id = "$dir/ssl-sess-id.pem";
+	ok($s_client->("-sess_out '$tickets'") eq 'New'
+	   && 4 == grep({ $s_client->("-sess_in '$tickets'") eq 'Reused' } 1..4),
+	   'TLS session ticket resumed by workers');
+	ok($s_client->("-no_ticket -sess_out '$sess_id'") eq 'New'
+	   && 4 == grep({ $s_client->("-no_ticket -sess_in '$sess_id'") eq 'Reused' } 1..4),
+	   'TLS session id resumed by workers (ssl.session-cache)');
+
+	# (workers which issued sessions are killed and replaced with workers
+	#  forked from parent, which has not seen those sessions; session id is
+	#  resumed only if found in session cache shared by workers)
+	my $workers = sub {
+		my @pids;
+		for my $stat (glob('/proc/[0-9]*/stat')) {
+			my $fh;
+			open($fh, '<', $stat) or next;
+			my @f = split(/ /, <$fh> // '');
+			push(@pids, $f[0]) if ($f[3] // 0) == $tf_ssl->{LIGHTTPD_PID} && ($f[1] // '') eq '(lighttpd)';
+		}
+		return @pids;
+	};
+	SKIP: {
+		my @pids = $workers->();
+		skip "no /proc", 1 unless @pids;
+		my $sess_id2 = "$dir/ssl-sess-id2.pem";
+		$s_client->("-no_ticket -sess_out '$sess_id2'");
+		kill('KILL', @pids);
+		my $i = 0;
+		select(undef, undef, undef, 0.1)
+		  while (grep({ my $p = $_; !grep { $_ == $p } @pids } $workers->()) < 2 && ++$i < 50);
+		ok(4 == grep({ $s_client->("-no_ticket -sess_in '$sess_id2'") eq 'Reused' } 1..4),
+		   'TLS session id resumed by replacement workers (shared session cache)');
+	}
+
+	# (shared memory is kept across graceful restart)
+	kill('USR1', $tf_ssl->{LIGHTTPD_PID});
+	select(undef, undef, undef, 1.5);
+	ok(4 == grep({ $s_client->("-sess_in '$tickets'") eq 'Reused' } 1..4)
+	   && 4 == grep({ $s_client->("-no_ticket -sess_in '$sess_id'") eq 'Reused' } 1..4),
+	   'TLS sessions resumed after graceful restart');
+
+	ok($tf_ssl->stop_proc == 0, "Stopping lighttpd with mod_openssl");
+}
+
+
+## server.network-backend = "linux-io_uring"
+
+SKIP: {
+	skip "server.network-backend linux-io_uring requires linux", 3
+	  if $ENV{NETWORK_BACKEND} ne 'linux-io_uring' || !-x '/bin/dd';
+
+	require IO::Handle;
+	my $file = $tf->{TESTDIR}.'/tmp/lighttpd/servers/www.example.org/pages/io_uring.txt';
+	my $data = join('', map { sprintf("%07d io_uring async read\n", $_) } 0..32767);
+	# (write file and evict it from page cache so that sendfile() would block)
+	my $evict = sub {
+		my $fh;
+		open($fh, '>', $file) && print($fh $data) && $fh->sync() && close($fh)
+		  && 0 == system("dd if='$file' iflag=nocache count=0 2>/dev/null");
+	};
+
+	my $reads = get_statistic($tf, 'network.io_uring-reads') || 0;
+	$t->{REQUEST}  = ( <<EOF
+GET /io_uring.txt HTTP/1.0
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => length($data), 'HTTP-Content' => $data } ];
+	# (the RWF_NOWAIT page cache probe may itself start kernel readahead,
+	#  which can complete before the probe returns; retry a few times)
+	my ($ok, $async);
+	for (1..10) {
+		$evict->();
+		last unless ($ok = ($tf->handle_http($t) == 0));
+		last if ($async = ((get_statistic($tf, 'network.io_uring-reads') || 0) > $reads));
+	}
+	ok($ok, 'linux-io_uring: file not in page cache');
+
+	skip "io_uring unavailable", 2
+	  if !defined(get_statistic($tf, 'network.io_uring-reads'))
+	  && `grep -c 'io_uring setup failed' '$tf->{TESTDIR}/tmp/lighttpd/logs/lighttpd.error.log'` > 0;
+	ok($async, 'linux-io_uring: file read asynchronously');
+
+	# (client closes connection while read may be in flight; op is released
+	#  or cancelled with chunk, and op slot and buffer are reused afterwards)
+	for (1..4) {
+		$evict->();
+		my $sock = IO::Socket::INET->new(
+			Proto    => "tcp",
+			PeerAddr => "127.0.0.1",
+			PeerPort => $tf->{PORT});
+		print $sock "GET /io_uring.txt HTTP/1.0\r\n\r\n" if $sock;
+		close($sock) if $sock;
+	}
+	$evict->();
+	ok($tf->handle_http($t) == 0, 'linux-io_uring: file served after aborted reads');
+	unlink($file);
+}
+
+
+## connection timeouts
+
+do {
+
+require Time::HiRes;
+require IO::Select;
+
+# (read response with Content-Length; returns 1 if 200 OK)
+my $read_response = sub {
+	my ($sock) = @_;
+	my ($resp, $len) = ('', undef);
+	do {
+		return 0 unless IO::Select->new($sock)->can_read(5);
+		return 0 unless sysread($sock, $resp, 4096, length($resp));
+		my $hlen = index($resp, "\r\n\r\n");
+		$len = $hlen + 4 + ($resp =~ /\r\nContent-Length: (\d+)\r\n/i ? $1 : 0)
+		  if $hlen >= 0;
+	} while (!defined($len) || length($resp) < $len);
+	return $resp =~ m{^HTTP/1\.1 200 } ? 1 : 0;
+};
+
+my $sock =
+	IO::Socket::INET->new(
+		Proto    => "tcp",
+		PeerAddr => "127.0.0.1",
+		PeerPort => $tf->{PORT});
+my $req = "GET /index.html HTTP/1.1\r\nHost: keep-alive-idle.example.org\r\n\r\n";
+
+# second request on connection before keep-alive idle timeout of first
+# extends the timeout (connection deadline is rescheduled)
+my $ok = defined($sock) && syswrite($sock, $req) && $read_response->($sock);
+select(undef, undef, undef, 1.5) if $ok;
+$ok = $ok && syswrite($sock, $req) && $read_response->($sock);
+ok($ok, 'keep-alive request before server.max-keep-alive-idle');
+
+# (timeouts are checked at second boundaries;
+#  closed 2 to 3 secs after last request with max-keep-alive-idle = 2)
+my $ts = Time::HiRes::time();
+my $eof = $ok && IO::Select->new($sock)->can_read(6)
+              && 0 == sysread($sock, my $buf, 1);
+my $elapsed = Time::HiRes::time() - $ts;
+ok($eof && $elapsed >= 1.9 && $elapsed < 4.5, 'connection closed after server.max-keep-alive-idle')
+  or diag(sprintf("\nclosed: %s, after %.2f secs", $eof ? 'yes' : 'no', $elapsed));
+close($sock) if defined($sock);
+
+} while (0);
+
+
 ## mod_setenv
 
 $t->{REQUEST} = ( <<EOF